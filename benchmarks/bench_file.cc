@@ -2,34 +2,123 @@
 // ALOX-CC
 //
 
+#include <sstream>
+
 #include <benchmark/benchmark.h>
 
 #include "alox.hh"
+#include "aot.hh"
+
+using namespace alox;
 
 template <typename... ExtraArgs>
-static void BM_Test(benchmark::State &state, ExtraArgs &&...extra_args) {
+static void BM_Test(benchmark::State &state, bool switch_dispatch, bool registers,
+                    bool jit, ExtraArgs &&...extra_args) {
     // Perform setup here
-
-    Options options;
-    Alox    alox(options);
+    std::ostringstream out;
+    Options            options(out, std::cin, std::cerr);
+    options.switch_dispatch = switch_dispatch;
+    options.registers = registers;
+    options.jit = jit;
+    Alox alox(options);
 
     for (auto _ : state) {
         // This code gets timed
         alox.runFile(extra_args...);
+        out.str("");
+    }
+}
+
+// Run file with the given number of workers for spawned functions.
+static void BM_Workers(benchmark::State &state, const char *file) {
+    std::ostringstream out;
+    Options            options(out, std::cin, std::cerr);
+    options.workers = uint32_t(state.range(0));
+    Alox alox(options);
+
+    for (auto _ : state) {
+        alox.runFile(file);
+        out.str("");
     }
 }
 
-BENCHMARK_CAPTURE(BM_Test, binary_trees, "../benchmarks/binary_trees.lox");
-BENCHMARK_CAPTURE(BM_Test, equality, "../benchmarks/equality.lox");
-BENCHMARK_CAPTURE(BM_Test, fib, "../benchmarks/fib.lox");
-BENCHMARK_CAPTURE(BM_Test, instantiation, "../benchmarks/instantiation.lox");
-BENCHMARK_CAPTURE(BM_Test, invocation, "../benchmarks/invocation.lox");
-BENCHMARK_CAPTURE(BM_Test, method_call, "../benchmarks/method_call.lox");
-BENCHMARK_CAPTURE(BM_Test, properties, "../benchmarks/properties.lox");
-// BENCHMARK_CAPTURE(BM_Test, string_equality, "../benchmarks/string_equality.lox");
-BENCHMARK_CAPTURE(BM_Test, trees, "../benchmarks/trees.lox");
-BENCHMARK_CAPTURE(BM_Test, zoo_batch, "../benchmarks/zoo_batch.lox");
-BENCHMARK_CAPTURE(BM_Test, zoo, "../benchmarks/zoo.lox");
+static void BM_Aot(benchmark::State &state, const AotProgram &program) {
+    std::ostringstream out;
+    Options            options(out, std::cin, std::cerr);
+    options.jit = false;
+    Alox alox(options);
+
+    for (auto _ : state) {
+        alox.runAot(program);
+        out.str("");
+    }
+}
+
+// The benchmarks compiled by alox --emit-cpp.
+#define AOT_PROGRAM(name) extern const AotProgram alox_aot_##name
+AOT_PROGRAM(binary_trees);
+AOT_PROGRAM(characters);
+AOT_PROGRAM(closures);
+AOT_PROGRAM(equality);
+AOT_PROGRAM(fib);
+AOT_PROGRAM(generators);
+AOT_PROGRAM(instantiation);
+AOT_PROGRAM(invocation);
+AOT_PROGRAM(method_call);
+AOT_PROGRAM(parallel);
+AOT_PROGRAM(properties);
+AOT_PROGRAM(sequential);
+AOT_PROGRAM(string_equality);
+AOT_PROGRAM(trees);
+AOT_PROGRAM(zoo_batch);
+AOT_PROGRAM(zoo);
+
+// Run each file with the switch loop, the register VM, when built threaded dispatch, and
+// compiled ahead of time, all without the JIT so that the loops are compared. The _jit
+// runs are the default loop with the JIT.
+#ifdef COMPUTED_GOTO
+#define BENCHMARK_FILE(name, file)                                                       \
+    BENCHMARK_CAPTURE(BM_Test, name##_switch, true, false, false, file);                 \
+    BENCHMARK_CAPTURE(BM_Test, name##_registers, true, true, false, file);               \
+    BENCHMARK_CAPTURE(BM_Test, name##_threaded, false, false, false, file);              \
+    BENCHMARK_CAPTURE(BM_Test, name##_jit, false, false, true, file);                    \
+    BENCHMARK_CAPTURE(BM_Aot, name##_aot, alox_aot_##name)
+#else
+#define BENCHMARK_FILE(name, file)                                                       \
+    BENCHMARK_CAPTURE(BM_Test, name##_switch, true, false, false, file);                 \
+    BENCHMARK_CAPTURE(BM_Test, name##_registers, true, true, false, file);               \
+    BENCHMARK_CAPTURE(BM_Test, name##_jit, true, false, true, file);                     \
+    BENCHMARK_CAPTURE(BM_Aot, name##_aot, alox_aot_##name)
+#endif
+
+BENCHMARK_FILE(binary_trees, "../benchmarks/binary_trees.lox");
+BENCHMARK_FILE(characters, "../benchmarks/characters.lox");
+BENCHMARK_FILE(closures, "../benchmarks/closures.lox");
+BENCHMARK_FILE(equality, "../benchmarks/equality.lox");
+BENCHMARK_FILE(fib, "../benchmarks/fib.lox");
+BENCHMARK_FILE(generators, "../benchmarks/generators.lox");
+BENCHMARK_FILE(instantiation, "../benchmarks/instantiation.lox");
+BENCHMARK_FILE(invocation, "../benchmarks/invocation.lox");
+BENCHMARK_FILE(method_call, "../benchmarks/method_call.lox");
+BENCHMARK_FILE(properties, "../benchmarks/properties.lox");
+BENCHMARK_FILE(string_equality, "../benchmarks/string_equality.lox");
+BENCHMARK_FILE(trees, "../benchmarks/trees.lox");
+BENCHMARK_FILE(zoo_batch, "../benchmarks/zoo_batch.lox");
+BENCHMARK_FILE(zoo, "../benchmarks/zoo.lox");
+
+// The main thread waits while the workers run, so parallel is timed by the clock. It
+// runs with 1 to 8 workers, against sequential making the same calls on one thread.
+#define PARALLEL_FILE "../benchmarks/parallel.lox"
+BENCHMARK_FILE(sequential, "../benchmarks/sequential.lox");
+BENCHMARK_CAPTURE(BM_Workers, parallel, PARALLEL_FILE)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_Test, parallel_registers, true, true, false, PARALLEL_FILE)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_Aot, parallel_aot, alox_aot_parallel)->UseRealTime();
 
 // Run the benchmark
-BENCHMARK_MAIN();
\ No newline at end of file
+BENCHMARK_MAIN();
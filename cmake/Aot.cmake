@@ -0,0 +1,45 @@
+# Lox programs compiled ahead of time with alox --emit-cpp.
+
+# The generated C++ for each lox file, named after the file, in the current binary
+# directory. The list of files is put in OUTPUT_VAR.
+function(alox_emit_cpp OUTPUT_VAR)
+  set(outputs)
+  foreach(lox_file ${ARGN})
+    get_filename_component(lox_path ${lox_file} ABSOLUTE)
+    get_filename_component(name ${lox_file} NAME_WE)
+    set(cpp_file ${CMAKE_CURRENT_BINARY_DIR}/${name}.cc)
+    add_custom_command(
+      OUTPUT ${cpp_file}
+      COMMAND alox --emit-cpp ${cpp_file} ${lox_path}
+      DEPENDS alox ${lox_path}
+      COMMENT "Compiling ${name}.lox to C++")
+    list(APPEND outputs ${cpp_file})
+  endforeach()
+  set(${OUTPUT_VAR} ${outputs} PARENT_SCOPE)
+endfunction()
+
+# aloxc file.lox executable: compiles a lox program to an executable outside the build,
+# with the compiler and libraries of this build. Used by the xtests with ALOX_AOT set.
+function(alox_add_compiler_script)
+  set(includes "$<TARGET_PROPERTY:lox,INCLUDE_DIRECTORIES>")
+  set(definitions "$<TARGET_PROPERTY:lox,INTERFACE_COMPILE_DEFINITIONS>")
+  file(
+    GENERATE
+    OUTPUT ${CMAKE_BINARY_DIR}/aloxc
+    CONTENT
+      "#!/bin/sh
+# Made by CMake: compile a lox program to an executable.
+set -e
+work=$(mktemp -d)
+trap 'rm -rf \"$work\"' EXIT
+cpp_file=\"$work/program.cc\"
+\"$<TARGET_FILE:alox>\" --emit-cpp \"$cpp_file\" \"$1\"
+${CMAKE_CXX_COMPILER} -std=c++23 -O2 $<$<BOOL:${definitions}>:-D$<JOIN:${definitions}, -D>> \\
+  -I$<JOIN:${includes}, -I> \"$cpp_file\" -o \"$2\" \\
+  $<TARGET_FILE:lox> $<TARGET_FILE:replxx> $<TARGET_FILE:fmt> \\
+  -L${ICU_LIBRARY_DIRS} -licuuc
+"
+    FILE_PERMISSIONS OWNER_READ OWNER_WRITE OWNER_EXECUTE GROUP_READ GROUP_EXECUTE
+                     WORLD_READ WORLD_EXECUTE)
+  install(PROGRAMS ${CMAKE_BINARY_DIR}/aloxc DESTINATION bin)
+endfunction()
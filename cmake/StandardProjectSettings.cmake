@@ -50,4 +50,3 @@ CPMAddPackage("gh:fmtlib/fmt#10.0.0")
 CPMAddPackage("gh:AmokHuginnsson/replxx#release-0.0.4")
 CPMAddPackage("gh:nemtrif/utfcpp#v3.2.1")
 CPMAddPackage("gh:CLIUtils/CLI11#v2.3.0")
-CPMAddPackage("gh:ivmai/bdwgc#v8.2.4")
\ No newline at end of file
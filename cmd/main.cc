@@ -4,25 +4,21 @@
 
 #include <iostream>
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wcast-align"
-#include <gc_cpp.h>
-#pragma clang diagnostic pop
-
 #include "alox.hh"
 #include "options.hh"
 
 int main(int argc, const char *argv[]) {
-
-    GC_INIT();
-
     alox::Options options(std::cout, std::cin, std::cerr);
-    getOptions(argc, argv, options);
+    if (const int status = getOptions(argc, argv, options); status != 0) {
+        return status;
+    }
 
     alox::Alox alox(options);
 
     if (options.file_name.empty()) {
         alox.repl();
+    } else if (!options.emit_cpp.empty()) {
+        return alox.emitCpp(options.file_name, options.emit_cpp);
     } else {
         return alox.runFile(options.file_name);
     }
@@ -16,7 +16,9 @@
 #include <unistd.h>
 
 #include "alox.hh"
+#include "aot.hh"
 #include "compiler.hh"
+#include "debug.hh"
 #include "error.hh"
 #include "memory.hh"
 #include "parser.hh"
@@ -69,6 +71,20 @@ std::string Alox::readFile(const std::string_view &path) {
     return buffer;
 }
 
+namespace {
+
+int exitStatus(InterpretResult result) {
+    if (result == INTERPRET_PARSE_ERROR || result == INTERPRET_COMPILE_ERROR) {
+        return 65;
+    }
+    if (result == INTERPRET_RUNTIME_ERROR) {
+        return 70;
+    }
+    return 0;
+}
+
+} // namespace
+
 int Alox::runFile(const std::string_view &path) {
     InterpretResult result{INTERPRET_OK};
     try {
@@ -78,25 +94,84 @@ int Alox::runFile(const std::string_view &path) {
         std::cerr << e.what() << '\n';
         return 74;
     }
+    return exitStatus(result);
+};
 
-    if (result == INTERPRET_COMPILE_ERROR) {
+/**
+ * @brief Write the program in the file as C++, to be built into an executable with the
+ * lox library. See AotEmitter.
+ */
+int Alox::emitCpp(const std::string_view &path, const std::string &output) {
+    std::string source;
+    try {
+        source = readFile(path);
+    } catch (std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 74;
+    }
+    // The errors of a program that still compiled are reported again when it runs.
+    InterpretResult    error{INTERPRET_OK};
+    std::ostringstream messages;
+    ObjFunction       *function = compile(source, error, messages);
+    options.err << messages.str();
+    if (function == nullptr) {
         return 65;
     }
-    if (result == INTERPRET_RUNTIME_ERROR) {
-        return 70;
+    std::ofstream os(output);
+    AotEmitter(os).emit(function, source, messages.str(),
+                        std::filesystem::path(path).stem().string(), vm.get_globals());
+    if (!os) {
+        std::cerr << fmt::format("can't write {}.\n", output);
+        return 74;
     }
     return 0;
-};
+}
+
+/**
+ * @brief Run a program made by --emit-cpp. Its functions are made from the chunks it has,
+ * each with its C++.
+ */
+int Alox::runAot(const AotProgram &program) {
+    ObjFunction *function = nullptr;
+    {
+        const Heap::Scope scope(vm.get_heap());
+        function = aotLoad(program, vm.get_globals());
+        if (function == nullptr) {
+            options.err << "The program was made by a different version of alox.\n";
+            return 65;
+        }
+        vm.addProgram(program.source, function);
+    }
+    options.err << program.errors;
+    return exitStatus(vm.run(function));
+}
 
 InterpretResult Alox::runString(const std::string &source) {
+    InterpretResult error{INTERPRET_OK};
+    ObjFunction    *function = compile(source, error, options.err);
+    if (function == nullptr) {
+        return error;
+    }
+    InterpretResult result = vm.run(function);
+    if (options.cache_stats) {
+        dumpInlineCaches(options.err, function);
+    }
+    return result;
+}
+
+// Returns nullptr with the error if the source doesn't parse or compile.
+ObjFunction *Alox::compile(const std::string &source, InterpretResult &error,
+                           std::ostream &err) {
+    const Heap::Scope scope(vm.get_heap());
 
     auto scanner = Scanner(source);
-    auto errors = ErrorManager(options.err);
+    auto errors = ErrorManager(err);
     auto parser = Parser(scanner, errors);
 
     auto ast = parser.parse();
     if (errors.hadError) {
-        return INTERPRET_PARSE_ERROR;
+        error = INTERPRET_PARSE_ERROR;
+        return nullptr;
     }
     if (options.parse) {
         std::stringstream os;
@@ -105,13 +180,13 @@ InterpretResult Alox::runString(const std::string &source) {
         std::cout << os.str();
     }
 
-    Compiler     compiler(options, errors);
+    Compiler     compiler(options, errors, vm.get_globals());
     ObjFunction *function = compiler.compile(ast);
+    vm.addProgram(source, function);
     if (function == nullptr) {
-        return INTERPRET_COMPILE_ERROR;
+        error = INTERPRET_COMPILE_ERROR;
     }
-    InterpretResult result = vm.run(function);
-    return result;
+    return function;
 }
 
-} // namespace alox
\ No newline at end of file
+} // namespace alox
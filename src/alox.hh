@@ -13,18 +13,36 @@
 
 namespace alox {
 
+struct AotProgram;
+
+/**
+ * @brief An interpreter. Its VM allocates in a heap of its own and shares nothing with
+ * another, so any number of interpreters can run at the same time, each on a thread.
+ * An interpreter must not be used by two threads at once.
+ *
+ * Nothing is collected: every object made is kept until the interpreter is destroyed,
+ * the one point at which its memory is freed. A script or REPL session that runs for
+ * long and keeps allocating grows without bound, so give each of a stream of unrelated
+ * programs an interpreter of its own rather than reusing one.
+ */
 class Alox {
   public:
     Alox(const Options &opt);
     ~Alox();
 
     int  runFile(const std::string_view &path);
+    int  emitCpp(const std::string_view &path, const std::string &output);
+    int  runAot(const AotProgram &program);
     void repl();
 
     InterpretResult runString(const std::string &s);
 
+    void set_hooks(VMHooks *hooks) { vm.set_hooks(hooks); }
+
   private:
     static std::string readFile(const std::string_view &path);
+    ObjFunction       *compile(const std::string &source, InterpretResult &error,
+                               std::ostream &err);
 
     const Options &options;
     VM             vm;
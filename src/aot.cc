@@ -0,0 +1,528 @@
+//
+// ALOX-CC
+//
+
+#include "aot.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iostream>
+#include <set>
+
+#include <fmt/core.h>
+
+#include "alox.hh"
+#include "debug.hh"
+#include "options.hh"
+
+namespace alox {
+
+namespace {
+
+// A C++ string literal, a line at a time.
+std::string quote(const std::string &text) {
+    std::string out = "\"";
+    for (const char c : text) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n\"\n    \"";
+            break;
+        default:
+            if (std::isprint(static_cast<unsigned char>(c)) != 0) {
+                out += c;
+            } else {
+                // Octal, as a hex escape would run into the next character.
+                out += fmt::format("\\{:03o}", static_cast<unsigned char>(c));
+            }
+        }
+    }
+    return out + "\"";
+}
+
+// A C++ double literal of a finite number.
+std::string number(double n) {
+    std::string text = fmt::format("{}", n);
+    if (text.find_first_of(".e") == std::string::npos) {
+        text += ".0";
+    }
+    return text;
+}
+
+// The strings of a C++ array, one to a line.
+std::string strings(const std::vector<std::string> &values) {
+    std::string out;
+    for (const std::string &value : values) {
+        out += "\n    " + quote(value) + ',';
+    }
+    return out + '\n';
+}
+
+// The numbers of a C++ array, sixteen to a line.
+template <typename T> std::string numbers(const T &values) {
+    std::string out;
+    for (size_t i = 0; i < values.size(); i++) {
+        out += fmt::format("{}{}", i % 16 == 0 ? "\n    " : " ", values[i]);
+        out += i + 1 < values.size() ? "," : "\n";
+    }
+    return out;
+}
+
+std::string identifier(const std::string &name) {
+    std::string out = name;
+    auto special = [](unsigned char c) { return std::isalnum(c) == 0; };
+    std::ranges::replace_if(out, special, '_');
+    return out;
+}
+
+} // namespace
+
+/**
+ * @brief The functions of a program: the script, then the functions found in the
+ * constants of each function in turn, or in the closures made by the compiler.
+ */
+std::vector<ObjFunction *> AotEmitter::functions(ObjFunction *script) {
+    std::vector<ObjFunction *> all{script};
+    for (size_t i = 0; i < all.size(); i++) {
+        ValueArray &constants = all[i]->chunk.get_constants();
+        for (size_t n = 0; n < constants.get_count(); n++) {
+            const Value  constant = constants.get_value(n);
+            ObjFunction *function = nullptr;
+            if (is<ObjFunction>(constant)) {
+                function = as<ObjFunction *>(constant);
+            } else if (is<ObjClosure>(constant)) {
+                function = as<ObjClosure *>(constant)->function;
+            }
+            if (function != nullptr && std::ranges::find(all, function) == all.end()) {
+                all.push_back(function);
+            }
+        }
+    }
+    return all;
+}
+
+void AotEmitter::emit(ObjFunction *script, const std::string &source,
+                      const std::string &errors, const std::string &name,
+                      Globals &globals) {
+    const auto all = functions(script);
+
+    os << "// Made by alox --emit-cpp from " << name << ".lox.\n\n";
+    os << "#include \"aot.hh\"\n\n";
+    os << "namespace {\n\n";
+    os << "using alox::OpCode;\n\n";
+    os << "const char *const source =\n    " << quote(source) << ";\n\n";
+    os << "const char *const errors =\n    " << quote(errors) << ";\n\n";
+    for (size_t n = 0; n < all.size(); n++) {
+        os << fmt::format("bool f{}(alox::AotFrame &f);\n", n);
+    }
+    for (size_t n = 0; n < all.size(); n++) {
+        emitFunction(n, all[n]);
+    }
+    for (size_t n = 0; n < all.size(); n++) {
+        emitChunk(n, all[n], all);
+    }
+
+    os << "\nconstexpr alox::AotChunk functions[] = {\n";
+    for (size_t n = 0; n < all.size(); n++) {
+        ObjFunction *function = all[n];
+        Chunk       &chunk = function->chunk;
+        auto span = [n](const char *array, size_t size) {
+            return size == 0 ? std::string("{}") : fmt::format("{}{}", array, n);
+        };
+        os << fmt::format(
+            "    {{{}, {}, {}, {}, {}, {}, {}, {}, {}, f{}}},\n",
+            function->name == nullptr ? "nullptr" : quote(function->name->str),
+            function->arity, function->upvalueCount, function->maxStack,
+            span("code", chunk.get_count()), span("lines", chunk.get_count()),
+            span("constants", chunk.get_constants().get_count()),
+            span("caches", chunk.get_caches().size()),
+            span("handlers", chunk.get_handlers().size()), n);
+    }
+    os << "};\n\n";
+
+    std::vector<std::string> names;
+    for (size_t slot = 0; slot < globals.get_count(); slot++) {
+        names.push_back(globals.get_name(global_index_t(slot))->str);
+    }
+    os << "constexpr const char *globals[] = {" << strings(names) << "};\n";
+    // The method names are constants of the functions defining the methods.
+    std::vector<ObjString *> methods;
+    for (ObjFunction *function : all) {
+        ValueArray &constants = function->chunk.get_constants();
+        for (size_t i = 0; i < constants.get_count(); i++) {
+            const Value constant = constants.get_value(i);
+            if (is<ObjString>(constant) &&
+                as<ObjString *>(constant)->selector != NO_SELECTOR &&
+                std::ranges::find(methods, as<ObjString *>(constant)) == methods.end()) {
+                methods.push_back(as<ObjString *>(constant));
+            }
+        }
+    }
+    std::ranges::sort(methods, {}, &ObjString::selector);
+    names.clear();
+    for (ObjString *method : methods) {
+        names.push_back(method->str);
+    }
+    if (!names.empty()) {
+        os << "constexpr const char *selectors[] = {" << strings(names) << "};\n";
+    }
+    os << "\n} // namespace\n\n";
+
+    const std::string program = "alox_aot_" + identifier(name);
+    os << "extern const alox::AotProgram " << program << ";\n";
+    os << fmt::format("const alox::AotProgram {}{{{}, source, errors, functions, "
+                      "globals, {}}};",
+                      program, OPCODE_COUNT, names.empty() ? "{}" : "selectors");
+    os << "\n\n";
+    os << "#ifndef ALOX_AOT_NO_MAIN\n";
+    os << "int main(int argc, const char *argv[]) {\n";
+    os << "    return alox::aotMain(" << program << ", argc, argv);\n";
+    os << "}\n";
+    os << "#endif\n";
+}
+
+// The arrays of a function's chunk, named with its number.
+void AotEmitter::emitChunk(size_t n, ObjFunction *function,
+                           const std::vector<ObjFunction *> &all) {
+    Chunk &chunk = function->chunk;
+
+    os << "\n// " << (function->name == nullptr ? "script" : function->name->str) << '\n';
+    if (chunk.get_count() > 0) {
+        std::vector<unsigned> code;
+        std::vector<size_t>   lines;
+        for (size_t offset = 0; offset < chunk.get_count(); offset++) {
+            code.push_back(chunk.get_code(offset));
+            lines.push_back(chunk.get_line(offset));
+        }
+        os << fmt::format("constexpr uint8_t code{}[] = {{{}}};\n", n, numbers(code));
+        os << fmt::format("constexpr uint32_t lines{}[] = {{{}}};\n", n, numbers(lines));
+    }
+
+    ValueArray &constants = chunk.get_constants();
+    if (constants.get_count() > 0) {
+        os << fmt::format("constexpr alox::AotConstant constants{}[] = {{\n", n);
+        for (size_t i = 0; i < constants.get_count(); i++) {
+            const Value constant = constants.get_value(i);
+            if (is<ObjString>(constant)) {
+                const std::string &text = as<ObjString *>(constant)->str;
+                os << fmt::format("    {{alox::AotConstant::STRING, 0, {{{}, {}}}}},\n",
+                                  quote(text), text.size());
+            } else if (is<ObjFunction>(constant) || is<ObjClosure>(constant)) {
+                const bool   closure = is<ObjClosure>(constant);
+                ObjFunction *callee = closure ? as<ObjClosure *>(constant)->function
+                                              : as<ObjFunction *>(constant);
+                os << fmt::format("    {{alox::AotConstant::{}, {}, {{}}}},\n",
+                                  closure ? "CLOSURE" : "FUNCTION",
+                                  std::ranges::find(all, callee) - all.begin());
+            } else if (is<double>(constant) && std::isfinite(as<double>(constant))) {
+                os << fmt::format("    {{alox::AotConstant::VALUE, "
+                                  "std::bit_cast<alox::Value>({}), {{}}}},\n",
+                                  number(as<double>(constant)));
+            } else {
+                os << fmt::format("    {{alox::AotConstant::VALUE, {:#x}, {{}}}},\n",
+                                  constant);
+            }
+        }
+        os << "};\n";
+    }
+
+    if (!chunk.get_caches().empty()) {
+        std::vector<size_t> offsets;
+        for (const InlineCache &cache : chunk.get_caches()) {
+            offsets.push_back(cache.get_offset());
+        }
+        os << fmt::format("constexpr uint32_t caches{}[] = {{{}}};\n", n,
+                          numbers(offsets));
+    }
+
+    if (!chunk.get_handlers().empty()) {
+        os << fmt::format("constexpr alox::ExceptionHandler handlers{}[] = {{\n", n);
+        for (const ExceptionHandler &handler : chunk.get_handlers()) {
+            os << fmt::format("    {{{}, {}, {}, {}}},\n", handler.start, handler.end,
+                              handler.target, handler.depth);
+        }
+        os << "};\n";
+    }
+}
+
+void AotEmitter::emitFunction(size_t n, ObjFunction *function) {
+    Chunk &chunk = function->chunk;
+
+    std::set<size_t> targets;
+    for (size_t offset = 0; offset < chunk.get_count();
+         offset += chunk.instruction_length(offset)) {
+        switch (OpCode(chunk.get_code(offset))) {
+        case OpCode::JUMP:
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::LOOP:
+        case OpCode::JUMP_IF_FALSE_POP:
+        case OpCode::LESS_JUMP_IF_FALSE:
+        case OpCode::EQUAL_JUMP_IF_FALSE:
+            targets.insert(chunk.jump_target(offset));
+            break;
+        default:
+            break;
+        }
+    }
+
+    os << "\n// " << (function->name == nullptr ? "script" : function->name->str) << '\n';
+    os << fmt::format("bool f{}(alox::AotFrame &f) {{\n", n);
+    for (size_t offset = 0; offset < chunk.get_count();
+         offset += chunk.instruction_length(offset)) {
+        if (targets.contains(offset)) {
+            os << 'L' << offset << ":\n";
+        }
+        emitInstruction(chunk, offset);
+    }
+    os << "}\n";
+}
+
+void AotEmitter::emitInstruction(Chunk &chunk, size_t offset) {
+    const uint8_t *ip = chunk.get_code() + offset;
+    auto word = [ip](size_t n) { return uint16_t((ip[n] << UINT8_WIDTH) | ip[n + 1]); };
+    const auto op = OpCode(*ip);
+
+    auto line = [this](const std::string &code) { os << "    " << code << '\n'; };
+    auto constant = [&](const_index_t n) {
+        const Value value = chunk.get_value(n);
+        if (!is<double>(value) || !std::isfinite(as<double>(value))) {
+            line(fmt::format("f.constant({});", n));
+            return;
+        }
+        line(fmt::format("f.number({});", number(as<double>(value))));
+    };
+    auto jumpIfFalse = [&](bool pop) {
+        line(fmt::format("if (f.falsey()) goto L{};", chunk.jump_target(offset)));
+        if (pop) {
+            line("f.pop();");
+        }
+    };
+    auto byVM = [&](OpCode instruction) {
+        line(fmt::format("if (!f.instruction(OpCode::{}, {})) return false;",
+                         opcodeName(instruction), offset));
+    };
+    auto binary = [&](OpCode instruction) {
+        line(fmt::format("if (!f.binary<OpCode::{}>({})) return false;",
+                         opcodeName(instruction), offset));
+    };
+
+    switch (op) {
+    case OpCode::CONSTANT:
+        constant(word(1));
+        break;
+    case OpCode::NIL:
+        line("f.push(alox::NIL_VAL);");
+        break;
+    case OpCode::TRUE:
+        line("f.push(alox::TRUE_VAL);");
+        break;
+    case OpCode::FALSE:
+        line("f.push(alox::FALSE_VAL);");
+        break;
+    case OpCode::ZERO:
+        line("f.number(0.0);");
+        break;
+    case OpCode::ONE:
+        line("f.number(1.0);");
+        break;
+    case OpCode::POP:
+        line("f.pop();");
+        break;
+    case OpCode::GET_LOCAL:
+        line(fmt::format("f.getLocal({});", ip[1]));
+        break;
+    case OpCode::GET_GLOBAL:
+        line(fmt::format("if (!f.getGlobal({}, {})) return false;", word(1), offset));
+        break;
+    case OpCode::SET_GLOBAL:
+        line(fmt::format("if (!f.setGlobal({}, {})) return false;", word(1), offset));
+        break;
+    case OpCode::DEFINE_GLOBAL:
+        line(fmt::format("f.defineGlobal({});", word(1)));
+        break;
+    case OpCode::SET_LOCAL:
+        line(fmt::format("f.setLocal({});", ip[1]));
+        break;
+    case OpCode::GET_LOCAL_LOCAL:
+        line(fmt::format("f.getLocal({});", ip[1]));
+        line(fmt::format("f.getLocal({});", ip[2]));
+        break;
+    case OpCode::GET_LOCAL_CONSTANT:
+        line(fmt::format("f.getLocal({});", ip[1]));
+        constant(word(2));
+        break;
+    case OpCode::GET_PROPERTY:
+        line(fmt::format("if (!f.getProperty({}, OpCode::{}, {})) return false;", word(3),
+                         opcodeName(op), offset));
+        break;
+    case OpCode::GET_LOCAL_PROPERTY:
+        line(fmt::format("f.getLocal({});", ip[1]));
+        line(fmt::format("if (!f.getProperty({}, OpCode::{}, {})) return false;", word(4),
+                         opcodeName(op), offset));
+        break;
+    case OpCode::JUMP:
+    case OpCode::LOOP:
+        line(fmt::format("goto L{};", chunk.jump_target(offset)));
+        break;
+    case OpCode::JUMP_IF_FALSE:
+        jumpIfFalse(false);
+        break;
+    case OpCode::JUMP_IF_FALSE_POP:
+        jumpIfFalse(true);
+        break;
+    case OpCode::EQUAL:
+    case OpCode::EQUAL_NUMBER:
+    case OpCode::EQUAL_GENERIC:
+        line("f.equal(true);");
+        break;
+    case OpCode::NOT_EQUAL:
+    case OpCode::NOT_EQUAL_NUMBER:
+    case OpCode::NOT_EQUAL_GENERIC:
+        line("f.equal(false);");
+        break;
+    case OpCode::EQUAL_JUMP_IF_FALSE:
+        line("f.equal(true);");
+        jumpIfFalse(true);
+        break;
+    case OpCode::ADD:
+    case OpCode::ADD_NUMBER:
+    case OpCode::ADD_STRING:
+    case OpCode::ADD_GENERIC:
+        binary(OpCode::ADD);
+        break;
+    case OpCode::SUBTRACT:
+    case OpCode::MULTIPLY:
+    case OpCode::DIVIDE:
+    case OpCode::GREATER:
+    case OpCode::NOT_GREATER:
+    case OpCode::LESS:
+    case OpCode::NOT_LESS:
+        binary(op);
+        break;
+    case OpCode::LESS_JUMP_IF_FALSE:
+        // The comparison pushes a boolean, false stays for the POP at the target.
+        binary(OpCode::LESS);
+        jumpIfFalse(true);
+        break;
+    case OpCode::CALL:
+    case OpCode::CALL_DIRECT:
+    case OpCode::CLOCK:
+    case OpCode::GETC:
+    case OpCode::CHR:
+    case OpCode::ORD:
+    case OpCode::INVOKE:
+    case OpCode::SUPER_INVOKE:
+        line(fmt::format("if (!f.call(OpCode::{}, {})) return false;", opcodeName(op),
+                         offset));
+        break;
+    case OpCode::TAIL_CALL:
+    case OpCode::TAIL_INVOKE:
+        line(fmt::format("if (!f.tailCall(OpCode::{}, {})) return false;", opcodeName(op),
+                         offset));
+        line("if (f.replaced()) return true;");
+        break;
+    case OpCode::RETURN:
+        line(fmt::format("f.ret({});", offset));
+        line("return true;");
+        break;
+    default:
+        byVM(op);
+        break;
+    }
+}
+
+bool AotFrame::run() {
+    return function->aot(*this) && tailCalls();
+}
+
+// A loop, so that tail calls run in constant C++ stack too.
+bool AotFrame::runTailCalls() {
+    for (bool more = true; more;) {
+        AotFrame callee(vm);
+        if (!callee.function->aot(callee)) {
+            return false;
+        }
+        more = callee.tail;
+    }
+    return true;
+}
+
+ObjFunction *aotLoad(const AotProgram &program, Globals &globals) {
+    if (program.opcodes != OPCODE_COUNT || program.functions.empty()) {
+        return nullptr;
+    }
+    // The natives are defined, so the slots of the program's globals follow them.
+    for (size_t slot = 0; slot < program.globals.size(); slot++) {
+        if (globals.slot(newString(program.globals[slot])) != slot) {
+            return nullptr;
+        }
+    }
+    if (globals.get_count() != program.globals.size()) {
+        return nullptr;
+    }
+    for (const char *name : program.selectors) {
+        methodSelector(newString(name));
+    }
+
+    // Made first, as the constants refer to functions later on. A function has one
+    // closure, which captures nothing.
+    std::vector<ObjFunction *> functions;
+    std::vector<ObjClosure *>  closures(program.functions.size());
+    for (size_t n = 0; n < program.functions.size(); n++) {
+        functions.push_back(newFunction());
+    }
+    for (size_t n = 0; n < program.functions.size(); n++) {
+        const AotChunk &aot = program.functions[n];
+        ObjFunction    *function = functions[n];
+        Chunk          &chunk = function->chunk;
+        function->name = aot.name != nullptr ? newString(aot.name) : nullptr;
+        function->arity = aot.arity;
+        function->upvalueCount = aot.upvalueCount;
+        function->maxStack = aot.maxStack;
+        function->aot = aot.function;
+
+        chunk.set_code({aot.code.begin(), aot.code.end()},
+                       {aot.lines.begin(), aot.lines.end()});
+        for (const AotConstant &constant : aot.constants) {
+            Value value = constant.value;
+            if (constant.kind == AotConstant::STRING) {
+                value = alox::value<Obj *>(newString(std::string(constant.string)));
+            } else if (constant.kind == AotConstant::FUNCTION) {
+                value = alox::value<Obj *>(functions[constant.value]);
+            } else if (constant.kind == AotConstant::CLOSURE) {
+                ObjClosure *&closure = closures[constant.value];
+                if (closure == nullptr) {
+                    closure = newClosure(functions[constant.value]);
+                }
+                value = alox::value<Obj *>(closure);
+            }
+            chunk.add_constant(value);
+        }
+        for (const uint32_t offset : aot.caches) {
+            chunk.add_cache(offset);
+        }
+        for (const ExceptionHandler &handler : aot.handlers) {
+            chunk.add_handler(handler);
+        }
+    }
+    return functions[0];
+}
+
+int aotMain(const AotProgram &program, int argc, const char *argv[]) {
+    Options options(std::cout, std::cin, std::cerr);
+    if (const int status = getOptions(argc, argv, options); status != 0) {
+        return status;
+    }
+    options.jit = false;
+
+    Alox alox(options);
+    return alox.runAot(program);
+}
+
+} // namespace alox
@@ -0,0 +1,276 @@
+//
+// ALOX-CC
+//
+
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chunk.hh"
+#include "globals.hh"
+#include "object.hh"
+#include "value.hh"
+#include "vm.hh"
+
+namespace alox {
+
+/**
+ * @brief A constant of a chunk in a program made by --emit-cpp: a number or other value
+ * that isn't an object, a string, or a function or its closure by its place in
+ * AotProgram::functions.
+ */
+struct AotConstant {
+    enum Kind : uint8_t { VALUE, STRING, FUNCTION, CLOSURE };
+
+    Kind             kind;
+    Value            value; // the bits of a VALUE, the function of the others.
+    std::string_view string;
+};
+
+/**
+ * @brief An ObjFunction of a program made by --emit-cpp: its chunk as compiled, and its
+ * C++.
+ */
+struct AotChunk {
+    const char                       *name; // nullptr for the script.
+    int                               arity;
+    int                               upvalueCount;
+    int                               maxStack;
+    std::span<const uint8_t>          code;
+    std::span<const uint32_t>         lines;
+    std::span<const AotConstant>      constants;
+    std::span<const uint32_t>         caches; // the offsets of the inline caches.
+    std::span<const ExceptionHandler> handlers;
+    AotFunction                       function;
+};
+
+/**
+ * @brief A program made by --emit-cpp. The generated C++ has the chunks as compiled,
+ * which are loaded at startup without compiling the source, and a function for each
+ * ObjFunction in the order of AotEmitter::functions(). It has the names of the globals
+ * by slot and of the methods by selector, to number them as the compiler did. The source
+ * is kept for the workers running spawned functions, which compile it.
+ */
+struct AotProgram {
+    size_t                       opcodes; // OPCODE_COUNT, to check the version.
+    const char                  *source;
+    const char                  *errors; // reported by the compiler, printed at startup.
+    std::span<const AotChunk>    functions;
+    std::span<const char *const> globals;
+    std::span<const char *const> selectors;
+};
+
+/**
+ * @brief Writes the C++ of a compiled program.
+ *
+ * Each function becomes a C++ function with a label for each jump target, so that the
+ * C++ compiler sees the control flow. Stack and local instructions, jumps, equality,
+ * number arithmetic and fields found in the inline caches are done inline. Calls run the callee's C++ function and return to
+ * the caller's. Everything else calls the VM as the JIT does.
+ */
+class AotEmitter {
+  public:
+    explicit AotEmitter(std::ostream &os) : os(os){};
+
+    // name is used for the AotProgram, alox_aot_name. errors are those the compiler
+    // reported, and globals those the script was compiled with.
+    void emit(ObjFunction *script, const std::string &source, const std::string &errors,
+              const std::string &name, Globals &globals);
+
+    static std::vector<ObjFunction *> functions(ObjFunction *script);
+
+  private:
+    void emitChunk(size_t n, ObjFunction *function,
+                   const std::vector<ObjFunction *> &all);
+    void emitFunction(size_t n, ObjFunction *function);
+    void emitInstruction(Chunk &chunk, size_t offset);
+
+    std::ostream &os;
+};
+
+/**
+ * @brief The frame of a function running as AOT code, and what its C++ does on the VM.
+ */
+class AotFrame {
+  public:
+    explicit AotFrame(VM &vm)
+        : vm(vm), slots(vm.frames[vm.frameCount - 1].slots),
+          function(vm.frames[vm.frameCount - 1].closure->function),
+          code(function->chunk.get_code()){};
+
+    // Run the function until it returns. Returns false on a runtime error.
+    bool run();
+
+    // Run the functions that took over this frame with tail calls.
+    [[nodiscard]] bool tailCalls() { return !tail || runTailCalls(); }
+    [[nodiscard]] bool replaced() const { return tail; }
+
+    void               push(Value value) { vm.push(value); }
+    void               pop() { vm.pop(); }
+    [[nodiscard]] bool falsey() const { return VM::isFalsey(vm.peek(0)); }
+    void               constant(const_index_t n) { push(function->chunk.get_value(n)); }
+    void               number(double n) { push(value<double>(n)); }
+    void               getLocal(uint8_t slot) { push(slots[slot]); }
+    void               setLocal(uint8_t slot) { slots[slot] = vm.peek(0); }
+    void               defineGlobal(global_index_t slot) { global(slot) = vm.pop(); }
+    bool               getGlobal(global_index_t slot, size_t offset);
+    bool               setGlobal(global_index_t slot, size_t offset);
+    bool               getProperty(cache_index_t cache, OpCode op, size_t offset);
+    void               equal(bool equal);
+
+    template <OpCode op> bool binary(size_t offset);
+
+    // The instruction at offset, by the VM.
+    bool instruction(OpCode op, size_t offset) {
+        return vm.nativeInstruction(op, code + offset + 1);
+    }
+    bool call(OpCode op, size_t offset);
+    // If the callee takes over the frame, the function returns at once to let it run.
+    bool tailCall(OpCode op, size_t offset);
+    void ret(size_t offset) { vm.nativeReturn(code + offset + 1); }
+
+  private:
+    Value &global(global_index_t slot) { return vm.globals.get_value(slot); }
+    bool   runTailCalls();
+    // A call that didn't enter a frame. After a coroutine switch the AOT code returns
+    // false, and the interpreter runs on from the top frame.
+    bool returned(VM::NativeCall result) {
+        vm.restart = vm.restart || result == VM::NativeCall::Switched;
+        return result == VM::NativeCall::Returned;
+    }
+    // The slots move when a call grows the stack.
+    void reload() { slots = vm.frames[vm.frameCount - 1].slots; }
+
+    VM          &vm;
+    Value       *slots;
+    ObjFunction *function;
+    uint8_t     *code;
+    bool         tail{false};
+};
+
+// Number arithmetic and comparisons, with the VM reporting other operands.
+template <OpCode op> bool AotFrame::binary(size_t offset) {
+    const Value b = vm.peek(0);
+    const Value a = vm.peek(1);
+    if (!is<double>(a) || !is<double>(b)) {
+        return instruction(op, offset);
+    }
+    const double x = as<double>(a);
+    const double y = as<double>(b);
+    Value       &result = vm.stackTop[-2];
+    if constexpr (op == OpCode::ADD) {
+        result = value<double>(x + y);
+    } else if constexpr (op == OpCode::SUBTRACT) {
+        result = value<double>(x - y);
+    } else if constexpr (op == OpCode::MULTIPLY) {
+        result = value<double>(x * y);
+    } else if constexpr (op == OpCode::DIVIDE) {
+        result = value<double>(x / y);
+    } else if constexpr (op == OpCode::GREATER) {
+        result = value<bool>(x > y);
+    } else if constexpr (op == OpCode::NOT_GREATER) {
+        result = value<bool>(x <= y);
+    } else if constexpr (op == OpCode::LESS) {
+        result = value<bool>(x < y);
+    } else {
+        static_assert(op == OpCode::NOT_LESS);
+        result = value<bool>(x >= y);
+    }
+    vm.stackTop--;
+    return true;
+}
+
+// Inline, so that each call site has its own indirect call.
+inline bool AotFrame::call(OpCode op, size_t offset) {
+    const VM::NativeCall result = vm.nativeCall(op, code + offset + 1);
+    if (result != VM::NativeCall::Entered) {
+        return returned(result);
+    }
+    AotFrame callee(vm);
+    if (!callee.function->aot(callee) || !callee.tailCalls()) {
+        return false;
+    }
+    reload();
+    return true;
+}
+
+// An initializer gets a frame of its own, and is run as for call().
+inline bool AotFrame::tailCall(OpCode op, size_t offset) {
+    const int            depth = vm.frameCount;
+    const VM::NativeCall result = vm.nativeCall(op, code + offset + 1);
+    if (result != VM::NativeCall::Entered) {
+        return returned(result);
+    }
+    if (vm.frameCount == depth) {
+        tail = true;
+        return true;
+    }
+    AotFrame callee(vm);
+    if (!callee.function->aot(callee) || !callee.tailCalls()) {
+        return false;
+    }
+    reload();
+    return true;
+}
+
+// The VM reports undefined globals.
+inline bool AotFrame::getGlobal(global_index_t slot, size_t offset) {
+    const Value value = global(slot);
+    if (value == UNDEFINED_VAL) {
+        return instruction(OpCode::GET_GLOBAL, offset);
+    }
+    push(value);
+    return true;
+}
+
+inline bool AotFrame::setGlobal(global_index_t slot, size_t offset) {
+    Value &value = global(slot);
+    if (value == UNDEFINED_VAL) {
+        return instruction(OpCode::SET_GLOBAL, offset);
+    }
+    value = vm.peek(0);
+    return true;
+}
+
+// A field found in the inline cache. The VM does the rest, and fills the cache.
+inline bool AotFrame::getProperty(cache_index_t cache, OpCode op, size_t offset) {
+    const Value receiver = vm.peek(0);
+    if (is<ObjInstance>(receiver)) {
+        ObjInstance      *instance = as<ObjInstance *>(receiver);
+        InlineCache      &entries = function->chunk.get_cache(cache);
+        const CacheEntry *entry = entries.find(instance->shape, instance->klass->version);
+        if (entry != nullptr && entry->method == nullptr) {
+            vm.stackTop[-1] = instance->fields[entry->slot];
+            return true;
+        }
+    }
+    if (op == OpCode::GET_LOCAL_PROPERTY) {
+        pop(); // The VM pushes the local again.
+    }
+    return instruction(op, offset);
+}
+
+inline void AotFrame::equal(bool equal) {
+    const Value b = vm.pop();
+    vm.stackTop[-1] = value<bool>(valuesEqual(vm.peek(0), b) == equal);
+}
+
+/**
+ * @brief The script of a program made by --emit-cpp, made from its chunks in the current
+ * heap with its globals in globals. Returns nullptr if it was made by a different
+ * version of alox.
+ */
+ObjFunction *aotLoad(const AotProgram &program, Globals &globals);
+
+/**
+ * @brief The main() of a program made by --emit-cpp.
+ */
+int aotMain(const AotProgram &program, int argc, const char *argv[]);
+
+} // namespace alox
@@ -2,8 +2,11 @@
 // ALOX-CC
 //
 
+#include <cstring>
+
 #include "chunk.hh"
 #include "memory.hh"
+#include "object.hh"
 
 namespace alox {
 
@@ -23,8 +26,176 @@ void Chunk::write(uint8_t byte, size_t line) {
     count++;
 }
 
+// Replace all the code, lines has the line of each byte.
+void Chunk::set_code(const std::vector<uint8_t> &bytes,
+                     std::vector<size_t>        &&byte_lines) {
+    delete[] code;
+    count = bytes.size();
+    capacity = count;
+    code = new uint8_t[capacity];
+    memcpy(code, bytes.data(), count);
+    lines = std::move(byte_lines);
+}
+
 const_index_t Chunk::add_constant(Value value) {
     return this->constants.write(value);
 }
 
+cache_index_t Chunk::add_cache(size_t offset) {
+    caches.emplace_back(offset);
+    return cache_index_t(caches.size() - 1);
+}
+
+// The length of the instruction at offset, with its operands.
+size_t Chunk::instruction_length(size_t offset) {
+    switch (OpCode(get_code(offset))) {
+    case OpCode::GET_LOCAL:
+    case OpCode::SET_LOCAL:
+    case OpCode::GET_UPVALUE:
+    case OpCode::SET_UPVALUE:
+    case OpCode::GET_CAPTURED:
+    case OpCode::CALL:
+    case OpCode::TAIL_CALL:
+        return 2;
+    case OpCode::CONSTANT:
+    case OpCode::GET_GLOBAL:
+    case OpCode::DEFINE_GLOBAL:
+    case OpCode::SET_GLOBAL:
+    case OpCode::GET_SUPER:
+    case OpCode::JUMP:
+    case OpCode::JUMP_IF_FALSE:
+    case OpCode::LOOP:
+    case OpCode::CLASS:
+    case OpCode::METHOD:
+    case OpCode::CLOCK:
+    case OpCode::GETC:
+    case OpCode::CHR:
+    case OpCode::ORD:
+    case OpCode::GET_LOCAL_LOCAL:
+    case OpCode::JUMP_IF_FALSE_POP:
+    case OpCode::LESS_JUMP_IF_FALSE:
+    case OpCode::EQUAL_JUMP_IF_FALSE:
+        return 3;
+    case OpCode::SUPER_INVOKE:
+    case OpCode::CALL_DIRECT:
+    case OpCode::GET_LOCAL_CONSTANT:
+        return 4;
+    case OpCode::GET_PROPERTY:
+    case OpCode::SET_PROPERTY:
+    case OpCode::SET_PROPERTY_POP:
+        return 5;
+    case OpCode::INVOKE:
+    case OpCode::TAIL_INVOKE:
+    case OpCode::GET_LOCAL_PROPERTY:
+        return 6;
+    case OpCode::CLOSURE: {
+        auto constant = const_index_t(get_code(offset + 1) << UINT8_WIDTH);
+        constant |= get_code(offset + 2);
+        return 3 + 2 * as<ObjFunction *>(get_value(constant))->upvalueCount;
+    }
+    default:
+        return 1;
+    }
+}
+
+static bool isJump(OpCode op) {
+    return op == OpCode::JUMP || op == OpCode::JUMP_IF_FALSE || op == OpCode::LOOP;
+}
+
+// The change in stack depth made by the instruction at offset, before superinstructions
+// and quickening.
+int Chunk::stack_effect(size_t offset) {
+    switch (OpCode(get_code(offset))) {
+    case OpCode::CONSTANT:
+    case OpCode::NIL:
+    case OpCode::TRUE:
+    case OpCode::FALSE:
+    case OpCode::ZERO:
+    case OpCode::ONE:
+    case OpCode::GET_LOCAL:
+    case OpCode::GET_GLOBAL:
+    case OpCode::GET_UPVALUE:
+    case OpCode::GET_CAPTURED:
+    case OpCode::CLOSURE:
+    case OpCode::CLASS:
+        return 1;
+    case OpCode::CALL:
+    case OpCode::TAIL_CALL:
+        return -get_code(offset + 1);
+    case OpCode::INVOKE:
+    case OpCode::TAIL_INVOKE:
+        return -get_code(offset + 5);
+    case OpCode::SUPER_INVOKE:
+        return -get_code(offset + 3) - 1;
+    case OpCode::CALL_DIRECT:
+        return -get_code(offset + 3);
+    case OpCode::CLOCK:
+    case OpCode::GETC:
+    case OpCode::CHR:
+    case OpCode::ORD:
+        return 1 - intrinsics[intrinsicIndex(OpCode(get_code(offset)))].arity;
+    case OpCode::SET_LOCAL:
+    case OpCode::SET_GLOBAL:
+    case OpCode::SET_UPVALUE:
+    case OpCode::GET_PROPERTY:
+    case OpCode::NOT:
+    case OpCode::NEGATE:
+    case OpCode::JUMP:
+    case OpCode::JUMP_IF_FALSE:
+    case OpCode::LOOP:
+    case OpCode::YIELD:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+// The stack depth before each reachable instruction, -1 for the others, from the depth
+// start at the beginning.
+std::vector<int> Chunk::stack_depths(int start) {
+    std::vector<int> depth(count + 1, -1);
+
+    std::vector<size_t> work{0};
+    depth[0] = start;
+    // A handler starts with the exception pushed.
+    for (const ExceptionHandler &handler : handlers) {
+        depth[handler.target] = handler.depth + 1;
+        work.push_back(handler.target);
+    }
+    while (!work.empty()) {
+        const size_t offset = work.back();
+        work.pop_back();
+        if (offset >= count) {
+            continue;
+        }
+        const auto op = OpCode(get_code(offset));
+        const int  after = depth[offset] + stack_effect(offset);
+        auto       next = [&](size_t to) {
+            // A jump left unpatched by a compile error goes nowhere.
+            if (to <= count && depth[to] < 0) {
+                depth[to] = after;
+                work.push_back(to);
+            }
+        };
+        if (isJump(op)) {
+            next(jump_target(offset));
+        }
+        if (op != OpCode::JUMP && op != OpCode::LOOP && op != OpCode::RETURN &&
+            op != OpCode::THROW) {
+            next(offset + instruction_length(offset));
+        }
+    }
+    return depth;
+}
+
+// Where the jump or LOOP at offset goes.
+size_t Chunk::jump_target(size_t offset) {
+    auto jump = size_t(get_code(offset + 1) << UINT8_WIDTH);
+    jump |= get_code(offset + 2);
+    if (OpCode(get_code(offset)) == OpCode::LOOP) {
+        return offset + 3 - jump;
+    }
+    return offset + 3 + jump;
+}
+
 } // namespace alox
@@ -4,7 +4,12 @@
 
 #pragma once
 
+#include <array>
+#include <string_view>
+
 #include "common.hh"
+#include "inline_cache.hh"
+#include "register.hh"
 #include "val_array.hh"
 #include "value.hh"
 
@@ -25,6 +30,7 @@ enum class OpCode {
     SET_GLOBAL,
     GET_UPVALUE,
     SET_UPVALUE,
+    GET_CAPTURED,
     GET_PROPERTY,
     SET_PROPERTY,
     GET_SUPER,
@@ -52,7 +58,76 @@ enum class OpCode {
     RETURN,
     CLASS,
     INHERIT,
-    METHOD
+    METHOD,
+
+    // Calls in tail position, which reuse the caller's frame.
+    TAIL_CALL,
+    TAIL_INVOKE,
+
+    // A call of a global function that is never assigned, made by Compiler::call().
+    CALL_DIRECT,
+
+    // Calls of the natives in intrinsics, with the global slot of the native.
+    CLOCK,
+    GETC,
+    CHR,
+    ORD,
+
+    // Throws the value on top of the stack to the handler of the innermost try block.
+    THROW,
+
+    // Leaves the running coroutine with the value on top of the stack, which is replaced
+    // by the value it is resumed with.
+    YIELD,
+
+    // Superinstructions, made by CodeGen::fuseInstructions().
+    GET_LOCAL_LOCAL,
+    GET_LOCAL_CONSTANT,
+    GET_LOCAL_PROPERTY,
+    SET_PROPERTY_POP,
+    JUMP_IF_FALSE_POP,
+    LESS_JUMP_IF_FALSE,
+    EQUAL_JUMP_IF_FALSE,
+
+    // Quickened in place by the VM for the operand types it sees.
+    ADD_NUMBER,
+    ADD_STRING,
+    EQUAL_NUMBER,
+    NOT_EQUAL_NUMBER,
+    // A quickened instruction whose operand types changed, never quickened again.
+    ADD_GENERIC,
+    EQUAL_GENERIC,
+    NOT_EQUAL_GENERIC
+};
+
+constexpr auto OPCODE_COUNT = size_t(OpCode::NOT_EQUAL_GENERIC) + 1;
+
+// The natives that calls by name compile to opcodes of, unless the script defines the
+// name. The opcode takes the arguments off the stack and pushes the result.
+struct Intrinsic {
+    std::string_view name;
+    OpCode           op;
+    int              arity;
+};
+
+constexpr std::array<Intrinsic, 4> intrinsics{{{"clock", OpCode::CLOCK, 0},
+                                               {"getc", OpCode::GETC, 0},
+                                               {"chr", OpCode::CHR, 1},
+                                               {"ord", OpCode::ORD, 1}}};
+
+constexpr bool isIntrinsic(OpCode op) {
+    return op >= OpCode::CLOCK && op <= OpCode::ORD;
+}
+
+constexpr size_t intrinsicIndex(OpCode op) {
+    return size_t(op) - size_t(OpCode::CLOCK);
+}
+
+// How CLOSURE captures a variable, the byte before its slot or upvalue index.
+enum CaptureKind : uint8_t {
+    CAPTURE_UPVALUE,    // the enclosing closure's capture, as it is.
+    CAPTURE_LOCAL,      // a local, in an ObjUpvalue shared with the enclosing function.
+    CAPTURE_LOCAL_COPY, // the value of a local that is never assigned.
 };
 
 using const_index_t = uint16_t;
@@ -66,6 +141,7 @@ class Chunk {
 
     void free();
     void write(uint8_t byte, size_t line);
+    void set_code(const std::vector<uint8_t> &bytes, std::vector<size_t> &&byte_lines);
 
     [[nodiscard]] constexpr size_t get_count() const { return count; }
     [[nodiscard]] constexpr size_t get_line(size_t n) const { return lines[n]; }
@@ -79,16 +155,34 @@ class Chunk {
         return constants.get_value(n);
     }
 
+    cache_index_t                       add_cache(size_t offset);
+    [[nodiscard]] constexpr InlineCache &get_cache(cache_index_t n) { return caches[n]; }
+    [[nodiscard]] constexpr std::vector<InlineCache> &get_caches() { return caches; }
+
     constexpr uint8_t               &get_code(size_t n) { return code[n]; };
     [[nodiscard]] constexpr uint8_t *get_code() const { return code; };
+    [[nodiscard]] size_t             instruction_length(size_t offset);
+    [[nodiscard]] size_t             jump_target(size_t offset);
+    [[nodiscard]] int                stack_effect(size_t offset);
+    [[nodiscard]] std::vector<int>   stack_depths(int start);
+
+    void add_handler(const ExceptionHandler &handler) { handlers.push_back(handler); }
+    [[nodiscard]] constexpr std::vector<ExceptionHandler> &get_handlers() {
+        return handlers;
+    }
+
+    [[nodiscard]] constexpr RegisterChunk &get_registers() { return registers; }
 
   private:
     size_t   count{0};
     size_t   capacity{0};
     uint8_t *code{nullptr};
 
-    std::vector<size_t> lines;
-    ValueArray          constants;
+    std::vector<size_t>      lines;
+    ValueArray               constants;
+    std::vector<InlineCache>      caches;
+    std::vector<ExceptionHandler> handlers; // innermost first.
+    RegisterChunk                 registers;
 };
 
 } // namespace lox
\ No newline at end of file
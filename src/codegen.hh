@@ -19,6 +19,7 @@ class CodeGen {
     constexpr void emitByte(OpCode byte) { return emitByte(uint8_t(byte)); };
     void           emitBytes(uint8_t byte1, uint8_t byte2);
     void           emitByteConst(OpCode byte1, const_index_t c);
+    void           emitByteConstCache(OpCode byte1, const_index_t c);
     constexpr void emitBytes(OpCode byte1, OpCode byte2) {
         return emitBytes(uint8_t(byte1), uint8_t(byte2));
     }
@@ -31,6 +32,7 @@ class CodeGen {
     const_index_t makeConstant(Value value);
     void          emitConstant(Value value);
     void          patchJump(size_t offset);
+    void          fuseInstructions();
 
     void set_chunk(Chunk *c) { cur = c; };
 
@@ -11,6 +11,11 @@ namespace alox {
 
 #define NAN_BOXING
 
+// Threaded dispatch in the VM needs the labels as values extension.
+#if defined(ALOX_COMPUTED_GOTO) && (defined(__GNUC__) || defined(__clang__))
+#define COMPUTED_GOTO
+#endif
+
 constexpr auto UINT8_COUNT = UINT8_MAX + 1; // 256
 
 #ifndef UINT8_WIDTH
@@ -2,10 +2,12 @@
 // ALOX-CC
 //
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -17,6 +19,7 @@
 #include "compiler.hh"
 #include "debug.hh"
 #include "memory.hh"
+#include "register_gen.hh"
 #include "scanner.hh"
 
 namespace alox {
@@ -34,11 +37,155 @@ constexpr auto MAX_ARGS = UINT8_MAX;
 constexpr auto sym_this = "this";
 constexpr auto sym_super = "super";
 
+// Escape analysis
+
+namespace {
+
+// The statements and expressions directly in ast.
+void children(Obj *ast, const std::function<void(Obj *)> &visit) {
+    auto all = [&](const auto &asts) {
+        for (auto *a : asts) {
+            visit(OBJ_AST(a));
+        }
+    };
+    if (is<Declaration>(ast)) {
+        all(as<Declaration>(ast)->stats);
+    } else if (is<Block>(ast)) {
+        all(as<Block>(ast)->stats);
+    } else if (is<Statement>(ast)) {
+        visit(as<Statement>(ast)->stat);
+    } else if (is<Expr>(ast)) {
+        visit(as<Expr>(ast)->expr);
+    } else if (is<Primary>(ast)) {
+        visit(as<Primary>(ast)->expr);
+    } else if (is<Unary>(ast)) {
+        visit(OBJ_AST(as<Unary>(ast)->expr));
+    } else if (is<Binary>(ast)) {
+        visit(OBJ_AST(as<Binary>(ast)->left));
+        visit(OBJ_AST(as<Binary>(ast)->right));
+    } else if (is<Print>(ast)) {
+        visit(OBJ_AST(as<Print>(ast)->expr));
+    } else if (is<Return>(ast)) {
+        visit(OBJ_AST(as<Return>(ast)->expr));
+    } else if (is<Try>(ast)) {
+        visit(OBJ_AST(as<Try>(ast)->body));
+        visit(OBJ_AST(as<Try>(ast)->var));
+        visit(OBJ_AST(as<Try>(ast)->handler));
+    } else if (is<Throw>(ast)) {
+        visit(OBJ_AST(as<Throw>(ast)->expr));
+    } else if (is<Yield>(ast)) {
+        visit(OBJ_AST(as<Yield>(ast)->expr));
+    } else if (is<VarDec>(ast)) {
+        visit(OBJ_AST(as<VarDec>(ast)->expr));
+    } else if (is<Assign>(ast)) {
+        visit(OBJ_AST(as<Assign>(ast)->left));
+        visit(OBJ_AST(as<Assign>(ast)->right));
+    } else if (is<If>(ast)) {
+        visit(OBJ_AST(as<If>(ast)->cond));
+        visit(OBJ_AST(as<If>(ast)->then_stat));
+        visit(OBJ_AST(as<If>(ast)->else_stat));
+    } else if (is<While>(ast)) {
+        visit(OBJ_AST(as<While>(ast)->cond));
+        visit(OBJ_AST(as<While>(ast)->body));
+    } else if (is<For>(ast)) {
+        visit(as<For>(ast)->init);
+        visit(OBJ_AST(as<For>(ast)->cond));
+        visit(OBJ_AST(as<For>(ast)->iter));
+        visit(OBJ_AST(as<For>(ast)->body));
+    } else if (is<FunctDec>(ast)) {
+        visit(OBJ_AST(as<FunctDec>(ast)->body));
+    } else if (is<Call>(ast)) {
+        visit(OBJ_AST(as<Call>(ast)->fname));
+        all(as<Call>(ast)->args);
+    } else if (is<ClassDec>(ast)) {
+        all(as<ClassDec>(ast)->methods);
+    } else if (is<Dot>(ast)) {
+        visit(OBJ_AST(as<Dot>(ast)->left));
+        all(as<Dot>(ast)->args);
+    } else if (is<This>(ast)) {
+        all(as<This>(ast)->args);
+    }
+}
+
+// The name called, for a call of a variable.
+Identifier *callee(Call *call) {
+    Expr *fname = call->fname;
+    while (is<Expr>(fname->expr)) {
+        fname = as<Expr>(fname->expr);
+    }
+    return is<Identifier>(fname->expr) ? as<Identifier>(fname->expr) : nullptr;
+}
+
+// Whether each use of name in ast calls it with arity arguments, and none is in a
+// function nested in ast: the local function of that name then never escapes its frame.
+bool onlyCalled(Obj *ast, const std::string &name, size_t arity, bool nested = false) {
+    if (ast == nullptr) {
+        return true;
+    }
+    if (is<Identifier>(ast)) {
+        return as<Identifier>(ast)->name != name;
+    }
+    if (is<Call>(ast)) {
+        auto *call = as<Call>(ast);
+        if (callee(call) != nullptr && callee(call)->name == name) {
+            if (nested || call->args.size() != arity) {
+                return false;
+            }
+            return std::ranges::all_of(call->args, [&](Expr *arg) {
+                return onlyCalled(arg, name, arity, nested);
+            });
+        }
+    }
+    nested = nested || is<FunctDec>(ast);
+    bool only = true;
+    children(ast,
+             [&](Obj *child) { only = only && onlyCalled(child, name, arity, nested); });
+    return only;
+}
+
+// The names used in a function and the names declared in it.
+struct Names {
+    std::vector<std::string> used;
+    std::vector<std::string> declared;
+    bool                     this_{false};
+};
+
+void collectNames(Obj *ast, Names &names) {
+    if (ast == nullptr) {
+        return;
+    }
+    auto add = [](std::vector<std::string> &list, const std::string &name) {
+        if (std::ranges::find(list, name) == list.end()) {
+            list.push_back(name);
+        }
+    };
+    if (is<Identifier>(ast)) {
+        add(names.used, as<Identifier>(ast)->name);
+    } else if (is<This>(ast)) {
+        names.this_ = true;
+    } else if (is<VarDec>(ast)) {
+        add(names.declared, as<VarDec>(ast)->var->name);
+    } else if (is<FunctDec>(ast)) {
+        add(names.declared, as<FunctDec>(ast)->name->name);
+        for (auto *p : as<FunctDec>(ast)->parameters) {
+            add(names.declared, p->name);
+        }
+    } else if (is<ClassDec>(ast)) {
+        add(names.declared, as<ClassDec>(ast)->name);
+        if (!as<ClassDec>(ast)->super.empty()) {
+            add(names.used, as<ClassDec>(ast)->super);
+        }
+    }
+    children(ast, [&](Obj *child) { collectNames(child, names); });
+}
+
+} // namespace
+
 // Context manipulation
 
 void Compiler::initCompiler(Context *compiler, const std::string &name,
-                            FunctionType type) {
-    compiler->init(current, type);
+                            FunctionType type, ObjFunction *function) {
+    compiler->init(current, type, function);
     current = compiler;
     gen.set_chunk(&current->function->chunk);
     if (type != TYPE_SCRIPT) {
@@ -58,12 +205,23 @@ void Compiler::initCompiler(Context *compiler, const std::string &name,
 ObjFunction *Compiler::endCompiler() {
     gen.emitReturn(current->type);
     ObjFunction *function = current->function;
+    // Even after an error, as the program still runs.
+    function->maxStack =
+        std::ranges::max(function->chunk.stack_depths(function->arity + 1));
+    if (options.registers && !err.hadError) {
+        RegisterGen(current->function, err).generate();
+    }
+    gen.fuseInstructions();
 
     if (options.debug_code) {
         if (!err.hadError) {
-            disassembleChunk(&current->function->chunk, function->name != nullptr
-                                                            ? function->name->str
-                                                            : "<script>");
+            const std::string_view name = function->name != nullptr
+                                              ? std::string_view(function->name->str)
+                                              : "<script>";
+            disassembleChunk(&current->function->chunk, name);
+            if (options.registers) {
+                disassembleRegisters(&current->function->chunk, name);
+            }
         }
     }
     current = current->enclosing;
@@ -110,7 +268,7 @@ int Compiler::resolveLocal(Context *compiler, const std::string &name) {
     return -1;
 }
 
-int Compiler::addUpvalue(Context *compiler, uint8_t index, bool isLocal) {
+int Compiler::addUpvalue(Context *compiler, uint8_t index, bool isLocal, bool copied) {
     const int upvalueCount = compiler->function->upvalueCount;
 
     for (int i = 0; i < upvalueCount; i++) {
@@ -127,6 +285,7 @@ int Compiler::addUpvalue(Context *compiler, uint8_t index, bool isLocal) {
 
     compiler->upvalues[upvalueCount].isLocal = isLocal;
     compiler->upvalues[upvalueCount].index = index;
+    compiler->upvalues[upvalueCount].copied = copied;
     return compiler->function->upvalueCount++;
 }
 
@@ -137,13 +296,19 @@ int Compiler::resolveUpvalue(Context *compiler, const std::string &name) {
 
     const int local = resolveLocal(compiler->enclosing, name);
     if (local != -1) {
-        compiler->enclosing->locals[local].isCaptured = true;
-        return addUpvalue(compiler, (uint8_t)local, true);
+        // A variable that is never assigned is copied into the closure, only the others
+        // need an ObjUpvalue.
+        const bool copied = !compiler->enclosing->assigns(name);
+        if (!copied) {
+            compiler->enclosing->locals[local].isCaptured = true;
+        }
+        return addUpvalue(compiler, (uint8_t)local, true, copied);
     }
 
     const int upvalue = resolveUpvalue(compiler->enclosing, name);
     if (upvalue != -1) {
-        return addUpvalue(compiler, (uint8_t)upvalue, false);
+        return addUpvalue(compiler, (uint8_t)upvalue, false,
+                          compiler->enclosing->upvalues[upvalue].copied);
     }
 
     return -1;
@@ -159,6 +324,8 @@ void Compiler::addLocal(const std::string &name) {
     local->name = name;
     local->depth = -1;
     local->isCaptured = false;
+    local->lifted = false;
+    local->captures.clear();
 }
 
 void Compiler::declareVariable(const std::string &name) {
@@ -187,7 +354,7 @@ void Compiler::markInitialized() {
     current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
-void Compiler::defineVariable(const_index_t global) {
+void Compiler::defineVariable(global_index_t global) {
     if (current->scopeDepth > 0) {
         markInitialized();
         return;
@@ -195,18 +362,31 @@ void Compiler::defineVariable(const_index_t global) {
     gen.emitByteConst(OpCode::DEFINE_GLOBAL, global);
 }
 
-const_index_t Compiler::parseVariable(const std::string &var) {
+global_index_t Compiler::parseVariable(const std::string &var) {
     declareVariable(var);
     if (current->scopeDepth > 0) {
         return 0;
     }
-    return identifierConstant(var);
+    return globalSlot(var);
 }
 
 const_index_t Compiler::identifierConstant(const std::string &name) {
     return gen.makeConstant(value<Obj *>(newString(name)));
 }
 
+global_index_t Compiler::globalSlot(const std::string &name) {
+    ObjString     *string = newString(name);
+    global_index_t slot = 0;
+    if (globals.find(string, &slot)) {
+        return slot;
+    }
+    if (globals.get_count() == GLOBALS_MAX) {
+        error(gen.get_linenumber(), "Too many global variables.");
+        return 0;
+    }
+    return globals.slot(string);
+}
+
 void Compiler::namedVariable(const std::string &name, bool canAssign) {
     OpCode getOp, setOp;
     bool   is_16{false};
@@ -215,10 +395,12 @@ void Compiler::namedVariable(const std::string &name, bool canAssign) {
         getOp = OpCode::GET_LOCAL;
         setOp = OpCode::SET_LOCAL;
     } else if ((arg = resolveUpvalue(current, name)) != -1) {
-        getOp = OpCode::GET_UPVALUE;
+        // A copied variable is never assigned, so never set.
+        const bool copied = current->upvalues[arg].copied;
+        getOp = copied ? OpCode::GET_CAPTURED : OpCode::GET_UPVALUE;
         setOp = OpCode::SET_UPVALUE;
     } else {
-        arg = identifierConstant(name);
+        arg = globalSlot(name);
         getOp = OpCode::GET_GLOBAL;
         setOp = OpCode::SET_GLOBAL;
         is_16 = true;
@@ -239,27 +421,145 @@ void Compiler::namedVariable(const std::string &name, bool canAssign) {
     }
 }
 
+/**
+ * @brief The global functions of the script that calls can be bound to: declared once,
+ * not as a variable or class too, and never assigned.
+ */
+void Compiler::findDirects(Declaration *ast) {
+    directs.clear();
+    declared.clear();
+    std::map<std::string, FunctDec *> functions;
+    std::vector<std::string>          others;
+    for (auto *s : ast->stats) {
+        if (is<FunctDec>(s)) {
+            const auto &name = as<FunctDec>(s)->name->name;
+            if (!functions.emplace(name, as<FunctDec>(s)).second) {
+                others.push_back(name);
+            }
+            declared.push_back(name);
+        } else if (is<VarDec>(s)) {
+            others.push_back(as<VarDec>(s)->var->name);
+            declared.push_back(as<VarDec>(s)->var->name);
+        } else if (is<ClassDec>(s)) {
+            others.push_back(as<ClassDec>(s)->name);
+            declared.push_back(as<ClassDec>(s)->name);
+        }
+    }
+    for (const auto &[name, function] : functions) {
+        if (current->assigns(name) || std::ranges::find(others, name) != others.end()) {
+            continue;
+        }
+        // A function of the script captures nothing.
+        ObjClosure *closure = newClosure(newFunction());
+        directs.emplace(name, Direct{function, closure, globalSlot(name)});
+    }
+}
+
 void Compiler::function(FunctDec *ast, FunctionType type) {
     Context compiler;
-    initCompiler(&compiler, ast->name->name, type);
+    std::vector<std::string> captures;
+    Local                   *local = nullptr;
+    if (type == TYPE_FUNCTION && current->scopeDepth > 0 && liftFunction(ast, captures)) {
+        local = &current->locals[current->localCount - 1];
+        for (const auto &name : captures) {
+            local->captures.push_back(uint8_t(resolveLocal(current, name)));
+        }
+    }
+    ObjClosure *direct = nullptr;
+    if (current->type == TYPE_SCRIPT && current->scopeDepth == 0) {
+        auto found = directs.find(ast->name->name);
+        if (found != directs.end() && found->second.ast == ast) {
+            direct = found->second.closure;
+        }
+    }
+
+    initCompiler(&compiler, ast->name->name, type,
+                 direct != nullptr ? direct->function : nullptr);
+    current->assigned = &ast->assigned;
+    current->body = OBJ_AST(ast->body);
     beginScope();
 
     for (auto p : ast->parameters) {
         current->function->arity++;
-        const uint8_t constant = parseVariable(p->name);
+        const auto constant = parseVariable(p->name);
+        defineVariable(constant);
+    }
+    for (const auto &name : captures) {
+        current->function->arity++;
+        const auto constant = parseVariable(name);
         defineVariable(constant);
     }
     block(ast->body);
 
     ObjFunction *function = endCompiler();
+    if (direct != nullptr) {
+        // The script runs once, so this is the only closure of the function.
+        gen.emitConstant(value<Obj *>(direct));
+        return;
+    }
+    if (local != nullptr) {
+        local->lifted = true;
+        if (function->upvalueCount == 0) {
+            // Nothing of the frame is in it, so one closure does for all the calls.
+            gen.emitConstant(value<Obj *>(newClosure(function)));
+            return;
+        }
+    }
     gen.emitByteConst(OpCode::CLOSURE, gen.makeConstant(value<Obj *>(function)));
 
     for (int i = 0; i < function->upvalueCount; i++) {
-        gen.emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
-        gen.emitByte(compiler.upvalues[i].index);
+        const Upvalue &upvalue = compiler.upvalues[i];
+        CaptureKind    kind = CAPTURE_UPVALUE;
+        if (upvalue.isLocal) {
+            kind = upvalue.copied ? CAPTURE_LOCAL_COPY : CAPTURE_LOCAL;
+        }
+        gen.emitByte(kind);
+        gen.emitByte(upvalue.index);
     }
 }
 
+/**
+ * @brief Whether the local function being declared can be lambda lifted: it never
+ * escapes the frame, and what it captures are locals of the frame that are never
+ * assigned. Its calls then pass those as arguments, in captures.
+ */
+bool Compiler::liftFunction(FunctDec *ast, std::vector<std::string> &captures) {
+    const auto &name = ast->name->name;
+    if (err.hadError || !onlyCalled(current->body, name, ast->parameters.size())) {
+        return false;
+    }
+    Names names;
+    collectNames(OBJ_AST(ast->body), names);
+    if (names.this_) {
+        return false;
+    }
+    for (const auto &used : names.used) {
+        if (std::ranges::any_of(ast->parameters,
+                                [&](Identifier *p) { return p->name == used; })) {
+            continue;
+        }
+        auto declared = [&](Context *c) {
+            return std::any_of(c->locals.begin(), c->locals.begin() + c->localCount,
+                               [&](const Local &l) { return l.name == used; });
+        };
+        if (declared(current)) {
+            // A name declared in the function too may be either variable.
+            if (current->assigns(used) ||
+                std::ranges::find(names.declared, used) != names.declared.end()) {
+                return false;
+            }
+            captures.push_back(used);
+            continue;
+        }
+        for (Context *c = current->enclosing; c != nullptr; c = c->enclosing) {
+            if (declared(c)) {
+                return false; // an upvalue of this frame.
+            }
+        }
+    }
+    return ast->parameters.size() + captures.size() <= MAX_ARGS;
+}
+
 uint8_t Compiler::argumentList(const std::vector<Expr *> &args) {
     for (auto *arg : args) {
         expr(arg);
@@ -273,6 +573,8 @@ void Compiler::method(FunctDec *ast) {
     if (ast->name->name == "init") {
         type = TYPE_INITIALIZER;
     }
+    // Numbered as it is compiled, so the vtables are laid out before the program runs.
+    methodSelector(newString(ast->name->name));
 
     function(ast, type);
     gen.emitByteConst(OpCode::METHOD, constant);
@@ -316,6 +618,9 @@ void Compiler::this_(This *ast, bool canAssign) {
 ObjFunction *Compiler::compile(Declaration *ast) {
     Context compiler{};
     initCompiler(&compiler, "script>", TYPE_SCRIPT);
+    current->assigned = &ast->assigned;
+    current->body = OBJ_AST(ast);
+    findDirects(ast);
 
     declaration(ast);
 
@@ -346,7 +651,7 @@ void Compiler::decs_statement(Obj *s) {
 
 void Compiler::varDeclaration(VarDec *ast) {
     gen.set_linenumber(ast->get_line());
-    const uint8_t global = parseVariable(ast->var->name);
+    const auto global = parseVariable(ast->var->name);
     if (ast->expr) {
         expr(ast->expr);
     } else {
@@ -357,7 +662,7 @@ void Compiler::varDeclaration(VarDec *ast) {
 
 void Compiler::funDeclaration(FunctDec *ast) {
     gen.set_linenumber(ast->get_line());
-    const uint8_t global = parseVariable(ast->name->name);
+    const auto global = parseVariable(ast->name->name);
     markInitialized();
     function(ast, TYPE_FUNCTION);
     defineVariable(global);
@@ -366,10 +671,10 @@ void Compiler::funDeclaration(FunctDec *ast) {
 void Compiler::classDeclaration(ClassDec *ast) {
     gen.set_linenumber(ast->get_line());
     auto nameConstant = identifierConstant(ast->name);
-    declareVariable(ast->name); // replace
+    auto global = parseVariable(ast->name);
 
     gen.emitByteConst(OpCode::CLASS, nameConstant);
-    defineVariable(nameConstant);
+    defineVariable(global);
 
     ClassContext classCompiler{};
     classCompiler.hasSuperclass = false;
@@ -414,6 +719,10 @@ void Compiler::statement(Statement *ast) {
         returnStatement(as<Return>(ast->stat));
     } else if (is<While>(ast->stat)) {
         whileStatement(as<While>(ast->stat));
+    } else if (is<Try>(ast->stat)) {
+        tryStatement(as<Try>(ast->stat));
+    } else if (is<Throw>(ast->stat)) {
+        throwStatement(as<Throw>(ast->stat));
     } else if (is<Break>(ast->stat)) {
         breakStatement(as<Break>(ast->stat));
     } else if (is<Block>(ast->stat)) {
@@ -544,11 +853,64 @@ void Compiler::returnStatement(Return *ast) {
         if (current->type == TYPE_INITIALIZER) {
             error(ast->get_line(), "Can't return a value from an initializer.");
         }
-        expr(ast->expr);
+        if (current->enclosing_try > 0 || !tailCall(ast->expr)) {
+            expr(ast->expr);
+        }
         gen.emitByte(OpCode::RETURN);
     }
 }
 
+/**
+ * @brief The try block is a range in the chunk's table of handlers, so running it costs
+ * nothing more than the jump over the catch block at its end. The handler starts with
+ * the locals of the try statement and the exception, which becomes the catch variable.
+ */
+void Compiler::tryStatement(Try *ast) {
+    Chunk       &chunk = current->function->chunk;
+    const int    depth = current->localCount;
+    const size_t start = gen.get_position();
+
+    current->enclosing_try++;
+    beginScope();
+    block(ast->body);
+    endScope();
+    current->enclosing_try--;
+
+    const size_t end = gen.get_position();
+    const int    exitJump = gen.emitJump(OpCode::JUMP);
+    chunk.add_handler({start, end, gen.get_position(), depth});
+
+    beginScope();
+    addLocal(ast->var->name);
+    markInitialized();
+    block(ast->handler);
+    endScope();
+    gen.patchJump(exitJump);
+}
+
+void Compiler::throwStatement(Throw *ast) {
+    expr(ast->expr);
+    gen.emitByte(OpCode::THROW);
+}
+
+// Compile a returned call as a tail call, if it is one.
+bool Compiler::tailCall(Expr *ast) {
+    Expr *inner = ast;
+    while (is<Expr>(inner->expr)) {
+        inner = as<Expr>(inner->expr);
+    }
+    gen.set_linenumber(inner->get_line());
+    if (is<Call>(inner->expr)) {
+        call(as<Call>(inner->expr), true);
+        return true;
+    }
+    if (is<Dot>(inner->expr) && as<Dot>(inner->expr)->token == TokenType::LEFT_PAREN) {
+        dot(as<Dot>(inner->expr), false, true);
+        return true;
+    }
+    return false;
+}
+
 void Compiler::breakStatement(Break *ast) {
     debug("breakStatement");
     const auto *name = ast->tok == TokenType::BREAK ? "break" : "continue";
@@ -618,6 +980,8 @@ void Compiler::expr(Expr *ast, bool canAssign) {
         boolean(as<Boolean>(ast->expr));
     } else if (is<This>(ast->expr)) {
         this_(as<This>(ast->expr), canAssign);
+    } else if (is<Yield>(ast->expr)) {
+        yield(as<Yield>(ast->expr));
     } else if (is<Nil>(ast->expr)) {
         gen.emitByte(OpCode::NIL);
     }
@@ -629,10 +993,92 @@ void Compiler::assign(Assign *ast) {
     expr(ast->left, true);
 }
 
-void Compiler::call(Call *ast) {
+void Compiler::call(Call *ast, bool tail) {
+    if (intrinsicCall(ast) || (!tail && directCall(ast))) {
+        return;
+    }
     expr(ast->fname, false);
+    uint8_t argCount = argumentList(ast->args);
+    if (callee(ast) != nullptr) {
+        // A lifted function gets what it would have captured.
+        const auto &name = callee(ast)->name;
+        for (int i = current->localCount - 1; i >= 0; i--) {
+            const Local &local = current->locals[i];
+            if (local.name == name) {
+                if (local.lifted) {
+                    for (const uint8_t slot : local.captures) {
+                        gen.emitBytes(OpCode::GET_LOCAL, slot);
+                    }
+                    argCount += local.captures.size();
+                }
+                break;
+            }
+        }
+    }
+    gen.emitBytes(tail ? OpCode::TAIL_CALL : OpCode::CALL, argCount);
+}
+
+/**
+ * @brief A call of a global function of directs with the right number of arguments
+ * pushes its closure as a constant, and CALL_DIRECT checks at run time that the global
+ * still holds it, in place of GET_GLOBAL and the checks of CALL.
+ */
+bool Compiler::directCall(Call *ast) {
+    if (callee(ast) == nullptr) {
+        return false;
+    }
+    const auto &name = callee(ast)->name;
+    auto        found = directs.find(name);
+    if (found == directs.end() ||
+        ast->args.size() != found->second.ast->parameters.size()) {
+        return false;
+    }
+    if (isLocal(name)) {
+        return false;
+    }
+    gen.emitConstant(value<Obj *>(found->second.closure));
     const uint8_t argCount = argumentList(ast->args);
-    gen.emitBytes(OpCode::CALL, argCount);
+    gen.emitByteConst(OpCode::CALL_DIRECT, found->second.slot);
+    gen.emitByte(argCount);
+    return true;
+}
+
+/**
+ * @brief A call by name of a native of intrinsics, which the script never declares or
+ * assigns, is its opcode. The opcode checks the types of the arguments, and that the
+ * global still holds the native.
+ */
+bool Compiler::intrinsicCall(Call *ast) {
+    if (callee(ast) == nullptr) {
+        return false;
+    }
+    const auto &name = callee(ast)->name;
+    const auto *found = std::ranges::find(intrinsics, name, &Intrinsic::name);
+    if (found == intrinsics.end() || ast->args.size() != size_t(found->arity) ||
+        isLocal(name) || std::ranges::find(declared, name) != declared.end()) {
+        return false;
+    }
+    Context *script = current;
+    while (script->enclosing != nullptr) {
+        script = script->enclosing;
+    }
+    if (script->assigns(name)) {
+        return false;
+    }
+    argumentList(ast->args);
+    gen.emitByteConst(found->op, globalSlot(name));
+    return true;
+}
+
+// Whether name is a local of the function or of one it is in.
+bool Compiler::isLocal(const std::string &name) {
+    for (Context *c = current; c != nullptr; c = c->enclosing) {
+        if (std::any_of(c->locals.begin(), c->locals.begin() + c->localCount,
+                        [&](const Local &l) { return l.name == name; })) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void Compiler::binary(Binary *ast, bool canAssign) {
@@ -706,18 +1152,18 @@ void Compiler::or_(Binary *ast, bool canAssign) {
     gen.patchJump(endJump);
 }
 
-void Compiler::dot(Dot *ast, bool canAssign) {
+void Compiler::dot(Dot *ast, bool canAssign, bool tail) {
     expr(ast->left, canAssign);
     auto name = identifierConstant(ast->id);
     if (ast->token == TokenType::EQUAL) {
         expr(ast->args[0]);
-        gen.emitByteConst(OpCode::SET_PROPERTY, name);
+        gen.emitByteConstCache(OpCode::SET_PROPERTY, name);
     } else if (ast->token == TokenType::LEFT_PAREN) {
         const uint8_t argCount = argumentList(ast->args);
-        gen.emitByteConst(OpCode::INVOKE, name);
+        gen.emitByteConstCache(tail ? OpCode::TAIL_INVOKE : OpCode::INVOKE, name);
         gen.emitByte(argCount);
     } else {
-        gen.emitByteConst(OpCode::GET_PROPERTY, name);
+        gen.emitByteConstCache(OpCode::GET_PROPERTY, name);
     }
 }
 
@@ -737,6 +1183,15 @@ void Compiler::unary(Unary *ast, bool canAssign) {
     }
 }
 
+// The VM checks that a function yields in a coroutine, the script never runs in one.
+void Compiler::yield(Yield *ast) {
+    if (current->type == TYPE_SCRIPT) {
+        error(ast->get_line(), "Can't yield from top-level code.");
+    }
+    expr(ast->expr);
+    gen.emitByte(OpCode::YIELD);
+}
+
 void Compiler::variable(Identifier *ast, bool canAssign) {
     namedVariable(ast->name, canAssign);
 }
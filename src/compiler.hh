@@ -9,16 +9,19 @@
 #include "chunk.hh"
 #include "codegen.hh"
 #include "context.hh"
+#include "globals.hh"
 #include "object.hh"
 #include "options.hh"
 
+#include <map>
 #include <string_view>
 
 namespace alox {
 
 class Compiler {
   public:
-    Compiler(const Options &opt, ErrorManager &err) : options(opt), err(err), gen(err){};
+    Compiler(const Options &opt, ErrorManager &err, Globals &globals)
+        : options(opt), err(err), globals(globals), gen(err){};
     ~Compiler() = default;
 
     ObjFunction *compile(Declaration *ast);
@@ -37,6 +40,8 @@ class Compiler {
     void whileStatement(While *ast);
     void printStatement(Print *ast);
     void returnStatement(Return *ast);
+    void tryStatement(Try *ast);
+    void throwStatement(Throw *ast);
     void breakStatement(Break *ast);
     void block(Block *);
     void exprStatement(Expr *ast);
@@ -44,11 +49,16 @@ class Compiler {
     void expr(Expr *ast, bool canAssign = false);
     void binary(Binary *ast, bool canAssign);
     void assign(Assign *ast);
-    void call(Call *ast);
-    void dot(Dot *ast, bool canAssign);
+    void call(Call *ast, bool tail = false);
+    bool directCall(Call *ast);
+    bool intrinsicCall(Call *ast);
+    bool isLocal(const std::string &name);
+    void dot(Dot *ast, bool canAssign, bool tail = false);
+    bool tailCall(Expr *ast);
     void and_(Binary *ast, bool canAssign);
     void or_(Binary *ast, bool canAssign);
     void unary(Unary *ast, bool canAssign);
+    void yield(Yield *ast);
     void variable(Identifier *ast, bool canAssign);
     void number(Number *ast);
     void string(String *ast);
@@ -57,24 +67,29 @@ class Compiler {
     void super_(This *ast, bool /*canAssign*/);
     void this_(This *ast, bool /*canAssign*/);
 
-    void initCompiler(Context *compiler, const std::string &name, FunctionType type);
+    void initCompiler(Context *compiler, const std::string &name, FunctionType type,
+                      ObjFunction *function = nullptr);
     ObjFunction *endCompiler();
 
-    const_index_t parseVariable(const std::string &var);
-    void          declareVariable(const std::string &name);
-    void          addLocal(const std::string &name);
-    const_index_t identifierConstant(const std::string &name);
-    void          defineVariable(const_index_t global);
-    void          markInitialized();
-    void          beginScope();
-    void          endScope();
-    void          namedVariable(const std::string &name, bool canAssign);
-    void          adjust_locals(int depth);
-    int           resolveLocal(Context *compiler, const std::string &name);
-    int           addUpvalue(Context *compiler, uint8_t index, bool isLocal);
-    int           resolveUpvalue(Context *compiler, const std::string &name);
-
+    global_index_t parseVariable(const std::string &var);
+    void           declareVariable(const std::string &name);
+    void           addLocal(const std::string &name);
+    const_index_t  identifierConstant(const std::string &name);
+    global_index_t globalSlot(const std::string &name);
+    void           defineVariable(global_index_t global);
+    void           markInitialized();
+    void           beginScope();
+    void           endScope();
+    void           namedVariable(const std::string &name, bool canAssign);
+    void           adjust_locals(int depth);
+    int            resolveLocal(Context *compiler, const std::string &name);
+    int            addUpvalue(Context *compiler, uint8_t index, bool isLocal,
+                              bool copied);
+    int            resolveUpvalue(Context *compiler, const std::string &name);
+
+    void    findDirects(Declaration *ast);
     void    function(FunctDec *ast, FunctionType type);
+    bool    liftFunction(FunctDec *ast, std::vector<std::string> &captures);
     void    method(FunctDec *ast);
     uint8_t argumentList(const std::vector<Expr *> &args);
 
@@ -82,6 +97,17 @@ class Compiler {
 
     const Options &options;
     ErrorManager  &err;
+    Globals       &globals;
+
+    // A global function declared once in the script and never assigned. Its closure is
+    // made before it is compiled so that calls, its own too, can refer to it.
+    struct Direct {
+        FunctDec      *ast;
+        ObjClosure    *closure;
+        global_index_t slot;
+    };
+    std::map<std::string, Direct> directs;
+    std::vector<std::string>      declared; // the globals the script declares.
 
     Context      *current{nullptr};
     ClassContext *currentClass{nullptr};
@@ -6,11 +6,11 @@
 
 namespace alox {
 
-void Context::init(Context *enclosing, FunctionType type) {
+void Context::init(Context *enclosing, FunctionType type, ObjFunction *function) {
     // Compiler is created on the stack.
     this->enclosing = enclosing;
     this->type = type;
-    this->function = newFunction();
+    this->function = function != nullptr ? function : newFunction();
 }
 
 BreakContext Context::save_break_context() {
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
 
 #include "object.hh"
@@ -15,11 +16,16 @@ struct Local {
     std::string name;
     int         depth{};
     bool        isCaptured{false};
+    // A local function that doesn't escape, called with these locals as more arguments
+    // in place of capturing them.
+    bool                 lifted{false};
+    std::vector<uint8_t> captures;
 };
 
 struct Upvalue {
     uint8_t index;
     bool    isLocal;
+    bool    copied; // the value, as the variable is never assigned.
 };
 
 enum FunctionType { TYPE_FUNCTION, TYPE_INITIALIZER, TYPE_METHOD, TYPE_SCRIPT };
@@ -32,15 +38,25 @@ using BreakContext = std::tuple<int, int, int>;
  */
 class Context {
   public:
-    void init(Context *enclosing, FunctionType type);
+    // function is made if null.
+    void init(Context *enclosing, FunctionType type, ObjFunction *function = nullptr);
 
     BreakContext save_break_context();
     void         restore_break_context(const BreakContext &context);
 
+    // Whether the function, or one nested in it, assigns a variable of this name.
+    [[nodiscard]] bool assigns(const std::string &name) const {
+        return assigned == nullptr ||
+               std::ranges::find(*assigned, name) != assigned->end();
+    }
+
     Context     *enclosing{nullptr};
     ObjFunction *function{nullptr};
     FunctionType type;
 
+    const std::vector<std::string> *assigned{nullptr}; // from the parser.
+    Obj                            *body{nullptr};     // for the escape analysis.
+
     std::array<Local, UINT8_COUNT>   locals;
     int                              localCount{0};
     std::array<Upvalue, UINT8_COUNT> upvalues{};
@@ -50,6 +66,7 @@ class Context {
     size_t last_break{0};
     int    last_scope_depth{0};
     int    enclosing_loop{0};
+    int    enclosing_try{0}; // try blocks, in which a call can't replace the frame.
 };
 
 struct ClassContext {
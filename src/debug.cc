@@ -2,22 +2,56 @@
 // ALOX-CC
 //
 
+#include <array>
 #include <iostream>
+#include <sstream>
 
 #include <fmt/core.h>
 
 #include "debug.hh"
+#include "globals.hh"
 #include "object.hh"
 #include "value.hh"
 
 namespace alox {
 
+// Must be in the same order as OpCode.
+constexpr std::array<std::string_view, OPCODE_COUNT> opcode_names{
+    "CONSTANT",       "NIL",            "TRUE",           "FALSE",          "ZERO",
+    "ONE",            "POP",            "GET_LOCAL",      "SET_LOCAL",      "GET_GLOBAL",
+    "DEFINE_GLOBAL",  "SET_GLOBAL",     "GET_UPVALUE",    "SET_UPVALUE",    "GET_CAPTURED",
+    "GET_PROPERTY",   "SET_PROPERTY",   "GET_SUPER",      "EQUAL",          "NOT_EQUAL",
+    "GREATER",        "NOT_GREATER",    "LESS",           "NOT_LESS",       "ADD",
+    "SUBTRACT",       "MULTIPLY",       "DIVIDE",         "NOT",            "NEGATE",
+    "PRINT",          "JUMP",           "JUMP_IF_FALSE",  "LOOP",           "CALL",
+    "INVOKE",         "SUPER_INVOKE",   "CLOSURE",        "CLOSE_UPVALUE",  "RETURN",
+    "CLASS",          "INHERIT",        "METHOD",         "TAIL_CALL",      "TAIL_INVOKE",
+    "CALL_DIRECT",    "CLOCK",          "GETC",           "CHR",            "ORD",
+    "THROW",          "YIELD",          "GET_LOCAL_LOCAL",
+    "GET_LOCAL_CONSTANT",               "GET_LOCAL_PROPERTY",
+    "SET_PROPERTY_POP",                 "JUMP_IF_FALSE_POP",
+    "LESS_JUMP_IF_FALSE",               "EQUAL_JUMP_IF_FALSE",
+    "ADD_NUMBER",     "ADD_STRING",     "EQUAL_NUMBER",   "NOT_EQUAL_NUMBER",
+    "ADD_GENERIC",    "EQUAL_GENERIC",  "NOT_EQUAL_GENERIC"};
+
+std::string_view opcodeName(OpCode op) {
+    return opcode_names[size_t(op)];
+}
+
+static void disassembleHandlers(const std::vector<ExceptionHandler> &handlers) {
+    for (const ExceptionHandler &handler : handlers) {
+        fmt::print("try {:04d} - {:04d} catch {:04d} depth {:d}\n", handler.start,
+                   handler.end, handler.target, handler.depth);
+    }
+}
+
 void disassembleChunk(Chunk *chunk, const std::string_view &name) {
     fmt::print("== {} ==\n", name);
 
     for (int offset = 0; offset < chunk->get_count();) {
         offset = disassembleInstruction(chunk, offset);
     }
+    disassembleHandlers(chunk->get_handlers());
 }
 
 static int constantInstruction(const char *name, Chunk *chunk, int offset) {
@@ -39,6 +73,44 @@ static int invokeInstruction(const char *name, Chunk *chunk, int offset) {
     return offset + 4;
 }
 
+static int cacheInstruction(const char *name, Chunk *chunk, int offset) {
+    auto constant = const_index_t(chunk->get_code(offset + 1) << UINT8_WIDTH);
+    constant |= chunk->get_code(offset + 2);
+    auto cache = cache_index_t(chunk->get_code(offset + 3) << UINT8_WIDTH);
+    cache |= chunk->get_code(offset + 4);
+    fmt::print("{:<16}    {:d} '", name, constant);
+    printValue(std::cout, chunk->get_value(constant));
+    fmt::print("' [{:d}]\n", cache);
+    return offset + 5;
+}
+
+static int invokeCacheInstruction(const char *name, Chunk *chunk, int offset) {
+    auto constant = const_index_t(chunk->get_code(offset + 1) << UINT8_WIDTH);
+    constant |= chunk->get_code(offset + 2);
+    auto cache = cache_index_t(chunk->get_code(offset + 3) << UINT8_WIDTH);
+    cache |= chunk->get_code(offset + 4);
+    uint8_t argCount = chunk->get_code(offset + 5);
+    fmt::print("{:<16}    ({:d} args) {:4d} '", name, argCount, constant);
+    printValue(std::cout, chunk->get_value(constant));
+    fmt::print("' [{:d}]\n", cache);
+    return offset + 6;
+}
+
+static int directInstruction(const char *name, Chunk *chunk, int offset) {
+    auto slot = global_index_t(chunk->get_code(offset + 1) << UINT8_WIDTH);
+    slot |= chunk->get_code(offset + 2);
+    uint8_t argCount = chunk->get_code(offset + 3);
+    fmt::print("{:<16}    ({:d} args) {:4d}\n", name, argCount, slot);
+    return offset + 4;
+}
+
+static int globalInstruction(const char *name, Chunk *chunk, int offset) {
+    auto slot = global_index_t(chunk->get_code(offset + 1) << UINT8_WIDTH);
+    slot |= chunk->get_code(offset + 2);
+    fmt::print("{:<16} {:4d}\n", name, slot);
+    return offset + 3;
+}
+
 static int simpleInstruction(const char *name, int offset) {
     fmt::print("{}\n", name);
     return offset + 1;
@@ -50,6 +122,35 @@ static int byteInstruction(const char *name, Chunk *chunk, int offset) {
     return offset + 2; // [debug]
 }
 
+static int twoByteInstruction(const char *name, Chunk *chunk, int offset) {
+    uint8_t first = chunk->get_code(offset + 1);
+    uint8_t second = chunk->get_code(offset + 2);
+    fmt::print("{:<16} {:4d} {:4d}\n", name, first, second);
+    return offset + 3;
+}
+
+static int localConstantInstruction(const char *name, Chunk *chunk, int offset) {
+    uint8_t slot = chunk->get_code(offset + 1);
+    auto    constant = const_index_t(chunk->get_code(offset + 2) << UINT8_WIDTH);
+    constant |= chunk->get_code(offset + 3);
+    fmt::print("{:<16} {:4d} {:d} '", name, slot, constant);
+    printValue(std::cout, chunk->get_value(constant));
+    std::cout << "'\n";
+    return offset + 4;
+}
+
+static int localCacheInstruction(const char *name, Chunk *chunk, int offset) {
+    uint8_t slot = chunk->get_code(offset + 1);
+    auto    constant = const_index_t(chunk->get_code(offset + 2) << UINT8_WIDTH);
+    constant |= chunk->get_code(offset + 3);
+    auto cache = cache_index_t(chunk->get_code(offset + 4) << UINT8_WIDTH);
+    cache |= chunk->get_code(offset + 5);
+    fmt::print("{:<16} {:4d} {:d} '", name, slot, constant);
+    printValue(std::cout, chunk->get_value(constant));
+    fmt::print("' [{:d}]\n", cache);
+    return offset + 6;
+}
+
 static int jumpInstruction(const char *name, int sign, Chunk *chunk, int offset) {
     auto jump = (uint16_t)(chunk->get_code(offset + 1) << UINT8_WIDTH);
     jump |= chunk->get_code(offset + 2);
@@ -86,19 +187,21 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     case OpCode::SET_LOCAL:
         return byteInstruction("SET_LOCAL", chunk, offset);
     case OpCode::GET_GLOBAL:
-        return constantInstruction("GET_GLOBAL", chunk, offset);
+        return globalInstruction("GET_GLOBAL", chunk, offset);
     case OpCode::DEFINE_GLOBAL:
-        return constantInstruction("DEFINE_GLOBAL", chunk, offset);
+        return globalInstruction("DEFINE_GLOBAL", chunk, offset);
     case OpCode::SET_GLOBAL:
-        return constantInstruction("SET_GLOBAL", chunk, offset);
+        return globalInstruction("SET_GLOBAL", chunk, offset);
     case OpCode::GET_UPVALUE:
         return byteInstruction("GET_UPVALUE", chunk, offset);
     case OpCode::SET_UPVALUE:
         return byteInstruction("SET_UPVALUE", chunk, offset);
+    case OpCode::GET_CAPTURED:
+        return byteInstruction("GET_CAPTURED", chunk, offset);
     case OpCode::GET_PROPERTY:
-        return constantInstruction("GET_PROPERTY", chunk, offset);
+        return cacheInstruction("GET_PROPERTY", chunk, offset);
     case OpCode::SET_PROPERTY:
-        return constantInstruction("SET_PROPERTY", chunk, offset);
+        return cacheInstruction("SET_PROPERTY", chunk, offset);
     case OpCode::GET_SUPER:
         return constantInstruction("GET_SUPER", chunk, offset);
     case OpCode::EQUAL:
@@ -136,7 +239,7 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     case OpCode::CALL:
         return byteInstruction("CALL", chunk, offset);
     case OpCode::INVOKE:
-        return invokeInstruction("INVOKE", chunk, offset);
+        return invokeCacheInstruction("INVOKE", chunk, offset);
     case OpCode::SUPER_INVOKE:
         return invokeInstruction("SUPER_INVOKE", chunk, offset);
     case OpCode::CLOSURE: {
@@ -149,10 +252,13 @@ int disassembleInstruction(Chunk *chunk, int offset) {
 
         ObjFunction *function = as<ObjFunction *>(chunk->get_value(constant));
         for (int j = 0; j < function->upvalueCount; j++) {
-            const int isLocal = chunk->get_code(offset++);
+            const int kind = chunk->get_code(offset++);
             int       index = chunk->get_code(offset++);
             fmt::print("{:04d}      |                     {} {:d}\n", offset - 2,
-                       isLocal ? "local" : "upvalue", index);
+                       kind == CAPTURE_LOCAL        ? "local"
+                       : kind == CAPTURE_LOCAL_COPY ? "copy"
+                                                    : "upvalue",
+                       index);
         }
 
         return offset;
@@ -167,10 +273,192 @@ int disassembleInstruction(Chunk *chunk, int offset) {
         return simpleInstruction("INHERIT", offset);
     case OpCode::METHOD:
         return constantInstruction("METHOD", chunk, offset);
+    case OpCode::TAIL_CALL:
+        return byteInstruction("TAIL_CALL", chunk, offset);
+    case OpCode::TAIL_INVOKE:
+        return invokeCacheInstruction("TAIL_INVOKE", chunk, offset);
+    case OpCode::CALL_DIRECT:
+        return directInstruction("CALL_DIRECT", chunk, offset);
+    case OpCode::CLOCK:
+        return globalInstruction("CLOCK", chunk, offset);
+    case OpCode::GETC:
+        return globalInstruction("GETC", chunk, offset);
+    case OpCode::CHR:
+        return globalInstruction("CHR", chunk, offset);
+    case OpCode::ORD:
+        return globalInstruction("ORD", chunk, offset);
+    case OpCode::THROW:
+        return simpleInstruction("THROW", offset);
+    case OpCode::YIELD:
+        return simpleInstruction("YIELD", offset);
+    case OpCode::GET_LOCAL_LOCAL:
+        return twoByteInstruction("GET_LOCAL_LOCAL", chunk, offset);
+    case OpCode::GET_LOCAL_CONSTANT:
+        return localConstantInstruction("GET_LOCAL_CONSTANT", chunk, offset);
+    case OpCode::GET_LOCAL_PROPERTY:
+        return localCacheInstruction("GET_LOCAL_PROPERTY", chunk, offset);
+    case OpCode::SET_PROPERTY_POP:
+        return cacheInstruction("SET_PROPERTY_POP", chunk, offset);
+    case OpCode::JUMP_IF_FALSE_POP:
+        return jumpInstruction("JUMP_IF_FALSE_POP", 1, chunk, offset);
+    case OpCode::LESS_JUMP_IF_FALSE:
+        return jumpInstruction("LESS_JUMP_IF_FALSE", 1, chunk, offset);
+    case OpCode::EQUAL_JUMP_IF_FALSE:
+        return jumpInstruction("EQUAL_JUMP_IF_FALSE", 1, chunk, offset);
+    case OpCode::ADD_NUMBER:
+        return simpleInstruction("ADD_NUMBER", offset);
+    case OpCode::ADD_STRING:
+        return simpleInstruction("ADD_STRING", offset);
+    case OpCode::EQUAL_NUMBER:
+        return simpleInstruction("EQUAL_NUMBER", offset);
+    case OpCode::NOT_EQUAL_NUMBER:
+        return simpleInstruction("NOT_EQUAL_NUMBER", offset);
+    case OpCode::ADD_GENERIC:
+        return simpleInstruction("ADD_GENERIC", offset);
+    case OpCode::EQUAL_GENERIC:
+        return simpleInstruction("EQUAL_GENERIC", offset);
+    case OpCode::NOT_EQUAL_GENERIC:
+        return simpleInstruction("NOT_EQUAL_GENERIC", offset);
     default:
         fmt::print("Unknown opcode {:d}\n", uint8_t(instruction));
         return offset + 1;
     }
 }
 
+constexpr std::array<std::string_view, size_t(RegOp::EXTRA) + 1> regop_names{
+    "MOVE",         "LOADK",     "GET_GLOBAL",  "DEFINE_GLOBAL", "SET_GLOBAL",
+    "GET_UPVALUE",  "SET_UPVALUE", "GET_CAPTURED", "GET_PROPERTY", "SET_PROPERTY",
+    "GET_SUPER",    "EQUAL",     "NOT_EQUAL",   "GREATER",       "NOT_GREATER",
+    "LESS",         "NOT_LESS",  "ADD",         "SUBTRACT",      "MULTIPLY",
+    "DIVIDE",       "NOT",       "NEGATE",      "PRINT",         "JUMP",
+    "JUMP_IF_FALSE", "CALL",     "CALL_DIRECT", "INTRINSIC",     "INVOKE",
+    "SUPER_INVOKE", "CLOSURE",   "CLOSE_UPVALUE", "RETURN",      "THROW",
+    "YIELD",        "CLASS",     "INHERIT",     "METHOD",        "TAIL_CALL",
+    "TAIL_INVOKE",  "EXTRA"};
+
+static std::string registerOperand(Chunk *chunk, uint16_t operand) {
+    if ((operand & RK_CONSTANT) == 0) {
+        return fmt::format("r{:d}", operand);
+    }
+    std::ostringstream os;
+    printValue(os, chunk->get_value(operand & ~RK_CONSTANT));
+    return fmt::format("'{}'", os.str());
+}
+
+std::string_view regopName(RegOp op) {
+    return regop_names[size_t(op)];
+}
+
+/**
+ * @brief Print the register instruction at offset, with its raw operands, and constants
+ * shown for the RK operands of the common instructions.
+ */
+void disassembleRegister(Chunk *chunk, size_t offset) {
+    RegisterChunk  &code = chunk->get_registers();
+    const RegInstr &instr = code.get_code(offset);
+    fmt::print("{:04d} ", offset);
+    if (offset > 0 && code.get_line(offset) == code.get_line(offset - 1)) {
+        fmt::print("   | ");
+    } else {
+        fmt::print("{:04d} ", code.get_line(offset));
+    }
+    fmt::print("{:<16}", regopName(instr.op));
+    switch (instr.op) {
+    case RegOp::MOVE:
+    case RegOp::NOT:
+    case RegOp::NEGATE:
+        fmt::print(" r{:d} {}\n", instr.a, registerOperand(chunk, instr.b));
+        break;
+    case RegOp::DEFINE_GLOBAL:
+    case RegOp::SET_GLOBAL:
+    case RegOp::SET_UPVALUE:
+        fmt::print(" {:d} {}\n", instr.a, registerOperand(chunk, instr.b));
+        break;
+    case RegOp::EQUAL:
+    case RegOp::NOT_EQUAL:
+    case RegOp::GREATER:
+    case RegOp::NOT_GREATER:
+    case RegOp::LESS:
+    case RegOp::NOT_LESS:
+    case RegOp::ADD:
+    case RegOp::SUBTRACT:
+    case RegOp::MULTIPLY:
+    case RegOp::DIVIDE:
+        fmt::print(" r{:d} {} {}\n", instr.a, registerOperand(chunk, instr.b),
+                   registerOperand(chunk, instr.c));
+        break;
+    case RegOp::PRINT:
+    case RegOp::RETURN:
+    case RegOp::THROW:
+    case RegOp::YIELD:
+        fmt::print(" {}\n", registerOperand(chunk, instr.a));
+        break;
+    case RegOp::JUMP:
+        fmt::print(" -> {:d}\n", int(offset) + 1 + instr.offset());
+        break;
+    case RegOp::JUMP_IF_FALSE:
+        fmt::print(" {} -> {:d}\n", registerOperand(chunk, instr.a),
+                   int(offset) + 1 + instr.offset());
+        break;
+    default:
+        fmt::print(" {:d} {:d} {:d}\n", instr.a, instr.b, instr.c);
+        break;
+    }
+}
+
+/**
+ * @brief Print the register code made for chunk, one instruction a line.
+ */
+void disassembleRegisters(Chunk *chunk, const std::string_view &name) {
+    fmt::print("== {} registers ==\n", name);
+    RegisterChunk &code = chunk->get_registers();
+    for (size_t i = 0; i < code.get_count(); i++) {
+        disassembleRegister(chunk, i);
+    }
+    disassembleHandlers(code.get_handlers());
+}
+
+static void dumpFunctionCaches(std::ostream &os, ObjFunction *function) {
+    Chunk     &chunk = function->chunk;
+    const auto name = function->name != nullptr ? function->name->str : "<script>";
+    for (auto const &cache : chunk.get_caches()) {
+        if (cache.get_hits() == 0 && cache.get_misses() == 0) {
+            continue;
+        }
+        const auto offset = cache.get_offset();
+        const auto op = OpCode(chunk.get_code(offset));
+        // GET_LOCAL_PROPERTY has the local slot before the constant.
+        const auto at = offset + (op == OpCode::GET_LOCAL_PROPERTY ? 2 : 1);
+        auto       constant = const_index_t(chunk.get_code(at) << UINT8_WIDTH);
+        constant |= chunk.get_code(at + 1);
+        const char *state = "monomorphic";
+        if (cache.is_megamorphic()) {
+            state = "megamorphic";
+        } else if (cache.get_count() > 1) {
+            state = "polymorphic";
+        }
+        os << fmt::format("{:<16} {:>5d} {:<14} {:<16} {:>12d} {:>8d} {}\n", name,
+                          chunk.get_line(offset), opcodeName(op),
+                          as<ObjString *>(chunk.get_value(constant))->str,
+                          cache.get_hits(), cache.get_misses(), state);
+    }
+    for (size_t i = 0; i < chunk.get_constants().get_count(); i++) {
+        const Value constant = chunk.get_value(i);
+        if (is<ObjFunction>(constant)) {
+            dumpFunctionCaches(os, as<ObjFunction *>(constant));
+        } else if (is<ObjClosure>(constant)) {
+            dumpFunctionCaches(os, as<ObjClosure *>(constant)->function);
+        }
+    }
+}
+
+/**
+ * @brief Print the hits and misses of the inline caches in function and the functions
+ * defined in it.
+ */
+void dumpInlineCaches(std::ostream &os, ObjFunction *function) {
+    os << "== inline caches ==\n";
+    dumpFunctionCaches(os, function);
+}
+
 } // namespace alox
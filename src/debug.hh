@@ -5,11 +5,20 @@
 #pragma once
 
 #include "chunk.hh"
+#include <ostream>
 #include <string_view>
 
 namespace alox {
 
 void disassembleChunk(Chunk *chunk, const std::string_view &name);
 int  disassembleInstruction(Chunk *chunk, int offset);
+void disassembleRegister(Chunk *chunk, size_t offset);
+void disassembleRegisters(Chunk *chunk, const std::string_view &name);
+
+std::string_view opcodeName(OpCode op);
+std::string_view regopName(RegOp op);
+
+class ObjFunction;
+void dumpInlineCaches(std::ostream &os, ObjFunction *function);
 
 } // namespace lox
@@ -0,0 +1,163 @@
+//
+// ALOX-CC
+//
+
+#include "event_loop.hh"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <climits>
+
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+namespace alox {
+
+EventLoop::~EventLoop() {
+#ifdef __linux__
+    if (epoll >= 0) {
+        ::close(epoll);
+    }
+#endif
+}
+
+void EventLoop::wait(ObjCoroutine *task, int fd, Event event, VmNativeFn retry,
+                     int argCount) {
+    waiters.push_back({{task, NIL_VAL, retry, argCount}, fd, event});
+    watch(fd);
+}
+
+void EventLoop::sleep(ObjCoroutine *task, double ms) {
+    const std::chrono::duration<double, std::milli> delay(
+        std::clamp(ms, 0.0, SLEEP_MAX));
+    timers.emplace(Clock::now() + std::chrono::ceil<Clock::duration>(delay), task);
+}
+
+void EventLoop::close(int fd) {
+    wake(fd, true, true);
+}
+
+EventLoop::Ready EventLoop::next() {
+    while (ready.empty()) {
+        if (waiters.empty() && timers.empty()) {
+            return {};
+        }
+        int timeout = -1;
+        if (!timers.empty()) {
+            const auto left = std::chrono::ceil<std::chrono::milliseconds>(
+                timers.begin()->first - Clock::now());
+            timeout = int(std::clamp<int64_t>(left.count(), 0, INT_MAX));
+        }
+        poll(timeout);
+        for (const auto now = Clock::now();
+             !timers.empty() && timers.begin()->first <= now;) {
+            ready.push_back({timers.begin()->second});
+            timers.erase(timers.begin());
+        }
+    }
+    const Ready task = ready.front();
+    ready.pop_front();
+    return task;
+}
+
+void EventLoop::block(int fd, Event event) {
+    pollfd watch{fd, short(event == Event::Read ? POLLIN : POLLOUT), 0};
+    while (::poll(&watch, 1, -1) < 0 && errno == EINTR) {
+    }
+}
+
+bool EventLoop::available(int fd, Event event) {
+    pollfd watch{fd, short(event == Event::Read ? POLLIN : POLLOUT), 0};
+    int    count = 0;
+    while ((count = ::poll(&watch, 1, 0)) < 0 && errno == EINTR) {
+    }
+    return count != 0;
+}
+
+// Wait up to timeout milliseconds, -1 for ever, for a descriptor to be ready. An error
+// or hang up counts as ready, for the native to find.
+void EventLoop::poll(int timeout) {
+    if (waiters.empty()) {
+        ::poll(nullptr, 0, timeout);
+        return;
+    }
+#ifdef __linux__
+    std::array<epoll_event, 64> events{};
+    const int count = epoll_wait(epoll, events.data(), int(events.size()), timeout);
+    for (int i = 0; i < count; i++) {
+        const uint32_t flags = events[i].events;
+        const bool     failed = (flags & (EPOLLERR | EPOLLHUP)) != 0;
+        wake(events[i].data.fd, failed || (flags & EPOLLIN) != 0,
+             failed || (flags & EPOLLOUT) != 0);
+    }
+#else
+    std::vector<pollfd> fds;
+    for (const Waiter &waiter : waiters) {
+        fds.push_back(
+            {waiter.fd, short(waiter.event == Event::Read ? POLLIN : POLLOUT), 0});
+    }
+    if (::poll(fds.data(), fds.size(), timeout) <= 0) {
+        return;
+    }
+    for (const pollfd &fd : fds) {
+        const bool failed = (fd.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+        if (fd.revents != 0) {
+            wake(fd.fd, failed || (fd.revents & POLLIN) != 0,
+                 failed || (fd.revents & POLLOUT) != 0);
+        }
+    }
+#endif
+}
+
+// The tasks waiting on fd for what it is ready for run next, in the order they waited.
+void EventLoop::wake(int fd, bool readable, bool writable) {
+    auto woken = [&](const Waiter &waiter) {
+        if (waiter.fd != fd || !(waiter.event == Event::Read ? readable : writable)) {
+            return false;
+        }
+        ready.push_back(waiter.ready);
+        return true;
+    };
+    std::erase_if(waiters, woken);
+    watch(fd);
+}
+
+// Register fd with epoll for what its waiters wait for, or remove it if none are left.
+void EventLoop::watch([[maybe_unused]] int fd) {
+#ifdef __linux__
+    uint32_t flags = 0;
+    for (const Waiter &waiter : waiters) {
+        if (waiter.fd == fd) {
+            flags |= waiter.event == Event::Read ? EPOLLIN : EPOLLOUT;
+        }
+    }
+    const auto registered = watched.find(fd);
+    if (flags == (registered == watched.end() ? 0 : registered->second)) {
+        return;
+    }
+    if (epoll < 0) {
+        epoll = epoll_create1(EPOLL_CLOEXEC);
+    }
+    epoll_event event{};
+    event.events = flags;
+    event.data.fd = fd;
+    if (flags == 0) {
+        epoll_ctl(epoll, EPOLL_CTL_DEL, fd, &event);
+        watched.erase(registered);
+        return;
+    }
+    const int op = registered == watched.end() ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (epoll_ctl(epoll, op, fd, &event) != 0) {
+        // Not a descriptor epoll can watch: its natives run again and report the error.
+        wake(fd, true, true);
+        return;
+    }
+    watched[fd] = flags;
+#endif
+}
+
+} // namespace alox
@@ -0,0 +1,83 @@
+//
+// ALOX-CC
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "object.hh"
+#include "value.hh"
+
+namespace alox {
+
+/**
+ * @brief The tasks of a VM, with the descriptors and timers they wait for.
+ *
+ * A task is a coroutine made by task(). The VM runs the tasks in turn, each until it
+ * yields, waits or returns. A native that would block on a descriptor makes its task
+ * wait, and is called again with the same arguments once the descriptor is ready. On
+ * Linux the descriptors are watched with epoll, elsewhere with poll().
+ */
+class EventLoop {
+  public:
+    EventLoop() = default;
+    ~EventLoop();
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    enum class Event : uint8_t { Read, Write };
+
+    // A task to run: resumed with result, or by calling retry with its arguments.
+    struct Ready {
+        ObjCoroutine *task{};
+        Value         result{NIL_VAL};
+        VmNativeFn    retry{};
+        int           argCount{};
+    };
+
+    void add(ObjCoroutine *task) { ready.push_back({task}); }
+    void wait(ObjCoroutine *task, int fd, Event event, VmNativeFn retry, int argCount);
+    void sleep(ObjCoroutine *task, double ms);
+    // The longest sleep, in milliseconds: longer ones are cut to it, to fit a Clock
+    // time point.
+    static constexpr double SLEEP_MAX = 1e12;
+    // The tasks waiting on fd are run again, to find it closed.
+    void close(int fd);
+
+    // The next task to run, waiting for one to be ready if need be. The task is nullptr
+    // once there are no tasks left.
+    Ready next();
+
+    // Wait for fd, blocking the VM: for a native called outside a task.
+    static void block(int fd, Event event);
+    // Whether a call on fd for event wouldn't block, or would fail.
+    static bool available(int fd, Event event);
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Waiter {
+        Ready ready;
+        int   fd;
+        Event event;
+    };
+
+    void poll(int timeout);
+    void wake(int fd, bool readable, bool writable);
+    void watch(int fd);
+
+    std::deque<Ready>                                ready;
+    std::vector<Waiter>                              waiters;
+    std::multimap<Clock::time_point, ObjCoroutine *> timers;
+#ifdef __linux__
+    int                     epoll{-1};
+    std::map<int, uint32_t> watched; // the events registered for each descriptor.
+#endif
+};
+
+} // namespace alox
@@ -0,0 +1,57 @@
+//
+// ALOX-CC
+//
+
+#include "globals.hh"
+#include "object.hh"
+
+#include <new>
+#include <stdexcept>
+
+#include <sys/mman.h>
+
+namespace alox {
+
+Globals::Globals() {
+    void *memory = mmap(nullptr, GLOBALS_MAX * sizeof(Value), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    values = static_cast<Value *>(memory);
+}
+
+Globals::~Globals() {
+    munmap(values, GLOBALS_MAX * sizeof(Value));
+}
+
+bool Globals::find(ObjString *name, global_index_t *n) {
+    Value slot;
+    if (!slots.get(name, &slot)) {
+        return false;
+    }
+    *n = global_index_t(as<double>(slot));
+    return true;
+}
+
+global_index_t Globals::slot(ObjString *name) {
+    global_index_t found = 0;
+    if (find(name, &found)) {
+        return found;
+    }
+    // The compiler reports this as an error before asking for a slot.
+    if (count == GLOBALS_MAX) {
+        throw std::length_error("Too many global variables.");
+    }
+    const auto n = global_index_t(count++);
+    slots.set(name, value<double>(double(n)));
+    names.push_back(name);
+    values[n] = UNDEFINED_VAL;
+    return n;
+}
+
+void Globals::define(ObjString *name, Value value) {
+    values[slot(name)] = value;
+}
+
+} // namespace alox
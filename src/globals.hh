@@ -0,0 +1,51 @@
+//
+// ALOX-CC
+//
+
+#pragma once
+
+#include <vector>
+
+#include "common.hh"
+#include "table.hh"
+#include "value.hh"
+
+namespace alox {
+
+using global_index_t = uint16_t;
+
+constexpr auto GLOBALS_MAX = UINT16_MAX + 1;
+
+/**
+ * @brief The global variables of a VM. The compiler gives each name a slot and the
+ * instructions use the slot number. Slots stay in the VM between compiles, so the
+ * REPL sees the globals of earlier inputs. The values never move, the JIT code keeps
+ * their addresses: the address space for all of them is reserved at once, and the
+ * system only gives memory to the pages of the slots used.
+ */
+class Globals {
+  public:
+    Globals();
+    ~Globals();
+    Globals(const Globals &) = delete;
+    Globals &operator=(const Globals &) = delete;
+
+    // Slot of name, added as undefined if it is new. Throws std::length_error once all
+    // the slots are used.
+    global_index_t slot(ObjString *name);
+    // Whether name has a slot, set in n.
+    bool           find(ObjString *name, global_index_t *n);
+    void           define(ObjString *name, Value value);
+
+    [[nodiscard]] size_t     get_count() const { return count; }
+    [[nodiscard]] ObjString *get_name(global_index_t n) const { return names[n]; }
+    [[nodiscard]] Value     &get_value(global_index_t n) { return values[n]; }
+
+  private:
+    Table                    slots; // name -> slot number
+    std::vector<ObjString *> names;
+    Value                   *values;
+    size_t                   count{0};
+};
+
+} // namespace alox
@@ -0,0 +1,97 @@
+//
+// ALOX-CC
+//
+
+#include <utility>
+
+#include "heap.hh"
+#include "vm.hh"
+
+namespace alox {
+
+Heap::~Heap() {
+    if (!blocks.empty()) {
+        blocks.back().used = size_t(next - blocks.back().memory.get());
+    }
+    for (const Block &block : blocks) {
+        for (size_t at = 0; at < block.used;) {
+            at += free(reinterpret_cast<Obj *>(block.memory.get() + at));
+        }
+    }
+}
+
+Heap::Scope::Scope(Heap &heap) : previous(active) {
+    active = &heap;
+}
+
+Heap::Scope::~Scope() {
+    active = previous;
+}
+
+// The heap of the thread, for objects made outside a Scope.
+Heap &Heap::local() {
+    thread_local Heap heap;
+    return heap;
+}
+
+void Heap::grow() {
+    if (!blocks.empty()) {
+        blocks.back().used = size_t(next - blocks.back().memory.get());
+    }
+    blocks.push_back({std::make_unique_for_overwrite<std::byte[]>(BLOCK_SIZE), 0});
+    next = blocks.back().memory.get();
+    end = next + BLOCK_SIZE;
+}
+
+namespace {
+
+template <typename T> void destroy(Obj *object) {
+    static_cast<T *>(object)->~T();
+}
+
+} // namespace
+
+// Destroy the object with what it owns, and return the space it took.
+size_t Heap::free(Obj *object) {
+    switch (object->get_type()) {
+    case OBJ_BOUND_METHOD:
+        destroy<ObjBoundMethod>(object);
+        return size<ObjBoundMethod>();
+    case OBJ_CLASS:
+        delete static_cast<ObjClass *>(object)->shape;
+        destroy<ObjClass>(object);
+        return size<ObjClass>();
+    case OBJ_CLOSURE:
+        delete[] static_cast<ObjClosure *>(object)->upvalues;
+        destroy<ObjClosure>(object);
+        return size<ObjClosure>();
+    case OBJ_FUNCTION:
+        static_cast<ObjFunction *>(object)->chunk.free();
+        destroy<ObjFunction>(object);
+        return size<ObjFunction>();
+    case OBJ_INSTANCE:
+        if (static_cast<ObjInstance *>(object)->shape->is_dictionary()) {
+            delete static_cast<ObjInstance *>(object)->shape;
+        }
+        delete[] static_cast<ObjInstance *>(object)->fields;
+        destroy<ObjInstance>(object);
+        return size<ObjInstance>();
+    case OBJ_NATIVE:
+        destroy<ObjNative>(object);
+        return size<ObjNative>();
+    case OBJ_STRING:
+        destroy<ObjString>(object);
+        return size<ObjString>();
+    case OBJ_UPVALUE:
+        destroy<ObjUpvalue>(object);
+        return size<ObjUpvalue>();
+    case OBJ_COROUTINE:
+        delete static_cast<ObjCoroutine *>(object)->stacks;
+        destroy<ObjCoroutine>(object);
+        return size<ObjCoroutine>();
+    default:
+        std::unreachable();
+    }
+}
+
+} // namespace alox
@@ -0,0 +1,90 @@
+//
+// ALOX-CC
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "object.hh"
+#include "table.hh"
+
+namespace alox {
+
+/**
+ * @brief The objects of a VM, with its interned strings and the numbering of its method
+ * names. Objects are made one after the other in blocks, and are all freed with the
+ * heap, never before: there is no collector, so a heap only grows.
+ *
+ * newString() and the other functions that make objects allocate in the heap of the
+ * innermost Scope on the calling thread, or outside one in a heap of the thread's own.
+ * A VM makes its heap current while it compiles and runs, so VMs share nothing and each
+ * can run on a thread of its own. Objects must not be passed from one heap to another:
+ * they are copied instead, as spawn() does.
+ */
+class Heap {
+  public:
+    Heap() = default;
+    ~Heap();
+    Heap(const Heap &) = delete;
+    Heap &operator=(const Heap &) = delete;
+
+    // Makes heap current on this thread until the scope ends.
+    class Scope {
+      public:
+        explicit Scope(Heap &heap);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+      private:
+        Heap *previous;
+    };
+
+    static Heap &current() { return active != nullptr ? *active : local(); }
+
+    template <typename T> T *make() {
+        static_assert(alignof(T) <= ALIGNMENT);
+        if (size<T>() > size_t(end - next)) [[unlikely]] {
+            grow();
+        }
+        T *object = new (next) T();
+        next += size<T>();
+        return object;
+    }
+
+    // All strings are interned, so strings with the same contents are the same object.
+    Table   &get_strings() { return strings; }
+    uint32_t next_selector() { return selectors++; }
+
+  private:
+    static constexpr size_t ALIGNMENT = alignof(void *);
+    static constexpr size_t BLOCK_SIZE = size_t(64) * 1024;
+
+    template <typename T> static constexpr size_t size() {
+        return (sizeof(T) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+
+    static Heap  &local();
+    static size_t free(Obj *object);
+    void          grow();
+
+    static inline thread_local Heap *active = nullptr;
+
+    struct Block {
+        std::unique_ptr<std::byte[]> memory;
+        size_t                       used; // set when the next block is started.
+    };
+    std::vector<Block> blocks;
+    std::byte         *next{nullptr}; // free space in the last block.
+    std::byte         *end{nullptr};
+
+    Table    strings;
+    uint32_t selectors{0};
+};
+
+} // namespace alox
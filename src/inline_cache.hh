@@ -0,0 +1,86 @@
+//
+// ALOX-CC
+//
+
+#pragma once
+
+#include <array>
+
+#include "common.hh"
+
+namespace alox {
+
+class ObjClosure;
+class Shape;
+
+using cache_index_t = uint16_t;
+
+constexpr auto CACHE_ENTRIES = 4;
+
+/**
+ * @brief What a property instruction found for one receiver shape. A shape belongs
+ * to a single class, so it identifies the class as well as the field layout.
+ */
+struct CacheEntry {
+    Shape      *shape{};   // shape of the receiver.
+    Shape      *next{};    // SET_PROPERTY: shape after the store, adds slot if different.
+    int         slot{-1};  // field slot, or -1 for a method.
+    uint32_t    version{}; // version of the class methods when method was found.
+    ObjClosure *method{};
+};
+
+/**
+ * @brief Inline cache for one GET_PROPERTY, SET_PROPERTY or INVOKE instruction.
+ *
+ * Monomorphic sites hit the first entry. Up to CACHE_ENTRIES shapes are kept, after
+ * that the site is megamorphic and new shapes are looked up each time.
+ */
+class InlineCache {
+  public:
+    explicit InlineCache(size_t offset) : offset(offset){};
+
+    CacheEntry *find(Shape *shape, uint32_t version) {
+        for (size_t i = 0; i < count; i++) {
+            CacheEntry &entry = entries[i];
+            if (entry.shape == shape &&
+                (entry.method == nullptr || entry.version == version)) {
+                hits++;
+                return &entry;
+            }
+        }
+        misses++;
+        return nullptr;
+    }
+
+    void add(const CacheEntry &entry) {
+        for (size_t i = 0; i < count; i++) {
+            if (entries[i].shape == entry.shape) {
+                entries[i] = entry; // method is out of date.
+                return;
+            }
+        }
+        if (count == entries.size()) {
+            megamorphic = true;
+            return;
+        }
+        entries[count++] = entry;
+    }
+
+    [[nodiscard]] size_t get_offset() const { return offset; }
+    void                 set_offset(size_t o) { offset = o; }
+    [[nodiscard]] size_t get_hits() const { return hits; }
+    [[nodiscard]] size_t get_misses() const { return misses; }
+    [[nodiscard]] size_t get_count() const { return count; }
+    [[nodiscard]] bool   is_megamorphic() const { return megamorphic; }
+
+  private:
+    std::array<CacheEntry, CACHE_ENTRIES> entries{};
+    size_t                                count{0};
+    bool                                  megamorphic{false};
+
+    size_t offset; // of the instruction in the chunk.
+    size_t hits{0};
+    size_t misses{0};
+};
+
+} // namespace alox
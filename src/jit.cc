@@ -0,0 +1,728 @@
+//
+// ALOX-CC
+//
+
+#include "jit.hh"
+
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "object.hh"
+
+namespace alox {
+
+namespace {
+
+/**
+ * @brief A gap in a stencil, filled in when the stencil is copied.
+ */
+enum class Hole : uint8_t {
+    Value,   // imm64: the value pushed.
+    Global,  // imm64: address of the global's value.
+    Ip,      // imm64: address of the instruction's operands, passed to the handler.
+    Handler, // imm64: address of the handler.
+    Slot,    // disp32: byte offset of the local in the frame.
+    Slot2,   // disp32: byte offset of the second local.
+    Frame,   // disp32: offset from the stack top to the callee's slots.
+    Exit,    // rel32: the exit back to the interpreter.
+    Target,  // rel32: the code of the jump target.
+};
+
+struct Stencil {
+    std::vector<uint8_t>                 code;
+    std::vector<std::pair<size_t, Hole>> holes;
+};
+
+// Writes the stencils, once.
+class StencilBuilder {
+  public:
+    StencilBuilder &bytes(std::initializer_list<uint8_t> b) {
+        stencil.code.insert(stencil.code.end(), b);
+        return *this;
+    }
+    StencilBuilder &imm64(uint64_t v) {
+        for (int i = 0; i < 8; i++) {
+            stencil.code.push_back(uint8_t(v >> (8 * i)));
+        }
+        return *this;
+    }
+    StencilBuilder &imm32(uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            stencil.code.push_back(uint8_t(v >> (8 * i)));
+        }
+        return *this;
+    }
+    StencilBuilder &hole(Hole h, int size) {
+        stencil.holes.emplace_back(stencil.code.size(), h);
+        stencil.code.insert(stencil.code.end(), size, 0);
+        return *this;
+    }
+    StencilBuilder &append(const Stencil &other) {
+        for (auto [at, h] : other.holes) {
+            stencil.holes.emplace_back(stencil.code.size() + at, h);
+        }
+        stencil.code.insert(stencil.code.end(), other.code.begin(), other.code.end());
+        return *this;
+    }
+
+    // A rel32 to a later point in the stencil, set with bind().
+    size_t forward() {
+        const size_t at = stencil.code.size();
+        stencil.code.insert(stencil.code.end(), 4, 0);
+        return at;
+    }
+    StencilBuilder &bind(size_t at) {
+        const auto rel = int32_t(stencil.code.size() - (at + 4));
+        std::memcpy(stencil.code.data() + at, &rel, sizeof(rel));
+        return *this;
+    }
+
+    Stencil build() { return std::move(stencil); }
+
+  private:
+    Stencil stencil;
+};
+
+// Registers while in JIT code: rbx the VM, r12 the stack top, r13 the frame slots.
+
+// mov rax, [r12 - 8]
+constexpr std::initializer_list<uint8_t> LOAD_TOP = {0x49, 0x8b, 0x44, 0x24, 0xf8};
+// mov [r12], rax; add r12, 8
+constexpr std::initializer_list<uint8_t> PUSH_RAX = {0x49, 0x89, 0x04, 0x24,
+                                                     0x49, 0x83, 0xc4, 0x08};
+// sub r12, 8
+constexpr std::initializer_list<uint8_t> POP = {0x49, 0x83, 0xec, 0x08};
+// cmp rax, rcx
+constexpr std::initializer_list<uint8_t> CMP_RAX_RCX = {0x48, 0x39, 0xc8};
+// je rel32
+constexpr std::initializer_list<uint8_t> JE = {0x0f, 0x84};
+// jne rel32
+constexpr std::initializer_list<uint8_t> JNE = {0x0f, 0x85};
+
+Stencil makePrologue() {
+    return StencilBuilder()
+        .bytes({0x53, 0x41, 0x54, 0x41, 0x55}) // push rbx; push r12; push r13
+        .bytes({0x48, 0x89, 0xfb})             // mov rbx, rdi
+        .bytes({0x49, 0x89, 0xf4})             // mov r12, rsi
+        .bytes({0x49, 0x89, 0xd5})             // mov r13, rdx
+        .bytes({0xff, 0xe1})                   // jmp rcx
+        .build();
+}
+
+Stencil makeExit() {
+    return StencilBuilder()
+        .bytes({0x41, 0x5d, 0x41, 0x5c, 0x5b}) // pop r13; pop r12; pop rbx
+        .bytes({0xc3})                         // ret
+        .build();
+}
+
+// Call the handler with the VM, the stack top and ip, leaving if it returns nullptr.
+StencilBuilder &callHandler(StencilBuilder &b) {
+    return b.bytes({0x48, 0x89, 0xdf})         // mov rdi, rbx
+        .bytes({0x4c, 0x89, 0xe6})             // mov rsi, r12
+        .bytes({0x48, 0xba}).hole(Hole::Ip, 8) // mov rdx, ip
+        .bytes({0x48, 0xb8})
+        .hole(Hole::Handler, 8)                // mov rax, handler
+        .bytes({0xff, 0xd0})                   // call rax
+        .bytes({0x48, 0x85, 0xc0})             // test rax, rax
+        .bytes(JE)
+        .hole(Hole::Exit, 4);                  // je exit
+}
+
+Stencil makeCall() {
+    StencilBuilder b;
+    return callHandler(b).bytes({0x49, 0x89, 0xc4}).build(); // mov r12, rax
+}
+
+// Jump to the callee's code with its slots, if the call gave some.
+Stencil makeCallJump() {
+    StencilBuilder b;
+    return callHandler(b)
+        .bytes({0x49, 0x89, 0xc4})             // mov r12, rax
+        .bytes({0x48, 0x85, 0xd2})             // test rdx, rdx
+        .bytes({0x74, 0x0a})                   // je over the next two
+        .bytes({0x4d, 0x8d, 0xac, 0x24})
+        .hole(Hole::Frame, 4)                  // lea r13, [r12 + frame]
+        .bytes({0xff, 0xe2})                   // jmp rdx
+        .build();
+}
+
+// Jump back to the caller's code. The result is in the callee's slot 0.
+Stencil makeReturn() {
+    StencilBuilder b;
+    return callHandler(b)
+        .bytes({0x4d, 0x8d, 0x65, 0x08}) // lea r12, [r13 + 8]
+        .bytes({0x49, 0x89, 0xc5})       // mov r13, rax
+        .bytes({0xff, 0xe2})             // jmp rdx
+        .build();
+}
+
+Stencil makePush() {
+    return StencilBuilder()
+        .bytes({0x48, 0xb8})
+        .hole(Hole::Value, 8) // mov rax, value
+        .bytes(PUSH_RAX)
+        .build();
+}
+
+Stencil makePop() {
+    return StencilBuilder().bytes(POP).build();
+}
+
+Stencil makeGetLocal(Hole slot = Hole::Slot) {
+    return StencilBuilder()
+        .bytes({0x49, 0x8b, 0x85}) // mov rax, [r13 + slot]
+        .hole(slot, 4)
+        .bytes(PUSH_RAX)
+        .build();
+}
+
+Stencil makeSetLocal() {
+    return StencilBuilder()
+        .bytes(LOAD_TOP)
+        .bytes({0x49, 0x89, 0x85}) // mov [r13 + slot], rax
+        .hole(Hole::Slot, 4)
+        .build();
+}
+
+Stencil makeJump() {
+    return StencilBuilder().bytes({0xe9}).hole(Hole::Target, 4).build();
+}
+
+// Jump if the top of the stack is nil or false, and pop it if not when pop is set.
+Stencil makeJumpIfFalse(bool pop) {
+    StencilBuilder b;
+    b.bytes(LOAD_TOP)
+        .bytes({0x48, 0xb9})
+        .imm64(NIL_VAL)
+        .bytes(CMP_RAX_RCX)
+        .bytes(JE)
+        .hole(Hole::Target, 4)
+        .bytes({0x48, 0xb9})
+        .imm64(FALSE_VAL)
+        .bytes(CMP_RAX_RCX)
+        .bytes(JE)
+        .hole(Hole::Target, 4);
+    if (pop) {
+        b.bytes(POP);
+    }
+    return b.build();
+}
+
+// A number fast path computing into rax, with the handler as the slow path.
+Stencil withSlowPath(const Stencil &compute) {
+    StencilBuilder b;
+    b.bytes({0x49, 0x8b, 0x44, 0x24, 0xf0}) // mov rax, [r12 - 16]
+        .bytes({0x49, 0x8b, 0x4c, 0x24, 0xf8}) // mov rcx, [r12 - 8]
+        .bytes({0x48, 0xba})
+        .imm64(QNAN)                           // mov rdx, QNAN
+        .bytes({0x48, 0x89, 0xc6})             // mov rsi, rax
+        .bytes({0x48, 0x21, 0xd6})             // and rsi, rdx
+        .bytes({0x48, 0x39, 0xd6})             // cmp rsi, rdx
+        .bytes(JE);
+    const size_t left = b.forward();
+    b.bytes({0x48, 0x89, 0xce}) // mov rsi, rcx
+        .bytes({0x48, 0x21, 0xd6})
+        .bytes({0x48, 0x39, 0xd6})
+        .bytes(JE);
+    const size_t right = b.forward();
+    b.bytes({0x66, 0x48, 0x0f, 0x6e, 0xc0}) // movq xmm0, rax
+        .bytes({0x66, 0x48, 0x0f, 0x6e, 0xc9}) // movq xmm1, rcx
+        .append(compute)
+        .bytes({0x49, 0x89, 0x44, 0x24, 0xf0}) // mov [r12 - 16], rax
+        .bytes(POP)
+        .bytes({0xe9}); // jmp done
+    const size_t done = b.forward();
+    b.bind(left).bind(right).append(makeCall()).bind(done);
+    return b.build();
+}
+
+Stencil arithmetic(uint8_t sse) {
+    return withSlowPath(StencilBuilder()
+                            .bytes({0xf2, 0x0f, sse, 0xc1})         // op xmm0, xmm1
+                            .bytes({0x66, 0x48, 0x0f, 0x7e, 0xc0}) // movq rax, xmm0
+                            .build());
+}
+
+// Compare with comisd, swapping the operands for < and <=, so that NaN is false.
+Stencil compare(bool swap, uint8_t setcc) {
+    const uint8_t operands = swap ? 0xc8 : 0xc1;
+    return withSlowPath(StencilBuilder()
+                            .bytes({0x31, 0xd2})                 // xor edx, edx
+                            .bytes({0x66, 0x0f, 0x2f, operands}) // comisd
+                            .bytes({0x0f, setcc, 0xc2})          // seta/setae dl
+                            .bytes({0x48, 0xb8})
+                            .imm64(FALSE_VAL)                    // mov rax, false
+                            .bytes({0x48, 0x01, 0xd0})           // add rax, rdx
+                            .build());
+}
+
+// The global's value in rcx, with the handler reporting an undefined variable.
+Stencil withUndefinedCheck(const Stencil &access) {
+    StencilBuilder b;
+    b.bytes({0x48, 0xb9})
+        .hole(Hole::Global, 8) // mov rcx, global
+        .bytes({0x48, 0xba})
+        .imm64(UNDEFINED_VAL)      // mov rdx, undefined
+        .bytes({0x48, 0x39, 0x11}) // cmp [rcx], rdx
+        .bytes(JE);
+    const size_t undefined = b.forward();
+    b.append(access).bytes({0xe9}); // jmp done
+    const size_t done = b.forward();
+    b.bind(undefined).append(makeCall()).bind(done);
+    return b.build();
+}
+
+Stencil makeGetGlobal() {
+    return withUndefinedCheck(StencilBuilder()
+                                  .bytes({0x48, 0x8b, 0x01}) // mov rax, [rcx]
+                                  .bytes(PUSH_RAX)
+                                  .build());
+}
+
+Stencil makeSetGlobal() {
+    return withUndefinedCheck(StencilBuilder()
+                                  .bytes(LOAD_TOP)
+                                  .bytes({0x48, 0x89, 0x01}) // mov [rcx], rax
+                                  .build());
+}
+
+Stencil makeDefineGlobal() {
+    return StencilBuilder()
+        .bytes({0x48, 0xb9})
+        .hole(Hole::Global, 8) // mov rcx, global
+        .bytes(POP)
+        .bytes({0x49, 0x8b, 0x04, 0x24}) // mov rax, [r12]
+        .bytes({0x48, 0x89, 0x01})       // mov [rcx], rax
+        .build();
+}
+
+// Numbers compare with ucomisd, so that NaN is not equal to itself, anything else by
+// its bits as strings are interned. Two strings with the same hash from different heaps
+// are compared by the handler.
+Stencil makeEqual(bool equal) {
+    static const auto hash = [] {
+        const ObjString string;
+        return uint32_t(reinterpret_cast<const std::byte *>(&string.hash) -
+                        reinterpret_cast<const std::byte *>(&string));
+    }();
+    StencilBuilder b;
+    b.bytes({0x49, 0x8b, 0x44, 0x24, 0xf0}) // mov rax, [r12 - 16]
+        .bytes({0x49, 0x8b, 0x4c, 0x24, 0xf8}) // mov rcx, [r12 - 8]
+        .bytes({0x48, 0xba})
+        .imm64(QNAN)                           // mov rdx, QNAN
+        .bytes({0x48, 0x89, 0xc6})             // mov rsi, rax
+        .bytes({0x48, 0x21, 0xd6})             // and rsi, rdx
+        .bytes({0x48, 0x39, 0xd6})             // cmp rsi, rdx
+        .bytes(JE);
+    const size_t left = b.forward();
+    b.bytes({0x48, 0x89, 0xce}) // mov rsi, rcx
+        .bytes({0x48, 0x21, 0xd6})
+        .bytes({0x48, 0x39, 0xd6})
+        .bytes(JE);
+    const size_t right = b.forward();
+    b.bytes({0x66, 0x48, 0x0f, 0x6e, 0xc0}) // movq xmm0, rax
+        .bytes({0x66, 0x48, 0x0f, 0x6e, 0xc9}) // movq xmm1, rcx
+        .bytes({0x66, 0x0f, 0x2e, 0xc1})       // ucomisd xmm0, xmm1
+        .bytes({0x0f, 0x94, 0xc2})             // sete dl
+        .bytes({0x40, 0x0f, 0x9b, 0xc6})       // setnp sil
+        .bytes({0x40, 0x20, 0xf2})             // and dl, sil
+        .bytes({0xe9});                        // jmp result
+    const size_t result = b.forward();
+    b.bind(left).bind(right).bytes(CMP_RAX_RCX).bytes({0x0f, 0x94, 0xc2}); // sete dl
+    b.bytes(JE);
+    const size_t same = b.forward();
+    // Both objects, then both strings, with the same hash.
+    b.bytes({0x48, 0x89, 0xc6})                // mov rsi, rax
+        .bytes({0x48, 0x21, 0xce})             // and rsi, rcx
+        .bytes({0x48, 0xbf})
+        .imm64(SIGN_BIT | QNAN)                // mov rdi, SIGN_BIT | QNAN
+        .bytes({0x48, 0x21, 0xfe})             // and rsi, rdi
+        .bytes({0x48, 0x39, 0xfe})             // cmp rsi, rdi
+        .bytes(JNE);
+    const size_t objects = b.forward();
+    b.bytes({0x48, 0xf7, 0xd7})                // not rdi
+        .bytes({0x48, 0x89, 0xc6})             // mov rsi, rax
+        .bytes({0x48, 0x21, 0xfe})             // and rsi, rdi
+        .bytes({0x48, 0x21, 0xcf})             // and rdi, rcx
+        .bytes({0x80, 0x3e, OBJ_STRING})       // cmp byte [rsi], OBJ_STRING (the type)
+        .bytes(JNE);
+    const size_t leftString = b.forward();
+    b.bytes({0x80, 0x3f, OBJ_STRING}) // cmp byte [rdi], OBJ_STRING
+        .bytes(JNE);
+    const size_t rightString = b.forward();
+    b.bytes({0x8b, 0x86}).imm32(hash) // mov eax, [rsi + hash]
+        .bytes({0x3b, 0x87})
+        .imm32(hash) // cmp eax, [rdi + hash]
+        .bytes(JNE);
+    const size_t hashes = b.forward();
+    b.append(makeCall()).bytes({0xe9}); // jmp done
+    const size_t done = b.forward();
+    b.bind(result).bind(same).bind(objects).bind(leftString).bind(rightString).bind(hashes);
+    b.bytes({0x0f, 0xb6, 0xd2}); // movzx edx, dl
+    if (!equal) {
+        b.bytes({0x83, 0xf2, 0x01}); // xor edx, 1
+    }
+    return b.bytes({0x48, 0xb8})
+        .imm64(FALSE_VAL)                      // mov rax, false
+        .bytes({0x48, 0x01, 0xd0})             // add rax, rdx
+        .bytes({0x49, 0x89, 0x44, 0x24, 0xf0}) // mov [r12 - 16], rax
+        .bytes(POP)
+        .bind(done)
+        .build();
+}
+
+constexpr uint8_t ADDSD = 0x58;
+constexpr uint8_t MULSD = 0x59;
+constexpr uint8_t SUBSD = 0x5c;
+constexpr uint8_t DIVSD = 0x5e;
+constexpr uint8_t SETA = 0x97;
+constexpr uint8_t SETAE = 0x93;
+
+struct Stencils {
+    Stencil prologue = makePrologue();
+    Stencil exit = makeExit();
+    Stencil call = makeCall();
+    Stencil callJump = makeCallJump();
+    Stencil ret = makeReturn();
+    Stencil push = makePush();
+    Stencil pop = makePop();
+    Stencil getLocal = makeGetLocal();
+    Stencil getLocalLocal =
+        StencilBuilder().append(makeGetLocal()).append(makeGetLocal(Hole::Slot2)).build();
+    Stencil getLocalConstant =
+        StencilBuilder().append(makeGetLocal()).append(makePush()).build();
+    Stencil setLocal = makeSetLocal();
+    Stencil getGlobal = makeGetGlobal();
+    Stencil setGlobal = makeSetGlobal();
+    Stencil defineGlobal = makeDefineGlobal();
+    Stencil jump = makeJump();
+    Stencil jumpIfFalse = makeJumpIfFalse(false);
+    Stencil jumpIfFalsePop = makeJumpIfFalse(true);
+    Stencil add = arithmetic(ADDSD);
+    Stencil subtract = arithmetic(SUBSD);
+    Stencil multiply = arithmetic(MULSD);
+    Stencil divide = arithmetic(DIVSD);
+    Stencil greater = compare(false, SETA);
+    Stencil notGreater = compare(true, SETAE);
+    Stencil less = compare(true, SETA);
+    Stencil notLess = compare(false, SETAE);
+    Stencil equal = makeEqual(true);
+    Stencil notEqual = makeEqual(false);
+};
+
+const Stencils &stencils() {
+    static const Stencils all;
+    return all;
+}
+
+// The values for the holes of one copy of a stencil.
+struct Patch {
+    uint64_t       value{};
+    Value         *global{};
+    uint8_t       *ip{};
+    JitHandler     handler{};
+    JitJumpHandler jump{}; // instead of handler for calls and returns.
+    int32_t        slot{};
+    int32_t        slot2{};
+    int32_t        frame{};
+    size_t         target{}; // bytecode offset
+};
+
+class Patcher {
+  public:
+    explicit Patcher(size_t count) : entries(count + 1, -1){};
+
+    void copy(const Stencil &stencil, const Patch &patch = {}) {
+        const size_t base = code.size();
+        code.insert(code.end(), stencil.code.begin(), stencil.code.end());
+        for (auto [at, hole] : stencil.holes) {
+            uint8_t *p = code.data() + base + at;
+            switch (hole) {
+            case Hole::Value:
+                std::memcpy(p, &patch.value, sizeof(uint64_t));
+                break;
+            case Hole::Global:
+                std::memcpy(p, &patch.global, sizeof(Value *));
+                break;
+            case Hole::Ip:
+                std::memcpy(p, &patch.ip, sizeof(uint8_t *));
+                break;
+            case Hole::Handler:
+                if (patch.jump != nullptr) {
+                    std::memcpy(p, &patch.jump, sizeof(JitJumpHandler));
+                } else {
+                    std::memcpy(p, &patch.handler, sizeof(JitHandler));
+                }
+                break;
+            case Hole::Slot:
+                std::memcpy(p, &patch.slot, sizeof(int32_t));
+                break;
+            case Hole::Slot2:
+                std::memcpy(p, &patch.slot2, sizeof(int32_t));
+                break;
+            case Hole::Frame:
+                std::memcpy(p, &patch.frame, sizeof(int32_t));
+                break;
+            case Hole::Exit:
+                rel32(base + at, exit);
+                break;
+            case Hole::Target:
+                targets.emplace_back(base + at, patch.target);
+                break;
+            }
+        }
+    }
+
+    void mark_exit() { exit = code.size(); }
+    void mark_entry(size_t offset) { entries[offset] = int32_t(code.size()); }
+
+    // Set the jumps once every instruction has its code.
+    bool link() {
+        for (auto [at, offset] : targets) {
+            if (entries[offset] < 0) {
+                return false;
+            }
+            rel32(at, size_t(entries[offset]));
+        }
+        return true;
+    }
+
+    std::vector<uint8_t> code;
+    std::vector<int32_t> entries;
+
+  private:
+    void rel32(size_t at, size_t to) {
+        const auto rel = int32_t(int64_t(to) - int64_t(at + 4));
+        std::memcpy(code.data() + at, &rel, sizeof(rel));
+    }
+
+    size_t                                 exit{0};
+    std::vector<std::pair<size_t, size_t>> targets;
+};
+
+#if defined(__x86_64__) && defined(__linux__)
+uint8_t *allocate(const std::vector<uint8_t> &code) {
+    void *memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, code.size());
+        return nullptr;
+    }
+    return static_cast<uint8_t *>(memory);
+}
+
+void release(uint8_t *code, size_t size) {
+    munmap(code, size);
+}
+#else
+uint8_t *allocate(const std::vector<uint8_t> & /*code*/) {
+    return nullptr;
+}
+
+void release(uint8_t * /*code*/, size_t /*size*/) {}
+#endif
+
+} // namespace
+
+JitCode::~JitCode() {
+    release(code, size);
+}
+
+/**
+ * @brief Compile the function's chunk, or return nullptr if the JIT is not available or
+ * the function is left to the interpreter.
+ */
+JitCode *Jit::compile(ObjFunction *function) {
+    if constexpr (!JIT_AVAILABLE) {
+        return nullptr;
+    }
+    Chunk          &chunk = function->chunk;
+    const Stencils &s = stencils();
+    const size_t    count = chunk.get_count();
+    Patcher         out(count);
+    bool            loops = false;
+
+    out.copy(s.prologue);
+    out.mark_exit();
+    out.copy(s.exit);
+
+    auto handler = [this](OpCode op) { return handlers.ops[size_t(op)]; };
+    for (size_t offset = 0; offset < count; offset += chunk.instruction_length(offset)) {
+        uint8_t   *ip = chunk.get_code() + offset;
+        auto       word = [ip](size_t n) {
+            return uint16_t((ip[n] << UINT8_WIDTH) | ip[n + 1]);
+        };
+        const auto op = OpCode(*ip);
+        out.mark_entry(offset);
+
+        // Most stencils with a handler call it with the operands after the opcode.
+        Patch patch{.ip = ip + 1, .handler = handler(op)};
+        switch (op) {
+        case OpCode::CONSTANT:
+            out.copy(s.push, {.value = chunk.get_value(word(1))});
+            break;
+        case OpCode::NIL:
+            out.copy(s.push, {.value = NIL_VAL});
+            break;
+        case OpCode::TRUE:
+            out.copy(s.push, {.value = TRUE_VAL});
+            break;
+        case OpCode::FALSE:
+            out.copy(s.push, {.value = FALSE_VAL});
+            break;
+        case OpCode::ZERO:
+            out.copy(s.push, {.value = value<double>(0)});
+            break;
+        case OpCode::ONE:
+            out.copy(s.push, {.value = value<double>(1)});
+            break;
+        case OpCode::POP:
+            out.copy(s.pop);
+            break;
+        case OpCode::GET_GLOBAL:
+            patch.global = &globals.get_value(word(1));
+            out.copy(s.getGlobal, patch);
+            break;
+        case OpCode::SET_GLOBAL:
+            patch.global = &globals.get_value(word(1));
+            out.copy(s.setGlobal, patch);
+            break;
+        case OpCode::DEFINE_GLOBAL:
+            out.copy(s.defineGlobal, {.global = &globals.get_value(word(1))});
+            break;
+        case OpCode::GET_LOCAL:
+            out.copy(s.getLocal, {.slot = ip[1] * int32_t(sizeof(Value))});
+            break;
+        case OpCode::SET_LOCAL:
+            out.copy(s.setLocal, {.slot = ip[1] * int32_t(sizeof(Value))});
+            break;
+        case OpCode::GET_LOCAL_LOCAL:
+            out.copy(s.getLocalLocal, {.slot = ip[1] * int32_t(sizeof(Value)),
+                                       .slot2 = ip[2] * int32_t(sizeof(Value))});
+            break;
+        case OpCode::GET_LOCAL_CONSTANT:
+            out.copy(s.getLocalConstant, {.value = chunk.get_value(word(2)),
+                                          .slot = ip[1] * int32_t(sizeof(Value))});
+            break;
+        case OpCode::LOOP:
+            loops = true;
+            [[fallthrough]];
+        case OpCode::JUMP:
+            out.copy(s.jump, {.target = chunk.jump_target(offset)});
+            break;
+        case OpCode::JUMP_IF_FALSE:
+            out.copy(s.jumpIfFalse, {.target = chunk.jump_target(offset)});
+            break;
+        case OpCode::JUMP_IF_FALSE_POP:
+            out.copy(s.jumpIfFalsePop, {.target = chunk.jump_target(offset)});
+            break;
+        case OpCode::ADD:
+        case OpCode::ADD_NUMBER:
+        case OpCode::ADD_STRING:
+        case OpCode::ADD_GENERIC:
+            patch.handler = handler(OpCode::ADD);
+            out.copy(s.add, patch);
+            break;
+        case OpCode::SUBTRACT:
+            out.copy(s.subtract, patch);
+            break;
+        case OpCode::MULTIPLY:
+            out.copy(s.multiply, patch);
+            break;
+        case OpCode::DIVIDE:
+            out.copy(s.divide, patch);
+            break;
+        case OpCode::GREATER:
+            out.copy(s.greater, patch);
+            break;
+        case OpCode::NOT_GREATER:
+            out.copy(s.notGreater, patch);
+            break;
+        case OpCode::LESS:
+            out.copy(s.less, patch);
+            break;
+        case OpCode::NOT_LESS:
+            out.copy(s.notLess, patch);
+            break;
+        case OpCode::LESS_JUMP_IF_FALSE:
+            // The comparison pushes a boolean, false stays for the POP at the target.
+            patch.handler = handler(OpCode::LESS);
+            out.copy(s.less, patch);
+            out.copy(s.jumpIfFalsePop, {.target = chunk.jump_target(offset)});
+            break;
+        case OpCode::EQUAL:
+        case OpCode::EQUAL_NUMBER:
+        case OpCode::EQUAL_GENERIC:
+            patch.handler = handler(OpCode::EQUAL);
+            out.copy(s.equal, patch);
+            break;
+        case OpCode::NOT_EQUAL:
+        case OpCode::NOT_EQUAL_NUMBER:
+        case OpCode::NOT_EQUAL_GENERIC:
+            patch.handler = handler(OpCode::NOT_EQUAL);
+            out.copy(s.notEqual, patch);
+            break;
+        case OpCode::EQUAL_JUMP_IF_FALSE:
+            patch.handler = handler(OpCode::EQUAL);
+            out.copy(s.equal, patch);
+            out.copy(s.jumpIfFalsePop, {.target = chunk.jump_target(offset)});
+            break;
+        case OpCode::CLOCK:
+        case OpCode::GETC:
+        case OpCode::CHR:
+        case OpCode::ORD: {
+            // The native can be defined again, then it is called in a frame.
+            const int arity = intrinsics[intrinsicIndex(op)].arity;
+            out.copy(s.callJump, {.ip = ip + 1,
+                                  .jump = handlers.natives[intrinsicIndex(op)],
+                                  .frame = -(arity + 1) * int32_t(sizeof(Value))});
+            break;
+        }
+        case OpCode::RETURN:
+            out.copy(s.ret, {.ip = ip + 1, .jump = handlers.ret});
+            break;
+        default:
+            // Calls and the instructions without a handler would leave the code, for the
+            // VM's frames or for the interpreter. That costs more than the code saves.
+            if (patch.handler == nullptr) {
+                return nullptr;
+            }
+            out.copy(s.call, patch);
+            break;
+        }
+    }
+    // Without a loop the function is not run long enough to make up for entering it.
+    if (!loops || !out.link()) {
+        return nullptr;
+    }
+
+    uint8_t *code = allocate(out.code);
+    if (code == nullptr) {
+        return nullptr;
+    }
+    codes.push_back(
+        std::make_unique<JitCode>(code, out.code.size(), std::move(out.entries)));
+    return codes.back().get();
+}
+
+bool Jit::enter(VM *vm, JitCode *code, Value *sp, Value *slots, size_t offset) {
+    uint8_t *entry = code->entry(offset);
+    if (entry == nullptr) {
+        return false;
+    }
+    using Native = void (*)(VM *, Value *, Value *, uint8_t *);
+    auto native = reinterpret_cast<Native>(code->get_code()); // NOLINT
+    native(vm, sp, slots, entry);
+    return true;
+}
+
+} // namespace alox
@@ -0,0 +1,113 @@
+//
+// ALOX-CC
+//
+
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "chunk.hh"
+#include "globals.hh"
+#include "value.hh"
+
+namespace alox {
+
+class ObjFunction;
+class VM;
+
+// The stencils are x86-64 machine code and the code memory comes from mmap.
+#if defined(__x86_64__) && defined(__linux__)
+constexpr bool JIT_AVAILABLE = true;
+#else
+constexpr bool JIT_AVAILABLE = false;
+#endif
+
+/**
+ * @brief Why the JIT code gave control back to the interpreter.
+ */
+enum class JitExit {
+    Call,      // a frame was pushed or popped, run the new top frame.
+    Interpret, // the instruction at frame->ip has no stencil.
+    Done,      // the script returned.
+    Error,     // a runtime error was reported.
+};
+
+/**
+ * @brief Runs the instruction at ip, the byte after the opcode, with the VM stack top
+ * at sp. Returns the new stack top, or nullptr to leave the JIT code after setting
+ * the VM's exit reason.
+ */
+using JitHandler = Value *(*)(VM *vm, Value *sp, uint8_t *ip);
+
+/**
+ * @brief Where the JIT code goes after a call or a return. Calls give the stack top and
+ * the callee's code, nullptr if it was a native function. Returns give the caller's
+ * slots and code. A null stack leaves the JIT code.
+ */
+struct JitJump {
+    Value   *stack;
+    uint8_t *code;
+};
+
+using JitJumpHandler = JitJump (*)(VM *vm, Value *sp, uint8_t *ip);
+
+struct JitHandlers {
+    std::array<JitHandler, OPCODE_COUNT>          ops{}; // nullptr: not compiled.
+    std::array<JitJumpHandler, intrinsics.size()> natives{}; // by intrinsicIndex()
+    JitJumpHandler                                ret{};
+};
+
+/**
+ * @brief The machine code of one function, with the entry point of each instruction
+ * so that the interpreter can continue in it after a call or at a loop.
+ */
+class JitCode {
+  public:
+    JitCode(uint8_t *code, size_t size, std::vector<int32_t> entries)
+        : code(code), size(size), entries(std::move(entries)){};
+    ~JitCode();
+
+    JitCode(const JitCode &) = delete;
+    JitCode &operator=(const JitCode &) = delete;
+
+    [[nodiscard]] uint8_t *entry(size_t offset) const {
+        return entries[offset] < 0 ? nullptr : code + entries[offset];
+    }
+    [[nodiscard]] uint8_t *get_code() const { return code; }
+
+  private:
+    uint8_t             *code;
+    size_t               size;
+    std::vector<int32_t> entries; // native offset of each instruction, -1 inside one.
+};
+
+/**
+ * @brief A copy-and-patch baseline JIT.
+ *
+ * Each instruction is compiled by copying its stencil, a fixed piece of machine code,
+ * and patching the holes left for operands, handler addresses and jump targets. Simple
+ * instructions are done inline, keeping the stack top and the frame slots in registers.
+ * The others call a handler in the VM. Only functions with a loop and no calls are
+ * compiled: a call would leave for the VM's frames and cost more than it saves. A
+ * return jumps to the caller's code if it has some, else it leaves for the interpreter.
+ */
+class Jit {
+  public:
+    Jit(const JitHandlers &handlers, Globals &globals)
+        : handlers(handlers), globals(globals){};
+
+    JitCode *compile(ObjFunction *function);
+
+    // Run code from the instruction at offset until it leaves. Returns false if there
+    // is no entry there.
+    bool enter(VM *vm, JitCode *code, Value *sp, Value *slots, size_t offset);
+
+  private:
+    JitHandlers                           handlers;
+    Globals                              &globals;
+    std::vector<std::unique_ptr<JitCode>> codes;
+};
+
+} // namespace alox
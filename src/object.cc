@@ -2,6 +2,7 @@
 // ALOX-CC
 //
 
+#include <algorithm>
 #include <cstring>
 #include <functional>
 #include <iostream>
@@ -9,8 +10,7 @@
 #include <fmt/core.h>
 #include <string_view>
 
-#include <gc_cpp.h>
-
+#include "heap.hh"
 #include "memory.hh"
 #include "object.hh"
 #include "table.hh"
@@ -18,34 +18,43 @@
 
 namespace alox {
 
+constexpr size_t INSTANCE_MIN_FIELDS = 4;
+
 ObjBoundMethod *newBoundMethod(Value receiver, ObjClosure *method) {
-    auto *bound = new ObjBoundMethod();
+    auto *bound = Heap::current().make<ObjBoundMethod>();
     bound->receiver = receiver;
     bound->method = method;
     return bound;
 }
 
 ObjClass *newClass(ObjString *name) {
-    auto *klass = new ObjClass();
+    auto *klass = Heap::current().make<ObjClass>();
     klass->name = name; // [klass]
+    klass->shape = new Shape();
     return klass;
 }
 
 ObjClosure *newClosure(ObjFunction *function) {
-    auto **upvalues = new ObjUpvalue *[function->upvalueCount];
+    auto *upvalues = new ObjClosure::Capture[function->upvalueCount];
     for (int i = 0; i < function->upvalueCount; i++) {
-        upvalues[i] = nullptr;
+        upvalues[i].upvalue = nullptr;
     }
 
-    auto *closure = new ObjClosure();
+    auto *closure = Heap::current().make<ObjClosure>();
     closure->function = function;
     closure->upvalues = upvalues;
     closure->upvalueCount = function->upvalueCount;
     return closure;
 }
 
+ObjCoroutine *newCoroutine(Value function) {
+    auto *coroutine = Heap::current().make<ObjCoroutine>();
+    coroutine->function = function;
+    return coroutine;
+}
+
 ObjFunction *newFunction() {
-    auto *function = new ObjFunction();
+    auto *function = Heap::current().make<ObjFunction>();
     function->arity = 0;
     function->upvalueCount = 0;
     function->name = nullptr;
@@ -53,17 +62,109 @@ ObjFunction *newFunction() {
 }
 
 ObjInstance *newInstance(ObjClass *klass) {
-    auto *instance = new ObjInstance();
+    auto *instance = Heap::current().make<ObjInstance>();
     instance->klass = klass;
+    instance->shape = klass->shape;
+    // Room for the fields the class's last instance has by now, usually those init adds,
+    // so that they don't grow the storage one by one.
+    const size_t count = klass->latest != nullptr ? klass->latest->shape->get_count() : 0;
+    if (count > 0) {
+        instance->capacity = count;
+        instance->fields = new Value[count];
+    }
+    klass->latest = instance;
     return instance;
 }
 
+bool ObjInstance::get_field(ObjString *name, Value *value) {
+    const int slot = shape->lookup(name);
+    if (slot < 0) {
+        return false;
+    }
+    *value = fields[slot];
+    return true;
+}
+
+void ObjInstance::set_field(ObjString *name, Value value) {
+    const int slot = shape->lookup(name);
+    if (slot >= 0) {
+        fields[slot] = value;
+        return;
+    }
+
+    Shape *next = shape->transition(name);
+    set_slot(next, int(next->get_count() - 1), value);
+}
+
+// Store value in slot, moving to the shape next if that adds the slot. A dictionary
+// shape adds its slots in place.
+void ObjInstance::set_slot(Shape *next, int slot, Value value) {
+    shape = next;
+    if (shape->get_count() > capacity) {
+        const size_t oldCapacity = capacity;
+        capacity = std::max({INSTANCE_MIN_FIELDS, oldCapacity * 2, shape->get_count()});
+        fields = grow_array<Value>(fields, oldCapacity, capacity);
+    }
+    fields[slot] = value;
+}
+
+void VTable::set(ObjString *name, ObjClosure *closure) {
+    const uint32_t selector = name->selector;
+    auto method = std::ranges::lower_bound(methods, selector, {}, &Method::selector);
+    if (method != methods.end() && method->selector == selector) {
+        method->closure = closure;
+    } else {
+        methods.insert(method, {selector, name, closure});
+    }
+    const size_t span = methods.back().selector - methods.front().selector + 1;
+    if (span > 2 * methods.size()) {
+        dense = {};
+        return;
+    }
+    if (dense.empty() || selector < base) {
+        base = methods.front().selector;
+        dense.assign(span, nullptr);
+        for (const Method &m : methods) {
+            dense[m.selector - base] = m.closure;
+        }
+        return;
+    }
+    if (selector - base >= dense.size()) {
+        dense.resize(selector - base + 1);
+    }
+    dense[selector - base] = closure;
+}
+
+void ObjClass::set_method(ObjString *name, ObjClosure *method) {
+    if (vtable == nullptr) {
+        vtable = std::make_shared<VTable>();
+    } else if (vtable.use_count() > 1) {
+        vtable = std::make_shared<VTable>(*vtable); // a copy of the superclass's.
+    }
+    methodSelector(name);
+    vtable->set(name, method);
+    version++;
+}
+
+// Called before the class's own methods are set. The vtable is shared until one is.
+void ObjClass::inherit(const ObjClass *superclass) {
+    vtable = superclass->vtable;
+    initializer = superclass->initializer;
+    version++;
+}
+
 ObjNative *newNative(NativeFn function) {
-    auto *native = new ObjNative();
+    auto *native = Heap::current().make<ObjNative>();
     native->function = function;
     return native;
 }
 
+ObjNative *newNative(VmNativeFn function) {
+    auto *native = Heap::current().make<ObjNative>();
+    native->vmFunction = function;
+    return native;
+}
+
 inline uint32_t hashString(const std::string_view &s) {
     uint32_t hash = 2166136261u;
     for (auto c : s) {
@@ -74,20 +175,36 @@ inline uint32_t hashString(const std::string_view &s) {
 }
 
 ObjString *newString(std::string const &s) {
-    auto *string = new ObjString();
+    Heap          &heap = Heap::current();
+    const uint32_t hash = hashString(s);
+    if (ObjString *interned = heap.get_strings().findString(s, hash)) {
+        return interned;
+    }
+
+    auto *string = heap.make<ObjString>();
     string->str = s;
-    string->hash = hashString(s);
+    string->hash = hash;
+    heap.get_strings().set(string, NIL_VAL);
     return string;
 }
 
 ObjUpvalue *newUpvalue(Value *slot) {
-    auto *upvalue = new ObjUpvalue();
+    auto *upvalue = Heap::current().make<ObjUpvalue>();
     upvalue->closed = NIL_VAL;
     upvalue->location = slot;
     upvalue->next = nullptr;
     return upvalue;
 }
 
+// The selector of a method name, numbering it in its heap if it is new. Names are
+// interned, so the number is kept in the string.
+uint32_t methodSelector(ObjString *name) {
+    if (name->selector == NO_SELECTOR) {
+        name->selector = Heap::current().next_selector();
+    }
+    return name->selector;
+}
+
 static void printFunction(std::ostream &os, ObjFunction *function) {
     if (function->name == nullptr) {
         os << "<script>";
@@ -122,6 +239,9 @@ void printObject(std::ostream &os, Value value) {
     case OBJ_UPVALUE:
         os << "upvalue";
         break;
+    case OBJ_COROUTINE:
+        os << "<coroutine>";
+        break;
     }
 }
 
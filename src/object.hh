@@ -4,15 +4,30 @@
 
 #pragma once
 
+#include <algorithm>
+#include <memory>
+#include <span>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "chunk.hh"
 #include "common.hh"
+#include "shape.hh"
 #include "table.hh"
 #include "value.hh"
 
 namespace alox {
 
+class AotFrame;
+class JitCode;
+class ObjInstance;
+class VM;
+struct CoroutineStacks;
+
+// The C++ made by AotEmitter for a function. Returns false on a runtime error.
+using AotFunction = bool (*)(AotFrame &frame);
+
 using ObjType = uint8_t;
 
 constexpr ObjType OBJ_BOUND_METHOD = 0;
@@ -23,6 +38,7 @@ constexpr ObjType OBJ_INSTANCE = 4;
 constexpr ObjType OBJ_NATIVE = 5;
 constexpr ObjType OBJ_STRING = 6;
 constexpr ObjType OBJ_UPVALUE = 7;
+constexpr ObjType OBJ_COROUTINE = 8;
 
 class Obj {
   public:
@@ -40,27 +56,47 @@ class ObjFunction : public Obj {
 
     int        arity{};
     int        upvalueCount{};
+    int        maxStack{}; // the most values on the stack from the frame's slots.
     Chunk      chunk;
     ObjString *name{};
+
+    uint32_t    hotness{}; // calls and loops, for the JIT.
+    JitCode    *jit{};
+    AotFunction aot{}; // set by the program made with --emit-cpp.
 };
 
 using NativeFn = Value (*)(int, Value const *);
+// A native that works on the VM, for one that can suspend the task calling it. The
+// arguments are on top of the stack, to be replaced by the result as a call of a native
+// does. Returns false on a runtime error.
+using VmNativeFn = bool (*)(VM &vm, int argCount);
 
 class ObjNative : public Obj {
   public:
     ObjNative() : Obj(OBJ_NATIVE){};
 
-    NativeFn function{};
+    NativeFn   function{};
+    VmNativeFn vmFunction{}; // called instead of function if set.
 };
 
+// Method names are numbered when first defined, the index in the vtables of the classes.
+constexpr uint32_t NO_SELECTOR = UINT32_MAX;
+
 class ObjString : public Obj {
   public:
     ObjString() : Obj(OBJ_STRING){};
 
     std::string str;
     uint32_t    hash{};
+    uint32_t    selector{NO_SELECTOR};
 };
 
+// Strings are interned in their heap, so the same object if made in the same heap. One
+// made in another heap, or outside a Heap::Scope, is compared by its text.
+inline bool stringsEqual(const ObjString *a, const ObjString *b) {
+    return a == b || (a->hash == b->hash && a->str == b->str);
+}
+
 class ObjUpvalue : public Obj {
   public:
     ObjUpvalue() : Obj(OBJ_UPVALUE){};
@@ -74,25 +110,98 @@ class ObjClosure : public Obj {
   public:
     ObjClosure() : Obj(OBJ_CLOSURE){};
 
+    // A captured variable: boxed when it can be assigned, else its value, read with
+    // GET_CAPTURED.
+    union Capture {
+        ObjUpvalue *upvalue;
+        Value       value;
+    };
+
     ObjFunction *function{};
-    ObjUpvalue **upvalues{};
+    Capture     *upvalues{};
     int          upvalueCount{};
 };
 
+// The methods of a class by selector. While the selectors span no more than twice the
+// methods, a method is one index from the lowest; past that they are searched in order,
+// so a class takes room for its own methods however far apart their names were numbered.
+class VTable {
+  public:
+    struct Method {
+        uint32_t    selector;
+        ObjString  *name;
+        ObjClosure *closure;
+    };
+
+    [[nodiscard]] ObjClosure *find(uint32_t selector) const {
+        if (!dense.empty()) {
+            const uint32_t index = selector - base; // past the end if below base.
+            return index < dense.size() ? dense[index] : nullptr;
+        }
+        const auto method =
+            std::ranges::lower_bound(methods, selector, {}, &Method::selector);
+        if (method == methods.end() || method->selector != selector) {
+            return nullptr;
+        }
+        return method->closure;
+    }
+    // name has its selector.
+    void set(ObjString *name, ObjClosure *closure);
+
+    [[nodiscard]] const std::vector<Method> &get_methods() const { return methods; }
+    // The entries kept for the methods.
+    [[nodiscard]] size_t size() const { return methods.size() + dense.size(); }
+
+  private:
+    std::vector<Method>       methods; // by selector.
+    std::vector<ObjClosure *> dense;   // from base, empty if the selectors are sparse.
+    uint32_t                  base{0};
+};
+
 class ObjClass : public Obj {
   public:
     ObjClass() : Obj(OBJ_CLASS){};
 
-    ObjString *name{};
-    Table      methods;
+    // The method, defined in the class or inherited, or nullptr.
+    [[nodiscard]] ObjClosure *find_method(const ObjString *name) const {
+        return vtable != nullptr ? vtable->find(name->selector) : nullptr;
+    }
+    void set_method(ObjString *name, ObjClosure *method);
+    void inherit(const ObjClass *superclass);
+
+    // The methods defined in the class or inherited.
+    [[nodiscard]] std::span<const VTable::Method> get_methods() const {
+        return vtable != nullptr ? std::span(vtable->get_methods())
+                                 : std::span<const VTable::Method>();
+    }
+    [[nodiscard]] size_t vtable_size() const {
+        return vtable != nullptr ? vtable->size() : 0;
+    }
+
+    ObjString   *name{};
+    uint32_t     version{0};    // changed with methods, checked by the inline caches.
+    Shape       *shape{};       // root shape of the instances, no fields.
+    ObjClosure  *initializer{}; // init, found once for all the constructor calls.
+    ObjInstance *latest{};      // the last instance made, whose fields size the next.
+
+  private:
+    // A subclass shares its superclass's until it sets a method of its own, then copies
+    // it, so a lookup doesn't walk the superclasses however deep the class is.
+    std::shared_ptr<VTable> vtable;
 };
 
 class ObjInstance : public Obj {
   public:
     ObjInstance() : Obj(OBJ_INSTANCE){};
 
+    bool get_field(ObjString *name, Value *value);
+    void set_field(ObjString *name, Value value);
+    void set_slot(Shape *next, int slot, Value value);
+
     ObjClass *klass{};
-    Table     fields; // [fields]
+    Shape    *shape{};
+    Value    *fields{}; // indexed by the slots of shape
+    size_t    capacity{0};
 };
 
 class ObjBoundMethod : public Obj {
@@ -103,6 +212,21 @@ class ObjBoundMethod : public Obj {
     ObjClosure *method{};
 };
 
+// A function run on stacks of its own, made by the native coroutine(). A call of the
+// coroutine resumes it until it yields or returns.
+class ObjCoroutine : public Obj {
+  public:
+    ObjCoroutine() : Obj(OBJ_COROUTINE){};
+
+    enum class State { Suspended, Running, Done };
+
+    Value            function{}; // called with the arguments of the first resume.
+    State            state{State::Suspended};
+    CoroutineStacks *stacks{};  // its own, or its resumer's while it runs.
+    ObjCoroutine    *resumer{}; // nullptr when resumed by the script's stacks.
+    bool             task{};    // made by task(), resumed by the event loop only.
+};
+
 constexpr ObjType obj_type(Value value) {
     return (as<Obj *>(value)->get_type());
 }
@@ -139,6 +263,10 @@ template <> constexpr bool is<ObjString>(Value value) {
     return isObjType(value, OBJ_STRING);
 }
 
+template <> constexpr bool is<ObjCoroutine>(Value value) {
+    return isObjType(value, OBJ_COROUTINE);
+}
+
 template <> inline ObjBoundMethod *as<ObjBoundMethod *>(Value value) {
     return reinterpret_cast<ObjBoundMethod *>(as<Obj *>(value));
 }
@@ -159,6 +287,14 @@ template <> inline ObjInstance *as<ObjInstance *>(Value value) {
     return reinterpret_cast<ObjInstance *>(as<Obj *>(value));
 }
 
+template <> inline ObjCoroutine *as<ObjCoroutine *>(Value value) {
+    return reinterpret_cast<ObjCoroutine *>(as<Obj *>(value));
+}
+
+template <> inline ObjNative *as<ObjNative *>(Value value) {
+    return reinterpret_cast<ObjNative *>(as<Obj *>(value));
+}
+
 template <> inline NativeFn as<NativeFn>(Value value) {
     return reinterpret_cast<ObjNative *>(as<Obj *>(value))->function;
 }
@@ -170,11 +306,14 @@ template <> inline ObjString *as<ObjString *>(Value value) {
 ObjBoundMethod *newBoundMethod(Value receiver, ObjClosure *method);
 ObjClass       *newClass(ObjString *name);
 ObjClosure     *newClosure(ObjFunction *function);
+ObjCoroutine   *newCoroutine(Value function);
 ObjFunction    *newFunction();
 ObjInstance    *newInstance(ObjClass *klass);
 ObjNative      *newNative(NativeFn function);
+ObjNative      *newNative(VmNativeFn function);
 ObjString      *newString(std::string const &s);
 ObjUpvalue     *newUpvalue(Value *slot);
+uint32_t        methodSelector(ObjString *name);
 void            printObject(std::ostream &os, Value value);
 
 } // namespace alox
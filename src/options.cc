@@ -23,6 +23,21 @@ int getOptions(int argc, const char *argv[], Options &options) {
     app.add_flag("-p,--parse", options.parse, "print the parsing");
     app.add_flag("-d,--debug", options.debug_code, "print the bytecode and exit");
     app.add_flag("-x,--trace", options.trace, "trace execution");
+    app.add_flag("--profile", options.profile, "print instruction and call counts");
+    app.add_flag("--coverage", options.coverage, "print the lines executed");
+    app.add_flag("--cache", options.cache_stats, "print inline cache hits and misses");
+    app.add_flag("--switch", options.switch_dispatch, "use switch dispatch in the VM");
+    app.add_flag("--registers", options.registers, "run the register VM");
+    app.add_flag("--jit", options.jit, "compile hot functions to machine code");
+    app.add_option("--jit-threshold", options.jit_threshold,
+                   "calls and loops before a function is compiled");
+    app.add_option("--max-frames", options.max_frames,
+                   "call depth before a stack overflow")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--workers", options.workers,
+                   "threads running spawned functions, 0 for one for each core");
+    app.add_option("--emit-cpp", options.emit_cpp,
+                   "write the program as C++ to build with the lox library");
 
     CLI11_PARSE(app, argc, argv);
     return 0;
@@ -18,9 +18,20 @@ struct Options {
     bool parse{false};
     bool debug_code{false};
     bool trace{false};
+    bool profile{false};
+    bool coverage{false};
+    bool cache_stats{false};
     bool silent{false};
+    bool switch_dispatch{false}; // use the switch loop even if threaded dispatch is built
+    bool registers{false};       // compile to register code and run the register VM
+    bool jit{false};             // compile hot functions to machine code
+
+    uint32_t jit_threshold{100}; // calls and loops before a function is compiled
+    uint32_t max_frames{10000};  // call depth before "Stack overflow."
+    uint32_t workers{0};         // threads running spawned functions, 0 for each core
 
     std::string file_name;
+    std::string emit_cpp; // write the program as C++ to this file instead of running it
 
     std::ostream &out;
     std::istream &in;
@@ -0,0 +1,266 @@
+//
+// ALOX-CC
+//
+
+#include "parallel.hh"
+
+#include <sstream>
+
+#include "aot.hh"
+#include "compiler.hh"
+#include "error.hh"
+#include "parser.hh"
+#include "scanner.hh"
+#include "vm.hh"
+
+namespace alox {
+
+void Programs::add(const std::string &source, ObjFunction *script) {
+    auto more = std::make_shared<std::vector<std::string>>(*sources);
+    more->push_back(source);
+    sources = std::move(more);
+
+    std::vector<ObjFunction *> all;
+    if (script != nullptr) {
+        all = AotEmitter::functions(script);
+    }
+    for (size_t n = 0; n < all.size(); n++) {
+        refs[all[n]] = {uint32_t(functions.size()), uint32_t(n)};
+    }
+    functions.push_back(std::move(all));
+}
+
+std::optional<Copy> Programs::copy(Value value) {
+    if (!is<Obj>(value)) {
+        return Copy{value};
+    }
+    if (is<ObjString>(value)) {
+        return Copy{as<ObjString *>(value)->str};
+    }
+    if (is<ObjClosure>(value) && as<ObjClosure *>(value)->upvalueCount == 0) {
+        const auto ref = refs.find(as<ObjClosure *>(value)->function);
+        if (ref != refs.end()) {
+            return Copy{ref->second};
+        }
+    }
+    if (is<ObjClass>(value)) {
+        return copyClass(as<ObjClass *>(value));
+    }
+    return std::nullopt;
+}
+
+// Copied once, as its methods are set when it is declared.
+std::optional<Copy> Programs::copyClass(ObjClass *klass) {
+    if (const auto copied = copies.find(klass); copied != copies.end()) {
+        return Copy{copied->second};
+    }
+    auto copied = std::make_shared<ClassCopy>();
+    copied->klass = klass;
+    copied->name = klass->name->str;
+    for (const VTable::Method &method : klass->get_methods()) {
+        const auto ref = refs.find(method.closure->function);
+        if (method.closure->upvalueCount != 0 || ref == refs.end()) {
+            return std::nullopt;
+        }
+        copied->methods.emplace_back(method.name->str, ref->second);
+    }
+    classes[klass] = klass;
+    copies[klass] = copied;
+    return Copy{std::shared_ptr<const ClassCopy>(std::move(copied))};
+}
+
+// Strings are made in this thread's VM. A function's closure captures nothing, so one
+// serves for every copy, and a class is made once for every copy of it.
+Value Programs::make(const Copy &copy) {
+    if (const auto *plain = std::get_if<Value>(&copy)) {
+        return *plain;
+    }
+    if (const auto *string = std::get_if<std::string>(&copy)) {
+        return value<Obj *>(newString(*string));
+    }
+    if (const auto *copied = std::get_if<std::shared_ptr<const ClassCopy>>(&copy)) {
+        return value<Obj *>(makeClass(*copied));
+    }
+    const FunctionRef ref = std::get<FunctionRef>(copy);
+    ObjFunction      *function = functions[ref.program][ref.function];
+    ObjClosure      *&closure = closures[function];
+    if (closure == nullptr) {
+        closure = newClosure(function);
+    }
+    return value<Obj *>(closure);
+}
+
+ObjClass *Programs::makeClass(const std::shared_ptr<const ClassCopy> &copied) {
+    ObjClass *&klass = classes[copied->klass];
+    if (klass != nullptr) {
+        return klass;
+    }
+    klass = newClass(newString(copied->name));
+    for (const auto &[name, ref] : copied->methods) {
+        auto *method = as<ObjClosure *>(make(Copy{ref}));
+        klass->set_method(newString(name), method);
+        if (name == "init") {
+            klass->initializer = method;
+        }
+    }
+    copies[klass] = copied;
+    return klass;
+}
+
+WorkerPool::WorkerPool(const Options &options, size_t count) : options(options) {
+    for (size_t n = 0; n < count; n++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t n = 0; n < count; n++) {
+        workers[n]->thread = std::thread([this, n] { work(n); });
+    }
+}
+
+// The jobs still queued are dropped.
+WorkerPool::~WorkerPool() {
+    {
+        const std::scoped_lock hold(lock);
+        stopping = true;
+    }
+    queued.notify_all();
+    for (const auto &worker : workers) {
+        worker->thread.join();
+    }
+}
+
+void WorkerPool::spawn(const std::shared_ptr<Job> &job) {
+    // Queued and counted under one lock, so that a worker counting it finds it queued.
+    {
+        const std::scoped_lock hold(lock);
+        Worker                &worker = *workers[next++ % workers.size()];
+        {
+            const std::scoped_lock holdJobs(worker.lock);
+            worker.jobs.push_back(job);
+        }
+        waiting++;
+    }
+    queued.notify_one();
+}
+
+void WorkerPool::join(const std::shared_ptr<Job> &job) {
+    std::unique_lock hold(lock);
+    finished.wait(hold, [&job] { return job->done; });
+}
+
+// The next job for worker n, the newest of its own or the oldest of another's. Returns
+// nullptr when the pool stops.
+std::shared_ptr<Job> WorkerPool::take(size_t n) {
+    // A job is claimed by counting it off, so the deques hold one for each claim.
+    {
+        std::unique_lock hold(lock);
+        queued.wait(hold, [this] { return stopping || waiting > 0; });
+        if (stopping) {
+            return nullptr;
+        }
+        waiting--;
+    }
+    for (;;) {
+        for (size_t i = 0; i < workers.size(); i++) {
+            Worker              &worker = *workers[(n + i) % workers.size()];
+            std::shared_ptr<Job> job;
+            {
+                const std::scoped_lock hold(worker.lock);
+                if (worker.jobs.empty()) {
+                    continue;
+                }
+                if (i == 0) {
+                    job = std::move(worker.jobs.back());
+                    worker.jobs.pop_back();
+                } else {
+                    job = std::move(worker.jobs.front());
+                    worker.jobs.pop_front();
+                }
+            }
+            return job;
+        }
+    }
+}
+
+namespace {
+
+// As Alox::compile(), for a source that compiled in the spawning VM.
+ObjFunction *compile(const std::string &source, const Options &options, VM &vm) {
+    Scanner      scanner(source);
+    ErrorManager errors(options.err);
+    Parser       parser(scanner, errors);
+    auto        *ast = parser.parse();
+    if (errors.hadError) {
+        return nullptr;
+    }
+    Compiler compiler(options, errors, vm.get_globals());
+    return compiler.compile(ast);
+}
+
+} // namespace
+
+// A worker's output and errors are kept for join(), so that only the spawning VM's
+// thread writes to its streams.
+void WorkerPool::work(size_t n) {
+    std::ostringstream out;
+    std::ostringstream err;
+    Options            workerOptions(out, options.in, err);
+    workerOptions.switch_dispatch = options.switch_dispatch;
+    workerOptions.registers = options.registers;
+    workerOptions.jit = options.jit;
+    workerOptions.jit_threshold = options.jit_threshold;
+    workerOptions.max_frames = options.max_frames;
+
+    VM                vm(workerOptions);
+    const Heap::Scope scope(vm.get_heap());
+    vm.init();
+    vm.set_worker();
+    Programs &programs = vm.get_programs();
+    Globals  &globals = vm.get_globals();
+    // The natives, which a job's globals that aren't copied are reset to.
+    std::vector<Value> natives;
+    for (size_t slot = 0; slot < globals.get_count(); slot++) {
+        natives.push_back(globals.get_value(global_index_t(slot)));
+    }
+
+    while (const std::shared_ptr<Job> job = take(n)) {
+        for (size_t i = programs.get_count(); i < job->sources->size(); i++) {
+            const std::string &source = (*job->sources)[i];
+            programs.add(source, compile(source, workerOptions, vm));
+        }
+        // Nothing an earlier job on this worker did to the globals is seen.
+        for (size_t slot = 0; slot < globals.get_count(); slot++) {
+            globals.get_value(global_index_t(slot)) =
+                slot < natives.size() ? natives[slot] : UNDEFINED_VAL;
+        }
+        for (const auto &[slot, copy] : job->globals) {
+            if (slot < globals.get_count()) {
+                globals.get_value(slot) = programs.make(copy);
+            }
+        }
+        std::vector<Value> args;
+        for (const Copy &copy : job->args) {
+            args.push_back(programs.make(copy));
+        }
+        ObjClosure *closure = as<ObjClosure *>(programs.make(job->function));
+
+        out.str("");
+        err.str("");
+        Value result = NIL_VAL;
+        if (vm.run(closure, args, result) != INTERPRET_OK) {
+            const std::string message = err.str();
+            job->error = message.substr(0, message.find('\n'));
+        } else if (!(job->result = programs.copy(result))) {
+            job->error =
+                "A spawned function can only return numbers, booleans, nil, strings, "
+                "functions and classes.";
+        }
+        job->output = out.str();
+        {
+            const std::scoped_lock hold(lock);
+            job->done = true;
+        }
+        finished.notify_all();
+    }
+}
+
+} // namespace alox
@@ -0,0 +1,137 @@
+//
+// ALOX-CC
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "globals.hh"
+#include "object.hh"
+#include "options.hh"
+#include "value.hh"
+
+namespace alox {
+
+// A function by the program it was compiled in and its place in
+// AotEmitter::functions() of that program, the same in every VM that compiles it.
+struct FunctionRef {
+    uint32_t program;
+    uint32_t function;
+};
+
+// A class whose methods capture no variables: its name and its methods, those it
+// inherits too. klass is the class copied, so that a VM makes it once.
+struct ClassCopy {
+    const ObjClass                                  *klass;
+    std::string                                      name;
+    std::vector<std::pair<std::string, FunctionRef>> methods;
+};
+
+// A value copied out of a VM: a number, boolean or nil as it is, the characters of a
+// string, a function that captures no variables, or a class.
+using Copy =
+    std::variant<Value, std::string, FunctionRef, std::shared_ptr<const ClassCopy>>;
+
+/**
+ * @brief The sources a VM has compiled, in order, and their functions. Another VM that
+ * compiles them again gets the same global slots and functions, so values can be copied
+ * between the two.
+ */
+class Programs {
+  public:
+    // script is nullptr if the source didn't compile.
+    void add(const std::string &source, ObjFunction *script);
+
+    [[nodiscard]] std::shared_ptr<const std::vector<std::string>> get_sources() const {
+        return sources;
+    }
+    [[nodiscard]] size_t get_count() const { return functions.size(); }
+
+    // Returns nullopt for a value that can't be copied.
+    std::optional<Copy> copy(Value value);
+    Value               make(const Copy &copy);
+
+  private:
+    std::optional<Copy> copyClass(ObjClass *klass);
+    ObjClass           *makeClass(const std::shared_ptr<const ClassCopy> &copied);
+
+    // Replaced, never changed, as the workers keep the one they compiled from.
+    std::shared_ptr<const std::vector<std::string>>  sources =
+        std::make_shared<const std::vector<std::string>>();
+    std::vector<std::vector<ObjFunction *>>          functions;
+    std::unordered_map<ObjFunction *, FunctionRef>   refs;
+    std::unordered_map<ObjFunction *, ObjClosure *>  closures; // made by make().
+    std::unordered_map<const ObjClass *, ObjClass *> classes;  // by the class copied.
+    std::unordered_map<ObjClass *, std::shared_ptr<const ClassCopy>> copies;
+};
+
+/**
+ * @brief A function spawned to run on a worker, with copies of its arguments and of the
+ * globals of the spawning VM.
+ */
+struct Job {
+    std::shared_ptr<const std::vector<std::string>>  sources;
+    FunctionRef                                      function;
+    std::vector<Copy>                                args;
+    std::vector<std::pair<global_index_t, Copy>>     globals;
+
+    bool                done{false};
+    std::optional<Copy> result;
+    std::string         error;  // the runtime error, if there is no result.
+    std::string         output; // what it printed, for join() to print.
+};
+
+/**
+ * @brief Runs jobs in parallel, each on the VM of a worker thread.
+ *
+ * Each worker has a deque of jobs. spawn() deals jobs to the workers in turn. A worker
+ * takes the newest job of its own deque, and when that is empty steals the oldest job of
+ * another's, so that a worker given long jobs doesn't hold up the ones queued behind
+ * them. A worker's VM compiles the programs of the spawning VM before its first job, and
+ * runs each job with the globals copied into it.
+ */
+class WorkerPool {
+  public:
+    WorkerPool(const Options &options, size_t count);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    void spawn(const std::shared_ptr<Job> &job);
+    // Wait for the job to be done.
+    void join(const std::shared_ptr<Job> &job);
+
+  private:
+    struct Worker {
+        std::mutex                       lock;
+        std::deque<std::shared_ptr<Job>> jobs;
+        std::thread                      thread;
+    };
+
+    void                 work(size_t n);
+    std::shared_ptr<Job> take(size_t n);
+
+    const Options                       &options;
+    std::vector<std::unique_ptr<Worker>> workers;
+    size_t                               next{0}; // the worker dealt the next job.
+
+    std::mutex              lock; // for the counts and flags below.
+    std::condition_variable queued;
+    std::condition_variable finished;
+    size_t                  waiting{0}; // jobs in the deques not yet claimed.
+    bool                    stopping{false};
+};
+
+} // namespace alox
@@ -28,6 +28,7 @@ constexpr auto MAX_ARGS = UINT8_MAX;
 Declaration *Parser::parse() {
     advance();
     auto *ast = new Declaration(current.line);
+    assigned = &ast->assigned;
 
     while (!match(TokenType::EOFS)) {
         auto *s = declaration();
@@ -88,7 +89,15 @@ FunctDec *Parser::funDeclaration(FunctionType type) {
     }
     consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters.");
     consume(TokenType::LEFT_BRACE, fmt::format("Expect '{{' before {} body.", type_name));
+
+    // A variable assigned in a nested function is assigned in the enclosing ones too.
+    auto *enclosing = assigned;
+    assigned = &ast->assigned;
     ast->body = block();
+    assigned = enclosing;
+    if (assigned != nullptr) {
+        assigned->insert(assigned->end(), ast->assigned.begin(), ast->assigned.end());
+    }
     return ast;
 }
 
@@ -127,6 +136,10 @@ Statement *Parser::statement() {
         ast->stat = OBJ_AST(return_stat());
     } else if (match(TokenType::WHILE)) {
         ast->stat = OBJ_AST(while_stat());
+    } else if (match(TokenType::TRY)) {
+        ast->stat = OBJ_AST(try_stat());
+    } else if (match(TokenType::THROW)) {
+        ast->stat = OBJ_AST(throw_stat());
     } else if (match(TokenType::BREAK)) {
         ast->stat = OBJ_AST(break_stat(TokenType::BREAK));
     } else if (match(TokenType::CONTINUE)) {
@@ -214,6 +227,27 @@ Return *Parser::return_stat() {
     return ast;
 }
 
+Try *Parser::try_stat() {
+    auto *ast = new Try(current.line);
+    consume(TokenType::LEFT_BRACE, "Expect '{' after 'try'.");
+    ast->body = block();
+    consume(TokenType::CATCH, "Expect 'catch' after try block.");
+    consume(TokenType::LEFT_PAREN, "Expect '(' after 'catch'.");
+    consume(TokenType::IDENTIFIER, "Expect exception variable name.");
+    ast->var = ident();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after exception variable.");
+    consume(TokenType::LEFT_BRACE, "Expect '{' after catch clause.");
+    ast->handler = block();
+    return ast;
+}
+
+Throw *Parser::throw_stat() {
+    auto *ast = new Throw(current.line);
+    ast->expr = expr();
+    consume(TokenType::SEMICOLON, "Expect ';' after thrown value.");
+    return ast;
+}
+
 Break *Parser::break_stat(TokenType t) {
     auto *ast = new Break(current.line);
     auto  name = "break";
@@ -301,6 +335,7 @@ inline const std::map<TokenType, ParseRule> rules{
     {TokenType::STRING, {std::mem_fn(&Parser::string), nullptr}},
     {TokenType::NUMBER, {std::mem_fn(&Parser::number), nullptr}},
     {TokenType::AND, {nullptr, std::mem_fn(&Parser::binary)}},
+    {TokenType::CATCH, {nullptr, nullptr}},
     {TokenType::CLASS, {nullptr, nullptr}},
     {TokenType::ELSE, {nullptr, nullptr}},
     {TokenType::FALSE, {std::mem_fn(&Parser::primary), nullptr}},
@@ -313,9 +348,12 @@ inline const std::map<TokenType, ParseRule> rules{
     {TokenType::RETURN, {nullptr, nullptr}},
     {TokenType::SUPER, {std::mem_fn(&Parser::super_), nullptr}},
     {TokenType::THIS, {std::mem_fn(&Parser::this_), nullptr}},
+    {TokenType::THROW, {nullptr, nullptr}},
     {TokenType::TRUE, {std::mem_fn(&Parser::primary), nullptr}},
+    {TokenType::TRY, {nullptr, nullptr}},
     {TokenType::VAR, {nullptr, nullptr}},
     {TokenType::WHILE, {nullptr, nullptr}},
+    {TokenType::YIELD, {std::mem_fn(&Parser::yield), nullptr}},
     {TokenType::ERROR, {nullptr, nullptr}},
     {TokenType::EOFS, {nullptr, nullptr}},
 };
@@ -363,6 +401,15 @@ Expr *Parser::unary(bool /*canAssign*/) {
     return e;
 }
 
+// The yielded value is as the right of an assignment.
+Expr *Parser::yield(bool /*canAssign*/) {
+    auto *ast = new Yield(current.line);
+    ast->expr = parsePrecedence(Precedence::ASSIGNMENT);
+    auto *e = new Expr(current.line);
+    e->expr = OBJ_AST(ast);
+    return e;
+}
+
 Expr *Parser::binary(Expr *left, bool /*canAssign*/) {
     auto *binary = new Binary(current.line);
     binary->left = left;
@@ -379,11 +426,32 @@ Expr *Parser::assign(Expr *left, bool /*canAssign*/) {
     auto *a = new Assign(current.line);
     a->left = left;
     a->right = parsePrecedence(Precedence::ASSIGNMENT);
+    addAssigned(left);
     auto *e = new Expr(current.line);
     e->expr = OBJ_AST(a);
     return e;
 }
 
+// Every name the compiler can set for the target, as it passes canAssign down.
+void Parser::addAssigned(Expr *target) {
+    if (assigned == nullptr) {
+        return;
+    }
+    Obj *ast = target->expr;
+    if (is<Expr>(ast)) {
+        addAssigned(as<Expr>(ast));
+    } else if (is<Identifier>(ast)) {
+        assigned->push_back(as<Identifier>(ast)->name);
+    } else if (is<Unary>(ast)) {
+        addAssigned(as<Unary>(ast)->expr);
+    } else if (is<Binary>(ast)) {
+        addAssigned(as<Binary>(ast)->left);
+        addAssigned(as<Binary>(ast)->right);
+    } else if (is<Dot>(ast)) {
+        addAssigned(as<Dot>(ast)->left);
+    }
+}
+
 Expr *Parser::call(Expr *left, bool /*canAssign*/) {
     auto *call = new Call(current.line);
     call->fname = left;
@@ -406,7 +474,7 @@ Expr *Parser::dot(Expr *left, bool canAssign) {
         dot->token = TokenType::LEFT_PAREN;
         argumentList(dot->args);
     } else {
-        // Get - collect nothing
+        dot->token = TokenType::DOT; // Get - collect nothing
     }
     auto *e = new Expr(current.line);
     e->expr = OBJ_AST(dot);
@@ -527,6 +595,8 @@ void Parser::synchronize() {
         case TokenType::WHILE:
         case TokenType::PRINT:
         case TokenType::RETURN:
+        case TokenType::TRY:
+        case TokenType::THROW:
             return;
 
         default:; // Do nothing.
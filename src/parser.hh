@@ -57,6 +57,8 @@ class Parser {
     For       *for_stat();
     Print     *printStatement();
     Return    *return_stat();
+    Try       *try_stat();
+    Throw     *throw_stat();
     Break     *break_stat(TokenType t);
     Expr      *exprStatement();
 
@@ -78,10 +80,12 @@ class Parser {
     Expr *number(bool /*canAssign*/);
     Expr *super_(bool /*canAssign*/);
     Expr *this_(bool /*canAssign*/);
+    Expr *yield(bool /*canAssign*/);
 
     Identifier *ident();
 
     void argumentList(std::vector<Expr *> &args);
+    void addAssigned(Expr *target);
 
     static ParseRule const *getRule(TokenType type);
 
@@ -104,6 +108,10 @@ class Parser {
   private:
     Scanner      &scanner;
     ErrorManager &err;
+
+    // The names assigned in the function being parsed, for the compiler to find the
+    // captured variables it can copy.
+    std::vector<std::string> *assigned{nullptr};
 };
 
 } // namespace lox
@@ -94,6 +94,10 @@ void AST_Printer::statement(Statement *s) {
         return_stat(as<Return>(s->stat));
     } else if (is<While>(s->stat)) {
         while_stat(as<While>(s->stat));
+    } else if (is<Try>(s->stat)) {
+        try_stat(as<Try>(s->stat));
+    } else if (is<Throw>(s->stat)) {
+        throw_stat(as<Throw>(s->stat));
     } else if (is<Break>(s->stat)) {
         break_stat(as<Break>(s->stat));
     } else if (is<Block>(s->stat)) {
@@ -160,6 +164,21 @@ void AST_Printer::return_stat(Return *s) {
     os << ';';
 }
 
+void AST_Printer::try_stat(Try *s) {
+    os << "try ";
+    block(s->body);
+    os << NL << "catch (";
+    identifier(s->var);
+    os << ") ";
+    block(s->handler);
+}
+
+void AST_Printer::throw_stat(Throw *s) {
+    os << "throw ";
+    expr(s->expr);
+    os << ';';
+}
+
 void AST_Printer::break_stat(Break *s) {
     if (s->tok == TokenType::BREAK) {
         os << "break;";
@@ -202,6 +221,8 @@ void AST_Printer::expr(Expr *ast) {
         dot(as<Dot>(ast->expr));
     } else if (is<This>(ast->expr)) {
         this_(as<This>(ast->expr));
+    } else if (is<Yield>(ast->expr)) {
+        yield(as<Yield>(ast->expr));
     } else if (is<Nil>(ast->expr)) {
         os << "nil";
     }
@@ -297,6 +318,12 @@ void AST_Printer::unary(Unary *ast) {
     expr(ast->expr);
 }
 
+void AST_Printer::yield(Yield *ast) {
+    os << "(yield ";
+    expr(ast->expr);
+    os << ')';
+}
+
 void AST_Printer::identifier(Identifier *ast) {
     os << ast->name;
 }
@@ -37,6 +37,8 @@ class AST_Printer {
     void while_stat(While *);
     void for_stat(For *);
     void return_stat(Return *);
+    void try_stat(Try *);
+    void throw_stat(Throw *);
     void break_stat(Break *);
     void printStatement(Print *s);
     void block(Block *s);
@@ -47,6 +49,7 @@ class AST_Printer {
     void call(Call *ast);
     void dot(Dot *ast);
     void unary(Unary *ast);
+    void yield(Yield *ast);
     void identifier(Identifier *ast);
     void boolean(Boolean *expr);
     void number(Number *num);
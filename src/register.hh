@@ -0,0 +1,134 @@
+//
+// ALOX-CC
+//
+
+#pragma once
+
+#include <vector>
+
+#include "common.hh"
+
+namespace alox {
+
+/**
+ * @brief Instructions of the register VM. Registers are the slots of the call frame, the
+ * locals first and then the temporaries.
+ *
+ * A is the destination unless noted. Operands marked RK are a register, or a constant
+ * when RK_CONSTANT is set. Instructions marked +1 are followed by an extra word.
+ */
+enum class RegOp : uint8_t {
+    MOVE,          // A = RK(B)
+    LOADK,         // A = K(B), for constants too large for RK
+    GET_GLOBAL,    // A = globals[B]
+    DEFINE_GLOBAL, // globals[A] = RK(B)
+    SET_GLOBAL,    // globals[A] = RK(B)
+    GET_UPVALUE,   // A = upvalues[B]
+    SET_UPVALUE,   // upvalues[A] = RK(B)
+    GET_CAPTURED,  // A = upvalues[B], a copied value
+    GET_PROPERTY,  // A = B.K(C), +1 cache
+    SET_PROPERTY,  // A.K(C) = RK(B), +1 cache
+    GET_SUPER,     // A = super method K(extra) of receiver B in superclass C, +1
+    EQUAL,         // A = RK(B) op RK(C)
+    NOT_EQUAL,
+    GREATER,
+    NOT_GREATER,
+    LESS,
+    NOT_LESS,
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    NOT,           // A = op RK(B)
+    NEGATE,
+    PRINT,         // print RK(A)
+    JUMP,          // pc += offset
+    JUMP_IF_FALSE, // if RK(A) is falsey pc += offset
+    CALL,          // A = A(A+1 .. A+B)
+    CALL_DIRECT,   // CALL of A, the function in globals[C] when compiled
+    INTRINSIC,     // A = intrinsic OpCode B of A .., the native in globals[C]
+    INVOKE,        // A = A.K(C)(A+1 .. A+B), +1 cache
+    SUPER_INVOKE,  // A = super K(C) of A in superclass A+B+1 (A+1 .. A+B)
+    CLOSURE,       // A = closure of K(B), +1 for each upvalue (CaptureKind, index)
+    CLOSE_UPVALUE, // close the upvalues from A
+    RETURN,        // return RK(A)
+    THROW,         // throw RK(A)
+    YIELD,         // A = the value resumed with, yielding A
+    CLASS,         // A = class K(B)
+    INHERIT,       // copy methods of superclass A to class B
+    METHOD,        // add method RK(B) named K(C) to class A
+    TAIL_CALL,     // CALL and INVOKE in the caller's frame
+    TAIL_INVOKE,
+    EXTRA,         // operands of the instruction before
+};
+
+constexpr auto REGOP_COUNT = size_t(RegOp::EXTRA) + 1;
+
+constexpr uint16_t RK_CONSTANT = 0x8000;
+
+struct RegInstr {
+    RegOp    op;
+    uint16_t a{0};
+    uint16_t b{0};
+    uint16_t c{0};
+
+    // Jumps keep the signed offset in b and c, relative to the next instruction.
+    [[nodiscard]] constexpr int32_t offset() const {
+        return int32_t((uint32_t(b) << UINT16_WIDTH) | c);
+    }
+    constexpr void set_offset(int32_t o) {
+        b = uint16_t(uint32_t(o) >> UINT16_WIDTH);
+        c = uint16_t(uint32_t(o) & UINT16_MAX);
+    }
+};
+
+/**
+ * @brief A try block. An exception thrown by the instructions in [start, end) cuts the
+ * frame back to depth slots, pushes the exception and goes on at target. The offsets
+ * are of the stack code in a Chunk, of instructions in a RegisterChunk.
+ */
+struct ExceptionHandler {
+    size_t start;
+    size_t end;
+    size_t target;
+    int    depth;
+};
+
+// The innermost handler for the instruction at offset, nullptr if there is none.
+inline const ExceptionHandler *findHandler(const std::vector<ExceptionHandler> &handlers,
+                                           size_t offset) {
+    for (const ExceptionHandler &handler : handlers) {
+        if (handler.start <= offset && offset < handler.end) {
+            return &handler;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief The register code of a function, made from its stack code by RegisterGen.
+ */
+class RegisterChunk {
+  public:
+    size_t write(const RegInstr &instr, size_t line) {
+        code.push_back(instr);
+        lines.push_back(line);
+        return code.size() - 1;
+    }
+
+    [[nodiscard]] bool      empty() const { return code.empty(); }
+    [[nodiscard]] size_t    get_count() const { return code.size(); }
+    [[nodiscard]] size_t    get_line(size_t n) const { return lines[n]; }
+    [[nodiscard]] RegInstr &get_code(size_t n) { return code[n]; }
+    [[nodiscard]] RegInstr *get_code() { return code.data(); }
+
+    void add_handler(const ExceptionHandler &handler) { handlers.push_back(handler); }
+    [[nodiscard]] std::vector<ExceptionHandler> &get_handlers() { return handlers; }
+
+  private:
+    std::vector<RegInstr>         code;
+    std::vector<size_t>           lines;
+    std::vector<ExceptionHandler> handlers; // innermost first.
+};
+
+} // namespace alox
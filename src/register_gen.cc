@@ -0,0 +1,414 @@
+//
+// ALOX-CC
+//
+
+#include "register_gen.hh"
+
+namespace alox {
+
+constexpr auto MAX_CONSTANTS = UINT16_MAX;
+
+static bool isJump(OpCode op) {
+    return op == OpCode::JUMP || op == OpCode::JUMP_IF_FALSE || op == OpCode::LOOP;
+}
+
+/**
+ * @brief Translate the stack code, simulating the stack to know what is in each slot.
+ * At a jump target every value is in its slot, as at the ends of a try block and at its
+ * handler. Code that can't be reached is not translated.
+ */
+void RegisterGen::generate() {
+    const size_t count = chunk.get_count();
+
+    std::vector<bool> target(count + 1, false);
+    for (size_t i = 0; i < count; i += chunk.instruction_length(i)) {
+        if (isJump(OpCode(chunk.get_code(i)))) {
+            target[chunk.jump_target(i)] = true;
+        }
+    }
+    for (const ExceptionHandler &handler : chunk.get_handlers()) {
+        target[handler.start] = target[handler.end] = target[handler.target] = true;
+    }
+    depth = chunk.stack_depths(function->arity + 1);
+
+    // The function and its arguments.
+    stack.assign(function->arity + 1, {Entry::TEMP, 0});
+    start.assign(count + 1, 0);
+    bool fallthrough = true;
+    for (size_t i = 0; i < count; i += chunk.instruction_length(i)) {
+        if (depth[i] < 0) {
+            start[i] = code.get_count();
+            fallthrough = false;
+            continue;
+        }
+        line = chunk.get_line(i);
+        if (target[i]) {
+            if (fallthrough) {
+                materializeAll();
+            } else {
+                stack.assign(depth[i], {Entry::TEMP, 0});
+            }
+            result = NO_RESULT;
+        }
+        start[i] = code.get_count();
+        translate(i);
+        auto op = OpCode(chunk.get_code(i));
+        fallthrough = op != OpCode::JUMP && op != OpCode::LOOP && op != OpCode::RETURN &&
+                      op != OpCode::THROW;
+    }
+    start[count] = code.get_count();
+
+    for (auto [instr, to] : jumps) {
+        code.get_code(instr).set_offset(int32_t(start[to]) - int32_t(instr + 1));
+    }
+    for (const ExceptionHandler &handler : chunk.get_handlers()) {
+        code.add_handler({start[handler.start], start[handler.end], start[handler.target],
+                          handler.depth});
+    }
+}
+
+void RegisterGen::translate(size_t offset) {
+    auto byte = [this, offset](size_t n) { return chunk.get_code(offset + n); };
+    auto word = [this, offset](size_t n) {
+        return uint16_t((chunk.get_code(offset + n) << UINT8_WIDTH) |
+                        chunk.get_code(offset + n + 1));
+    };
+
+    const auto op = OpCode(chunk.get_code(offset));
+    switch (op) {
+    case OpCode::CONSTANT:
+        push(Entry::CONSTANT, word(1));
+        break;
+    case OpCode::NIL:
+    case OpCode::TRUE:
+    case OpCode::FALSE:
+    case OpCode::ZERO:
+    case OpCode::ONE:
+        push(Entry::CONSTANT, literal(op));
+        break;
+    case OpCode::POP:
+        pop();
+        break;
+    case OpCode::GET_LOCAL: {
+        const uint16_t local = byte(1);
+        materialize(local);
+        push(Entry::LOCAL, local);
+        break;
+    }
+    case OpCode::SET_LOCAL: {
+        const uint16_t local = byte(1);
+        bool           referenced = false;
+        for (size_t i = 0; i < top(); i++) {
+            referenced |= stack[i].kind == Entry::LOCAL && stack[i].index == local;
+        }
+        if (result != NO_RESULT && !referenced) {
+            // Write the result straight to the local.
+            code.get_code(result).a = local;
+            stack[top()] = {Entry::LOCAL, local};
+        } else {
+            materializeRefs(local);
+            emit({RegOp::MOVE, local, rk(top())});
+        }
+        stack[local] = {Entry::TEMP, 0};
+        break;
+    }
+    case OpCode::GET_GLOBAL:
+        emitTemp({RegOp::GET_GLOBAL, uint16_t(stack.size()), word(1)});
+        break;
+    case OpCode::DEFINE_GLOBAL:
+        emit({RegOp::DEFINE_GLOBAL, word(1), rk(top())});
+        pop();
+        break;
+    case OpCode::SET_GLOBAL:
+        emit({RegOp::SET_GLOBAL, word(1), rk(top())});
+        break;
+    case OpCode::GET_UPVALUE:
+        emitTemp({RegOp::GET_UPVALUE, uint16_t(stack.size()), byte(1)});
+        break;
+    case OpCode::SET_UPVALUE:
+        emit({RegOp::SET_UPVALUE, byte(1), rk(top())});
+        break;
+    case OpCode::GET_CAPTURED:
+        emitTemp({RegOp::GET_CAPTURED, uint16_t(stack.size()), byte(1)});
+        break;
+    case OpCode::GET_PROPERTY: {
+        const uint16_t object = reg(top());
+        pop();
+        const size_t get =
+            emit({RegOp::GET_PROPERTY, uint16_t(stack.size()), object, word(1)});
+        emit({RegOp::EXTRA, word(3)}); // cache
+        push(Entry::TEMP);
+        result = get;
+        break;
+    }
+    case OpCode::SET_PROPERTY: {
+        const uint16_t object = reg(top(1));
+        const uint16_t value = rk(top());
+        emit({RegOp::SET_PROPERTY, object, value, word(1)});
+        emit({RegOp::EXTRA, word(3)}); // cache
+        const Entry entry = stack[top()];
+        pop(2);
+        if (entry.kind == Entry::TEMP) {
+            emit({RegOp::MOVE, uint16_t(stack.size()), value});
+        }
+        push(entry.kind, entry.index);
+        break;
+    }
+    case OpCode::GET_SUPER: {
+        const uint16_t superclass = reg(top());
+        const uint16_t receiver = reg(top(1));
+        pop(2);
+        const size_t get =
+            emit({RegOp::GET_SUPER, uint16_t(stack.size()), receiver, superclass});
+        emit({RegOp::EXTRA, word(1)}); // name
+        push(Entry::TEMP);
+        result = get;
+        break;
+    }
+    case OpCode::EQUAL:
+    case OpCode::NOT_EQUAL:
+    case OpCode::GREATER:
+    case OpCode::NOT_GREATER:
+    case OpCode::LESS:
+    case OpCode::NOT_LESS:
+    case OpCode::ADD:
+    case OpCode::SUBTRACT:
+    case OpCode::MULTIPLY:
+    case OpCode::DIVIDE: {
+        const uint16_t right = rk(top());
+        const uint16_t left = rk(top(1));
+        pop(2);
+        static_assert(int(RegOp::DIVIDE) - int(RegOp::EQUAL) ==
+                      int(OpCode::DIVIDE) - int(OpCode::EQUAL));
+        const auto binary = RegOp(int(RegOp::EQUAL) + int(op) - int(OpCode::EQUAL));
+        emitTemp({binary, uint16_t(stack.size()), left, right});
+        break;
+    }
+    case OpCode::NOT:
+    case OpCode::NEGATE: {
+        const uint16_t operand = rk(top());
+        pop();
+        emitTemp({op == OpCode::NOT ? RegOp::NOT : RegOp::NEGATE, uint16_t(stack.size()),
+                  operand});
+        break;
+    }
+    case OpCode::PRINT:
+        emit({RegOp::PRINT, rk(top())});
+        pop();
+        break;
+    case OpCode::JUMP:
+        materializeAll();
+        emitJump(RegOp::JUMP, 0, offset);
+        break;
+    case OpCode::JUMP_IF_FALSE: {
+        // The condition is usually popped at the target, then it need not be in its slot.
+        const size_t to = chunk.jump_target(offset);
+        materializeAll(to < chunk.get_count() &&
+                       OpCode(chunk.get_code(to)) == OpCode::POP);
+        emitJump(RegOp::JUMP_IF_FALSE, rk(top()), offset);
+        break;
+    }
+    case OpCode::LOOP:
+        materializeAll();
+        emitJump(RegOp::JUMP, 0, offset);
+        break;
+    case OpCode::CALL:
+    case OpCode::TAIL_CALL: {
+        const uint16_t argCount = byte(1);
+        const RegOp    call = op == OpCode::CALL ? RegOp::CALL : RegOp::TAIL_CALL;
+        materializeAll();
+        emit({call, top(argCount), argCount});
+        pop(argCount + 1);
+        push(Entry::TEMP);
+        break;
+    }
+    case OpCode::CALL_DIRECT: {
+        const uint16_t argCount = byte(3);
+        materializeAll();
+        emit({RegOp::CALL_DIRECT, top(argCount), argCount, word(1)});
+        pop(argCount + 1);
+        push(Entry::TEMP);
+        break;
+    }
+    case OpCode::CLOCK:
+    case OpCode::GETC:
+    case OpCode::CHR:
+    case OpCode::ORD: {
+        // The arguments and the result in the registers of a call without the callee.
+        const auto arity = size_t(intrinsics[intrinsicIndex(op)].arity);
+        materializeAll();
+        emit({RegOp::INTRINSIC, uint16_t(stack.size() - arity), uint16_t(op), word(1)});
+        pop(arity);
+        push(Entry::TEMP);
+        break;
+    }
+    case OpCode::INVOKE:
+    case OpCode::TAIL_INVOKE: {
+        const uint16_t argCount = byte(5);
+        const RegOp    invoke = op == OpCode::INVOKE ? RegOp::INVOKE : RegOp::TAIL_INVOKE;
+        materializeAll();
+        emit({invoke, top(argCount), argCount, word(1)});
+        emit({RegOp::EXTRA, word(3)}); // cache
+        pop(argCount + 1);
+        push(Entry::TEMP);
+        break;
+    }
+    case OpCode::SUPER_INVOKE: {
+        const uint16_t argCount = byte(3);
+        materializeAll();
+        emit({RegOp::SUPER_INVOKE, top(argCount + 1), argCount, word(1)});
+        pop(argCount + 2);
+        push(Entry::TEMP);
+        break;
+    }
+    case OpCode::CLOSURE: {
+        materializeAll();
+        const size_t closure = emit({RegOp::CLOSURE, uint16_t(stack.size()), word(1)});
+        auto *inner = as<ObjFunction *>(chunk.get_value(word(1)));
+        for (int i = 0; i < inner->upvalueCount; i++) {
+            emit({RegOp::EXTRA, byte(3 + (2 * i)), byte(4 + (2 * i))}); // kind, index
+        }
+        push(Entry::TEMP);
+        result = closure;
+        break;
+    }
+    case OpCode::CLOSE_UPVALUE:
+        materialize(top());
+        emit({RegOp::CLOSE_UPVALUE, top()});
+        pop();
+        break;
+    case OpCode::RETURN:
+        emit({RegOp::RETURN, rk(top())});
+        pop();
+        break;
+    case OpCode::THROW:
+        emit({RegOp::THROW, rk(top())});
+        pop();
+        break;
+    case OpCode::YIELD:
+        // As for a call, the values can change before the coroutine is resumed.
+        materializeAll();
+        emit({RegOp::YIELD, top()});
+        pop();
+        push(Entry::TEMP);
+        break;
+    case OpCode::CLASS:
+        emitTemp({RegOp::CLASS, uint16_t(stack.size()), word(1)});
+        break;
+    case OpCode::INHERIT:
+        emit({RegOp::INHERIT, reg(top(1)), reg(top())});
+        pop();
+        break;
+    case OpCode::METHOD:
+        emit({RegOp::METHOD, reg(top(1)), rk(top()), word(1)});
+        pop();
+        break;
+    default:
+        // Superinstructions and quickened instructions are made after this.
+        break;
+    }
+}
+
+void RegisterGen::push(Entry::Kind kind, uint16_t index) {
+    stack.push_back({kind, index});
+    result = NO_RESULT;
+}
+
+void RegisterGen::pop(size_t n) {
+    stack.resize(stack.size() - n);
+    result = NO_RESULT;
+}
+
+size_t RegisterGen::emit(RegInstr instr) {
+    result = NO_RESULT;
+    return code.write(instr, line);
+}
+
+// Emit an instruction leaving its result in a new slot on top of the stack.
+void RegisterGen::emitTemp(RegInstr instr) {
+    const size_t n = emit(instr);
+    push(Entry::TEMP);
+    result = n;
+}
+
+void RegisterGen::emitJump(RegOp op, uint16_t a, size_t offset) {
+    jumps.emplace_back(emit({op, a}), chunk.jump_target(offset));
+}
+
+// The operand for the value in slot, a register or a constant.
+uint16_t RegisterGen::rk(uint16_t slot) {
+    const Entry &entry = stack[slot];
+    switch (entry.kind) {
+    case Entry::LOCAL:
+        return entry.index;
+    case Entry::CONSTANT:
+        if (entry.index < RK_CONSTANT) {
+            return entry.index | RK_CONSTANT;
+        }
+        materialize(slot);
+        return slot;
+    default:
+        return slot;
+    }
+}
+
+// The register with the value in slot.
+uint16_t RegisterGen::reg(uint16_t slot) {
+    if (stack[slot].kind == Entry::LOCAL) {
+        return stack[slot].index;
+    }
+    materialize(slot);
+    return slot;
+}
+
+// Copy the value in slot to its register.
+void RegisterGen::materialize(uint16_t slot) {
+    Entry &entry = stack[slot];
+    if (entry.kind == Entry::CONSTANT) {
+        if (entry.index < RK_CONSTANT) {
+            emit({RegOp::MOVE, slot, uint16_t(entry.index | RK_CONSTANT)});
+        } else {
+            emit({RegOp::LOADK, slot, entry.index});
+        }
+    } else if (entry.kind == Entry::LOCAL && entry.index != slot) {
+        emit({RegOp::MOVE, slot, entry.index});
+    }
+    entry = {Entry::TEMP, 0};
+}
+
+void RegisterGen::materializeAll(bool keepTop) {
+    const size_t n = keepTop ? stack.size() - 1 : stack.size();
+    for (size_t i = 0; i < n; i++) {
+        if (stack[i].kind != Entry::TEMP) {
+            materialize(i);
+        }
+    }
+}
+
+// Copy the values read from local before it is assigned.
+void RegisterGen::materializeRefs(uint16_t local) {
+    for (size_t i = 0; i < stack.size(); i++) {
+        if (stack[i].kind == Entry::LOCAL && stack[i].index == local) {
+            materialize(i);
+        }
+    }
+}
+
+// The constant for nil, true, false, 0 and 1, which have their own stack instructions.
+uint16_t RegisterGen::literal(OpCode op) {
+    int &index = literals[size_t(op) - size_t(OpCode::NIL)];
+    if (index >= 0) {
+        return index;
+    }
+    if (chunk.get_constants().get_count() >= MAX_CONSTANTS) {
+        err.errorAt(line, "Too many constants in one chunk.");
+        return 0;
+    }
+    static const std::array<Value, 5> values = {NIL_VAL, value<bool>(true),
+                                                value<bool>(false), value<double>(0),
+                                                value<double>(1)};
+    index = chunk.add_constant(values[size_t(op) - size_t(OpCode::NIL)]);
+    return index;
+}
+
+} // namespace alox
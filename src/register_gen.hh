@@ -0,0 +1,74 @@
+//
+// ALOX-CC
+//
+
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "chunk.hh"
+#include "error.hh"
+#include "object.hh"
+
+namespace alox {
+
+/**
+ * @brief Makes the register code of a chunk from its stack code.
+ *
+ * The stack slot at depth n is register n, so locals keep their slots. Pushes of locals
+ * and constants make no code, the instruction using the value reads the local or the
+ * constant directly. A value is only copied to its stack slot when it has to be there:
+ * for a call, at a jump, or before the local it refers to changes.
+ */
+class RegisterGen {
+  public:
+    RegisterGen(ObjFunction *function, ErrorManager &err)
+        : function(function), chunk(function->chunk), err(err){};
+
+    void generate();
+
+  private:
+    // A value on the simulated stack.
+    struct Entry {
+        enum Kind { TEMP, LOCAL, CONSTANT } kind;
+        uint16_t index; // LOCAL: register, CONSTANT: constant.
+    };
+
+    void translate(size_t offset);
+
+    size_t emit(RegInstr instr);
+    void   emitTemp(RegInstr instr);
+    void   emitJump(RegOp op, uint16_t a, size_t offset);
+
+    void     push(Entry::Kind kind, uint16_t index = 0);
+    void     pop(size_t n = 1);
+    uint16_t top(size_t distance = 0) const { return stack.size() - 1 - distance; }
+
+    uint16_t rk(uint16_t slot);
+    uint16_t reg(uint16_t slot);
+    void     materialize(uint16_t slot);
+    void     materializeAll(bool keepTop = false);
+    void     materializeRefs(uint16_t local);
+    uint16_t literal(OpCode op);
+
+    ObjFunction   *function;
+    Chunk         &chunk;
+    RegisterChunk &code{chunk.get_registers()};
+    ErrorManager  &err;
+
+    std::vector<Entry> stack;
+    std::array<int, 5> literals{-1, -1, -1, -1, -1}; // constants for NIL to ONE
+    size_t             line{0};
+
+    // The instruction whose result is on top of the stack, so SET_LOCAL can write it to
+    // the local instead.
+    static constexpr size_t NO_RESULT = SIZE_MAX;
+    size_t                  result{NO_RESULT};
+
+    std::vector<int>                       depth;  // of the stack at each offset
+    std::vector<size_t>                    start;  // register instruction of each offset
+    std::vector<std::pair<size_t, size_t>> jumps;  // register instruction, stack target
+};
+
+} // namespace alox
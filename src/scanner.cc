@@ -51,15 +51,17 @@ const std::map<Char, TokenType> single_tokens = {
     {'.', TokenType::DOT}};
 
 const std::map<std::string, TokenType> keyword_map = {
-    {"and", TokenType::AND},     {"break", TokenType::BREAK},
-    {"class", TokenType::CLASS}, {"continue", TokenType::CONTINUE},
-    {"else", TokenType::ELSE},   {"false", TokenType::FALSE},
-    {"for", TokenType::FOR},     {"fun", TokenType::FUN},
-    {"if", TokenType::IF},       {"nil", TokenType::NIL},
-    {"or", TokenType::OR},       {"return", TokenType::RETURN},
-    {"print", TokenType::PRINT}, {"super", TokenType::SUPER},
-    {"this", TokenType::THIS},   {"true", TokenType::TRUE},
-    {"var", TokenType::VAR},     {"while", TokenType::WHILE},
+    {"and", TokenType::AND},           {"break", TokenType::BREAK},
+    {"catch", TokenType::CATCH},       {"class", TokenType::CLASS},
+    {"continue", TokenType::CONTINUE}, {"else", TokenType::ELSE},
+    {"false", TokenType::FALSE},       {"for", TokenType::FOR},
+    {"fun", TokenType::FUN},           {"if", TokenType::IF},
+    {"nil", TokenType::NIL},           {"or", TokenType::OR},
+    {"return", TokenType::RETURN},     {"print", TokenType::PRINT},
+    {"super", TokenType::SUPER},       {"this", TokenType::THIS},
+    {"throw", TokenType::THROW},       {"true", TokenType::TRUE},
+    {"try", TokenType::TRY},           {"var", TokenType::VAR},
+    {"while", TokenType::WHILE},       {"yield", TokenType::YIELD},
 };
 
 Token Scanner::error_token(const char *message) const {
@@ -47,6 +47,7 @@ enum class TokenType {
     // Keywords.
     AND,
     BREAK,
+    CATCH,
     CLASS,
     CONTINUE,
     ELSE,
@@ -60,9 +61,12 @@ enum class TokenType {
     RETURN,
     SUPER,
     THIS,
+    THROW,
     TRUE,
+    TRY,
     VAR,
     WHILE,
+    YIELD,
 
     ERROR,
     EOFS
@@ -0,0 +1,68 @@
+//
+// ALOX-CC
+//
+
+#include "shape.hh"
+#include "object.hh"
+
+namespace alox {
+
+// The shapes of the transitions are this one's alone.
+Shape::~Shape() {
+    for (auto [key, shape] : transitions) {
+        delete shape;
+    }
+}
+
+int Shape::lookup(ObjString *name) {
+    if (slots == nullptr && count > SHAPE_LINEAR_LOOKUP) {
+        slots = std::make_unique<Slots>();
+        add_slots(*slots);
+    }
+    if (slots != nullptr) {
+        const auto slot = slots->find(name);
+        return slot != slots->end() ? slot->second : -1;
+    }
+    for (const Shape *shape = this; shape->parent != nullptr; shape = shape->parent) {
+        if (shape->name == name) {
+            return int(shape->count - 1);
+        }
+    }
+    return -1;
+}
+
+void Shape::add_slots(Slots &to) const {
+    for (const Shape *shape = this; shape->parent != nullptr; shape = shape->parent) {
+        to.emplace(shape->name, int(shape->count - 1));
+    }
+}
+
+Shape *Shape::transition(ObjString *name) {
+    if (dictionary) {
+        slots->emplace(name, int(count++));
+        return this;
+    }
+    if (count == SHAPE_MAX_FIELDS) {
+        auto *shape = new Shape();
+        shape->dictionary = true;
+        shape->slots = std::make_unique<Slots>();
+        add_slots(*shape->slots);
+        shape->count = count;
+        return shape->transition(name);
+    }
+
+    for (auto [key, shape] : transitions) {
+        if (key == name) {
+            return shape;
+        }
+    }
+
+    auto *shape = new Shape();
+    shape->parent = this;
+    shape->name = name;
+    shape->count = count + 1;
+    transitions.emplace_back(name, shape);
+    return shape;
+}
+
+} // namespace alox
@@ -0,0 +1,62 @@
+//
+// ALOX-CC
+//
+
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common.hh"
+#include "value.hh"
+
+namespace alox {
+
+// An instance past this many fields leaves the transition tree for a shape of its own.
+constexpr size_t SHAPE_MAX_FIELDS = 64;
+
+// A shape with up to this many fields is looked up by walking to the root.
+constexpr size_t SHAPE_LINEAR_LOOKUP = 8;
+
+/**
+ * @brief Hidden class for instances. A shape maps field names to slot indices and is
+ * shared by all instances which had the same fields added in the same order. Adding a
+ * field moves an instance to a child shape in a transition tree rooted at its class.
+ * Each shape keeps only the field it added, the slots of the others are found through
+ * its parent. An instance given more than SHAPE_MAX_FIELDS fields moves to a dictionary
+ * shape, which is its alone and to which fields are added in place.
+ */
+class Shape {
+  public:
+    Shape() = default;
+    ~Shape();
+    Shape(const Shape &) = delete;
+
+    // Slot of the field, or -1 if the shape does not have it.
+    [[nodiscard]] int lookup(ObjString *name);
+
+    // The shape with name added as the next slot, shared with earlier transitions. A
+    // dictionary shape is returned with the field added, and a new one past
+    // SHAPE_MAX_FIELDS, which the instance moving to it owns.
+    Shape *transition(ObjString *name);
+
+    [[nodiscard]] constexpr size_t get_count() const { return count; }
+    [[nodiscard]] constexpr bool   is_dictionary() const { return dictionary; }
+
+  private:
+    using Slots = std::unordered_map<const ObjString *, int>;
+
+    void add_slots(Slots &to) const;
+
+    Shape     *parent{};
+    ObjString *name{}; // the field added to the parent, in slot count - 1.
+    size_t     count{0};
+    bool       dictionary{false};
+    // By name, made when a shape past SHAPE_LINEAR_LOOKUP is first looked up.
+    std::unique_ptr<Slots>                       slots;
+    std::vector<std::pair<ObjString *, Shape *>> transitions;
+};
+
+} // namespace alox
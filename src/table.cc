@@ -29,7 +29,7 @@ Entry *findEntry(Entry *entries, size_t capacity, ObjString *key) {
                 tombstone = entry;
             }
 
-        } else if (entry->key->str == key->str) {
+        } else if (stringsEqual(entry->key, key)) {
             // We found the key.
             return entry;
         }
@@ -38,6 +38,10 @@ Entry *findEntry(Entry *entries, size_t capacity, ObjString *key) {
     }
 }
 
+Table::~Table() {
+    delete[] entries;
+}
+
 bool Table::get(ObjString *key, Value *value) {
     if (this->count == 0) {
         return false;
@@ -111,6 +115,28 @@ bool Table::del(ObjString *key) {
     return true;
 }
 
+ObjString *Table::findString(const std::string_view &chars, uint32_t hash) {
+    if (this->count == 0) {
+        return nullptr;
+    }
+
+    uint32_t index = hash & (this->capacity - 1);
+    for (;;) {
+        Entry *entry = &this->entries[index];
+        if (entry->key == nullptr) {
+            // Stop if we find an empty non-tombstone entry.
+            if (is<nullptr_t>(entry->value)) {
+                return nullptr;
+            }
+        } else if (entry->key->hash == hash && entry->key->str == chars) {
+            // We found it.
+            return entry->key;
+        }
+
+        index = (index + 1) & (this->capacity - 1);
+    }
+}
+
 void Table::addAll(const Table &from, Table &to) {
     for (int i = 0; i < from.capacity; i++) {
         Entry *entry = &from.entries[i];
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <string_view>
+
 #include "common.hh"
 #include "value.hh"
 
@@ -21,6 +23,7 @@ struct Entry {
 class Table {
   public:
     Table() = default;
+    ~Table();
 
     Table(const Table &) = delete;
 
@@ -29,6 +32,9 @@ class Table {
     bool        del(ObjString *key);
     static void addAll(const Table &from, Table &to);
 
+    // The key with these contents, for interning strings.
+    ObjString *findString(const std::string_view &chars, uint32_t hash);
+
   private:
     void adjustCapacity(size_t capacity);
 
@@ -20,6 +20,8 @@ class ValueArray {
     size_t write(const Value &value);
 
     [[nodiscard]] constexpr Value &get_value(size_t n) { return values[n]; }
+    [[nodiscard]] constexpr Value *get_values() { return values.data(); }
+    [[nodiscard]] constexpr size_t get_count() const { return values.size(); }
 
   private:
     std::vector<Value> values{};
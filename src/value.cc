@@ -46,11 +46,11 @@ bool valuesEqual(Value a, Value b) {
     if (is<double>(a) && is<double>(b)) {
         return as<double>(a) == as<double>(b);
     }
-    if (is<ObjString>(a) && is<ObjString>(b)) {
-        // fmt::print("{:d} {:d}\n", AS_STRING(a)->str.size(), AS_STRING(b)->str.size());
-        return as<ObjString *>(a)->str == as<ObjString *>(b)->str;
+    if (a == b) {
+        return true;
     }
-    return a == b;
+    return is<ObjString>(a) && is<ObjString>(b) &&
+           stringsEqual(as<ObjString *>(a), as<ObjString *>(b));
 #else
     if (a.type != b.type) {
         return false;
@@ -62,12 +62,10 @@ bool valuesEqual(Value a, Value b) {
         return true;
     case VAL_NUMBER:
         return AS_NUMBER(a) == AS_NUMBER(b);
-    case VAL_OBJ: {
-        if (IS_STRING(a) && IS_STRING(b)) {
-            return AS_STRING(a)->str == AS_STRING(b)->str;
-        }
-        return AS_OBJ(a) == AS_OBJ(b);
-    }
+    case VAL_OBJ:
+        return AS_OBJ(a) == AS_OBJ(b) ||
+               (is<ObjString>(a) && is<ObjString>(b) &&
+                stringsEqual(as<ObjString *>(a), as<ObjString *>(b)));
     default:
         return false; // Unreachable.
     }
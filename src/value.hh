@@ -20,15 +20,18 @@ class Obj;
 constexpr uint64_t SIGN_BIT = ((uint64_t)0x8000000000000000);
 constexpr uint64_t QNAN = ((uint64_t)0x7ffc000000000000);
 
-constexpr auto TAG_NIL = 1;   // 01.
-constexpr auto TAG_FALSE = 2; // 10.
-constexpr auto TAG_TRUE = 3;  // 11.
+constexpr auto TAG_NIL = 1;       // 01.
+constexpr auto TAG_FALSE = 2;     // 10.
+constexpr auto TAG_TRUE = 3;      // 11.
+constexpr auto TAG_UNDEFINED = 4; // 100.
 
 using Value = uint64_t;
 
 constexpr Value FALSE_VAL = ((Value)(uint64_t)(QNAN | TAG_FALSE));
 constexpr Value TRUE_VAL = ((Value)(uint64_t)(QNAN | TAG_TRUE));
 constexpr Value NIL_VAL = ((Value)(uint64_t)(QNAN | TAG_NIL));
+// Not a Lox value, marks a global which has a slot but is not defined yet.
+constexpr Value UNDEFINED_VAL = ((Value)(uint64_t)(QNAN | TAG_UNDEFINED));
 
 template <typename T> bool is(Value value);
 
@@ -2,15 +2,20 @@
 // ALOX-CC
 //
 
+#include <algorithm>
+#include <bit>
 #include <cstdarg>
 #include <cstdio>
 #include <ctime>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <sstream>
 
 #include <fmt/core.h>
 #include <memory>
 
+#include "aot.hh"
 #include "common.hh"
 #include "compiler.hh"
 #include "debug.hh"
@@ -29,29 +34,81 @@ static void debug(const S &format, const Args &...msg) {
     }
 }
 
-constexpr auto DEBUG_TRACE_EXECUTION{true};
-
 void VM::resetStack() {
-    stackTop = stack;
+    // The coroutines an error passes through are done, and their stacks freed.
+    while (running != nullptr) {
+        closeUpvalues(stack.data());
+        leaveCoroutine(true);
+    }
+    // Closed, as growStack() only moves the upvalues still open.
+    closeUpvalues(stack.data());
+    stackTop = stack.data();
     frameCount = 0;
-    openUpvalues = nullptr;
 }
 
+// Moves the stack to a bigger one, and the pointers into it with it.
+void VM::growStack(size_t size) {
+    Value *const from = stack.data();
+    stack.resize(std::bit_ceil(size));
+    auto move = [from, to = stack.data()](Value *&slot) { slot = to + (slot - from); };
+    move(stackTop);
+    for (int i = 0; i < frameCount; i++) {
+        move(frames[i].slots);
+    }
+    for (ObjUpvalue *open = openUpvalues; open != nullptr; open = open->next) {
+        move(open->location);
+    }
+}
+
+// The error is thrown as its message, and only reported if no try block catches it.
 template <typename... T> void VM::runtimeError(const char *format, const T &...msg) {
-    options.err << fmt::format(fmt::runtime(format), msg...); // NOLINT
-    options.err << '\n';
+    const std::string message = fmt::format(fmt::runtime(format), msg...); // NOLINT
+    if (throwValue(value<Obj *>(newString(message)))) {
+        restart = true;
+        return;
+    }
+    reportError(message);
+}
 
-    for (int i = frameCount - 1; i >= 0; i--) {
-        CallFrame   *frame = &frames[i];
-        ObjFunction *function = frame->closure->function;
-        const size_t instruction = frame->ip - function->chunk.get_code() - 1;
-        options.err << fmt::format("[line {:d}] in ", // [minus]
-                                   function->chunk.get_line(instruction));
-        if (function->name == nullptr) {
-            options.err << "script\n";
-        } else {
-            options.err << fmt::format("{}()\n", function->name->str);
+void VM::reportError(const std::string &message) {
+    options.err << message << '\n';
+
+    // The frames of each resumer are in the stacks of the coroutine it resumed.
+    int  printed = 0;
+    int  skipped = 0;
+    auto trace = [this, &printed, &skipped](const std::vector<CallFrame> &stackFrames,
+                                            int                            count) {
+        for (int i = count - 1; i >= 0; i--) {
+            if (printed == TRACE_FRAMES) {
+                skipped += i + 1;
+                return;
+            }
+            printed++;
+            const CallFrame *frame = &stackFrames[i];
+            ObjFunction     *function = frame->closure->function;
+            size_t           line = 0;
+            if (running_registers) {
+                RegisterChunk &registers = function->chunk.get_registers();
+                line = registers.get_line(frame->pc - registers.get_code() - 1);
+            } else {
+                Chunk &chunk = function->chunk;
+                line = chunk.get_line(frame->ip - chunk.get_code() - 1);
+            }
+            options.err << fmt::format("[line {:d}] in ", line); // [minus]
+            if (function->name == nullptr) {
+                options.err << "script\n";
+            } else {
+                options.err << fmt::format("{}()\n", function->name->str);
+            }
         }
+    };
+    trace(frames, frameCount);
+    for (ObjCoroutine *coroutine = running; coroutine != nullptr;
+         coroutine = coroutine->resumer) {
+        trace(coroutine->stacks->frames, coroutine->stacks->frameCount);
+    }
+    if (skipped > 0) {
+        options.err << fmt::format("... {:d} more frames\n", skipped);
     }
 
     resetStack();
@@ -60,57 +117,167 @@ template <typename... T> void VM::runtimeError(const char *format, const T &...m
     }
 }
 
+// THROW with no try block to catch the exception.
+void VM::uncaught(Value exception) {
+    std::ostringstream os;
+    printValue(os, exception);
+    reportError("Uncaught exception: " + os.str());
+}
+
+// The innermost try block around the instruction the frame is at, or nullptr.
+const ExceptionHandler *VM::frameHandler(const CallFrame &frame) const {
+    Chunk         &chunk = frame.closure->function->chunk;
+    RegisterChunk &registers = chunk.get_registers();
+    // A frame is past the opcode of its instruction, unless it hasn't started.
+    if (running_registers && frame.pc > registers.get_code()) {
+        return findHandler(registers.get_handlers(),
+                           size_t(frame.pc - registers.get_code() - 1));
+    }
+    if (!running_registers && frame.ip > chunk.get_code()) {
+        return findHandler(chunk.get_handlers(), size_t(frame.ip - chunk.get_code() - 1));
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Unwind the frames to the innermost try block around the instruction a frame is
+ * at, found in the handler table of its function. The handler's frame is cut back to
+ * the depth of the try statement, with the exception pushed, and goes on at the handler.
+ * The coroutines between are done, and the search goes on in the frames of their
+ * resumers. Returns false, changing nothing, if no try block catches the exception.
+ */
+bool VM::throwValue(Value exception) {
+    const std::vector<CallFrame> *stackFrames = &frames;
+    int                           count = frameCount;
+    int                           leave = 0;
+    const ExceptionHandler       *handler = nullptr;
+    for (ObjCoroutine *coroutine = running;; coroutine = coroutine->resumer) {
+        while (count > 0 && handler == nullptr) {
+            handler = frameHandler((*stackFrames)[--count]);
+        }
+        if (handler != nullptr || coroutine == nullptr) {
+            break;
+        }
+        stackFrames = &coroutine->stacks->frames;
+        count = coroutine->stacks->frameCount;
+        leave++;
+    }
+    if (handler == nullptr) {
+        return false;
+    }
+    for (; leave > 0; leave--) {
+        closeUpvalues(stack.data());
+        leaveCoroutine(true);
+    }
+
+    CallFrame *frame = &frames[count];
+    Chunk     &chunk = frame->closure->function->chunk;
+    Value     *base = frame->slots + handler->depth;
+    closeUpvalues(base);
+    *base = exception;
+    stackTop = base + 1;
+    frameCount = count + 1;
+    if (running_registers) {
+        frame->pc = chunk.get_registers().get_code() + handler->target;
+    } else {
+        frame->ip = chunk.get_code() + handler->target;
+    }
+    return true;
+}
+
 // Not necessarily fast with optimised code
 // #define push(value)    (*stackTop = (value), stackTop++)
 // #define pop()          (stackTop--, *stackTop)
 // #define peek(distance) (stackTop[-1 - (distance)])
 
 void VM::init() {
+    const Heap::Scope scope(heap);
     resetStack();
 
     initString = newString("init");
 
     // these are defined before the compiler starts
     def_stdlib();
+
+    if (JIT_AVAILABLE && options.jit && !options.registers) {
+        jit = std::make_unique<Jit>(jitHandlers(), globals);
+    }
 }
 
 void VM::free() {
     initString = nullptr;
 }
 
-bool VM::call(ObjClosure *closure, int argCount) {
+template <ExecutionPolicy P>
+bool VM::call(P &policy, ObjClosure *closure, int argCount, bool tail) {
     if (argCount != closure->function->arity) {
         runtimeError("Expected {:d} arguments but got {:d}.", closure->function->arity,
                      argCount);
         return false;
     }
+    return pushFrame(policy, closure, argCount, tail);
+}
+
+// call() without the arity check.
+template <ExecutionPolicy P>
+bool VM::pushFrame(P &policy, ObjClosure *closure, int argCount, bool tail) {
+    if (tail) {
+        // The caller returns now: the callee and its arguments move down to its slots.
+        CallFrame *caller = &frames[frameCount - 1];
+        if constexpr (P::enabled) {
+            policy.onReturn(caller->closure);
+        }
+        closeUpvalues(caller->slots);
+        stackTop = std::copy(stackTop - argCount - 1, stackTop, caller->slots);
+        frameCount--;
+    }
 
-    if (frameCount == FRAMES_MAX) {
+    if (frameCount == int(options.max_frames)) {
         runtimeError("Stack overflow.");
         return false;
     }
+    if (frameCount == int(frames.size())) {
+        frames.resize(frames.size() * 2);
+    }
+    // Room for the callee's slots and the values it pushes.
+    const size_t end =
+        stackTop - stack.data() - argCount - 1 + closure->function->maxStack;
+    if (end > stack.size()) {
+        growStack(end);
+    }
 
     CallFrame *frame = &frames[frameCount++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.get_code();
+    frame->pc = closure->function->chunk.get_registers().get_code();
     frame->slots = stackTop - argCount - 1;
+    if constexpr (P::enabled) {
+        policy.onCall(closure);
+    }
+    if constexpr (std::is_same_v<P, PlainPolicy>) {
+        countHot(closure->function);
+    }
     return true;
 }
 
-bool VM::callValue(Value callee, int argCount) {
+template <ExecutionPolicy P>
+bool VM::callValue(P &policy, Value callee, int argCount, bool tail) {
     if (is<Obj>(callee)) {
         switch (obj_type(callee)) {
         case OBJ_BOUND_METHOD: {
             ObjBoundMethod *bound = as<ObjBoundMethod *>(callee);
             stackTop[-argCount - 1] = bound->receiver;
-            return call(bound->method, argCount);
+            return call(policy, bound->method, argCount, tail);
         }
         case OBJ_CLASS: {
-            ObjClass *klass = as<ObjClass *>(callee);
-            stackTop[-argCount - 1] = value<Obj *>(newInstance(klass));
-            Value initializer;
-            if (klass->methods.get(initString, &initializer)) {
-                return call(as<ObjClosure *>(initializer), argCount);
+            ObjClass    *klass = as<ObjClass *>(callee);
+            ObjInstance *instance = newInstance(klass);
+            if constexpr (P::enabled) {
+                policy.onAllocate(instance);
+            }
+            stackTop[-argCount - 1] = value<Obj *>(instance);
+            if (klass->initializer != nullptr) {
+                return call(policy, klass->initializer, argCount);
             }
             if (argCount != 0) {
                 runtimeError("Expected 0 arguments but got {:d}.", argCount);
@@ -119,8 +286,16 @@ bool VM::callValue(Value callee, int argCount) {
             return true;
         }
         case OBJ_CLOSURE:
-            return call(as<ObjClosure *>(callee), argCount);
+            return call(policy, as<ObjClosure *>(callee), argCount, tail);
+        case OBJ_COROUTINE:
+            return resume(policy, as<ObjCoroutine *>(callee), argCount);
         case OBJ_NATIVE: {
+            ObjNative *const vmNative = as<ObjNative *>(callee);
+            if (vmNative->vmFunction != nullptr) {
+                // Where a task that waits finds the native to call again.
+                stackTop[-argCount - 1] = callee;
+                return vmNative->vmFunction(*this, argCount);
+            }
             NativeFn    native = as<NativeFn>(callee);
             const Value result = native(argCount, stackTop - argCount);
             stackTop -= argCount + 1;
@@ -135,16 +310,273 @@ bool VM::callValue(Value callee, int argCount) {
     return false;
 }
 
-bool VM::invokeFromClass(ObjClass *klass, ObjString *name, int argCount) {
-    Value method;
-    if (!klass->methods.get(name, &method)) {
+/**
+ * @brief A call of a coroutine: it runs on its own stacks until it yields or returns,
+ * when the value is the result of the call. The first call passes its arguments to the
+ * coroutine's function, a later one at most one, the value of the yield it is at.
+ */
+template <ExecutionPolicy P>
+bool VM::resume(P &policy, ObjCoroutine *coroutine, int argCount) {
+    using enum ObjCoroutine::State;
+    if (coroutine->task) {
+        runtimeError("Can't resume a task.");
+        return false;
+    }
+    if (coroutine->state != Suspended) {
+        runtimeError(coroutine->state == Done ? "Can't resume a finished coroutine."
+                                              : "Can't resume a running coroutine.");
+        return false;
+    }
+    const bool start = coroutine->stacks == nullptr;
+    if (start) {
+        if (!is<ObjClosure>(coroutine->function)) {
+            runtimeError("A coroutine must be made of a function.");
+            return false;
+        }
+        const int arity = as<ObjClosure *>(coroutine->function)->function->arity;
+        if (argCount != arity) {
+            runtimeError("Expected {:d} arguments but got {:d}.", arity, argCount);
+            return false;
+        }
+        coroutine->stacks = new CoroutineStacks();
+    } else if (argCount > 1) {
+        runtimeError("Expected 0 or 1 arguments but got {:d}.", argCount);
+        return false;
+    }
+
+    // The result goes in the callee's slot.
+    Value *args = stackTop - argCount;
+    stackTop = args - 1;
+    enterCoroutine(coroutine);
+    if (!start) {
+        stackTop[-1] = argCount == 1 ? args[0] : NIL_VAL;
+        return true;
+    }
+    push(coroutine->function);
+    for (int i = 0; i < argCount; i++) {
+        push(args[i]);
+    }
+    return pushFrame(policy, as<ObjClosure *>(coroutine->function), argCount, false);
+}
+
+void VM::enterCoroutine(ObjCoroutine *coroutine) {
+    swapStacks(*coroutine->stacks);
+    coroutine->resumer = running;
+    coroutine->state = ObjCoroutine::State::Running;
+    running = coroutine;
+}
+
+// Back to the stacks of the running coroutine's resumer. A coroutine that is done has
+// no more use for its own.
+void VM::leaveCoroutine(bool done) {
+    ObjCoroutine *coroutine = running;
+    swapStacks(*coroutine->stacks);
+    running = coroutine->resumer;
+    coroutine->resumer = nullptr;
+    coroutine->state = ObjCoroutine::State::Suspended;
+    if (done) {
+        coroutine->state = ObjCoroutine::State::Done;
+        delete coroutine->stacks;
+        coroutine->stacks = nullptr;
+    }
+}
+
+void VM::swapStacks(CoroutineStacks &other) {
+    std::swap(frames, other.frames);
+    std::swap(frameCount, other.frameCount);
+    std::swap(stack, other.stack);
+    std::swap(stackTop, other.stackTop);
+    std::swap(openUpvalues, other.openUpvalues);
+}
+
+/**
+ * @brief The running coroutine yields result, or returns it if done. A coroutine's
+ * resumer gets the result, while a task's turn passes to the next task. Returns false
+ * on a runtime error in the task run next.
+ */
+bool VM::suspend(Value result, bool done) {
+    ObjCoroutine *const coroutine = running;
+    leaveCoroutine(done);
+    if (!coroutine->task) {
+        push(result);
+        return true;
+    }
+    if (!done) {
+        loop.add(coroutine);
+    }
+    return schedule();
+}
+
+/**
+ * @brief Run the next task of the event loop, waiting for one to be ready if need be. A
+ * task that waited on a descriptor calls its native again. Once there are no tasks left
+ * the call of run() that started them returns nil.
+ */
+bool VM::schedule() {
+    const EventLoop::Ready next = loop.next();
+    ObjCoroutine *const    task = next.task;
+    if (task == nullptr) {
+        push(NIL_VAL);
+        return true;
+    }
+    const bool start = task->stacks == nullptr;
+    if (start) {
+        task->stacks = new CoroutineStacks();
+    }
+    enterCoroutine(task);
+    if (start) {
+        PlainPolicy policy;
+        push(task->function);
+        return pushFrame(policy, as<ObjClosure *>(task->function), 0, false);
+    }
+    if (next.retry != nullptr) {
+        return next.retry(*this, next.argCount);
+    }
+    stackTop[-1] = next.result;
+    return true;
+}
+
+/**
+ * @brief A VmNativeFn that would block on fd. A task waits for fd with the native's
+ * call left on its stack, and the next task runs. Elsewhere the VM waits. The native is
+ * called again once fd is ready.
+ */
+bool VM::wait(int argCount, int fd, EventLoop::Event event) {
+    const VmNativeFn retry = as<ObjNative *>(stackTop[-argCount - 1])->vmFunction;
+    if (running == nullptr || !running->task) {
+        EventLoop::block(fd, event);
+        return retry(*this, argCount);
+    }
+    loop.wait(running, fd, event, retry, argCount);
+    leaveCoroutine(false);
+    return schedule();
+}
+
+bool VM::nativeResult(int argCount, Value result) {
+    stackTop -= argCount + 1;
+    push(result);
+    return true;
+}
+
+bool VM::nativeError(const std::string &message) {
+    runtimeError("{}", message);
+    return false;
+}
+
+/**
+ * @brief CALL_DIRECT of the global function in slot, whose closure the compiler put in
+ * the callee's slot with the arity checked. If the global holds another value, defined
+ * again in the REPL or not yet defined, it is called as CALL would.
+ */
+template <ExecutionPolicy P>
+bool VM::callDirect(P &policy, global_index_t slot, int argCount) {
+    Value      *callee = stackTop - argCount - 1;
+    const Value global = globals.get_value(slot);
+    if (global == *callee) [[likely]] {
+        return pushFrame(policy, as<ObjClosure *>(global), argCount, false);
+    }
+    if (global == UNDEFINED_VAL) {
+        runtimeError("Undefined variable '{}'.", globals.get_name(slot)->str);
+        return false;
+    }
+    *callee = global;
+    return callValue(policy, global, argCount);
+}
+
+/**
+ * @brief The native of an intrinsic opcode on the arguments from args, with their types
+ * checked. The result replaces the first argument, or goes at args for none.
+ */
+template <OpCode op> bool VM::intrinsic(Value *args) {
+    if constexpr (op == OpCode::CLOCK) {
+        args[0] = value<double>(double(clock()) / CLOCKS_PER_SEC);
+    } else if constexpr (op == OpCode::GETC) {
+        args[0] = value<double>(std::getc(stdin));
+    } else if constexpr (op == OpCode::CHR) {
+        if (!is<double>(args[0])) {
+            runtimeError("Argument to chr must be a number.");
+            return false;
+        }
+        const double n = as<double>(args[0]);
+        if (!(n >= 0 && n <= UINT8_MAX)) {
+            runtimeError("Argument to chr must be from 0 to 255.");
+            return false;
+        }
+        const auto ch = uint8_t(n);
+        if (characters[ch] == nullptr) {
+            characters[ch] = newString(std::string(1, char(ch)));
+        }
+        args[0] = value<Obj *>(characters[ch]);
+    } else {
+        static_assert(op == OpCode::ORD);
+        if (!is<ObjString>(args[0])) {
+            runtimeError("Argument to ord must be a string.");
+            return false;
+        }
+        const std::string &str = as<ObjString *>(args[0])->str;
+        if (str.empty()) {
+            runtimeError("Argument to ord must not be empty.");
+            return false;
+        }
+        args[0] = value<double>(uint8_t(str[0]));
+    }
+    return true;
+}
+
+bool VM::intrinsic(OpCode op, Value *args) {
+    switch (op) {
+    case OpCode::CLOCK:
+        return intrinsic<OpCode::CLOCK>(args);
+    case OpCode::GETC:
+        return intrinsic<OpCode::GETC>(args);
+    case OpCode::CHR:
+        return intrinsic<OpCode::CHR>(args);
+    default:
+        return intrinsic<OpCode::ORD>(args);
+    }
+}
+
+/**
+ * @brief An intrinsic opcode, with its arguments on the stack. If the global of the
+ * native holds another value, defined again in the REPL, that is called as CALL would.
+ */
+template <ExecutionPolicy P>
+bool VM::callIntrinsic(P &policy, OpCode op, global_index_t slot) {
+    const int   arity = intrinsics[intrinsicIndex(op)].arity;
+    const Value global = globals.get_value(slot);
+    if (global == natives[intrinsicIndex(op)]) [[likely]] {
+        if (!intrinsic(op, stackTop - arity)) {
+            return false;
+        }
+        stackTop += 1 - arity;
+        return true;
+    }
+    if (global == UNDEFINED_VAL) {
+        runtimeError("Undefined variable '{}'.", globals.get_name(slot)->str);
+        return false;
+    }
+    // The callee goes below the arguments.
+    if (stackTop == stack.data() + stack.size()) {
+        growStack(stack.size() + 1);
+    }
+    std::copy_backward(stackTop - arity, stackTop, stackTop + 1);
+    stackTop[-arity] = global;
+    stackTop++;
+    return callValue(policy, global, arity);
+}
+
+template <ExecutionPolicy P>
+bool VM::invokeFromClass(P &policy, ObjClass *klass, ObjString *name, int argCount) {
+    ObjClosure *method = klass->find_method(name);
+    if (method == nullptr) {
         runtimeError("Undefined property '{}'.", name->str);
         return false;
     }
-    return call(as<ObjClosure *>(method), argCount);
+    return call(policy, method, argCount);
 }
 
-bool VM::invoke(ObjString *name, int argCount) {
+template <ExecutionPolicy P>
+bool VM::invoke(P &policy, ObjString *name, int argCount, InlineCache &cache, bool tail) {
     const Value receiver = peek(argCount);
 
     if (!is<ObjInstance>(receiver)) {
@@ -153,30 +585,127 @@ bool VM::invoke(ObjString *name, int argCount) {
     }
 
     ObjInstance *instance = as<ObjInstance *>(receiver);
+    ObjClass    *klass = instance->klass;
+
+    if (const CacheEntry *entry = cache.find(instance->shape, klass->version)) {
+        if (entry->method != nullptr) {
+            return call(policy, entry->method, argCount, tail);
+        }
+        const Value value = instance->fields[entry->slot];
+        stackTop[-argCount - 1] = value;
+        return callValue(policy, value, argCount, tail);
+    }
 
-    Value value;
-    if (instance->fields.get(name, &value)) {
+    const int slot = instance->shape->lookup(name);
+    if (slot >= 0) {
+        cache.add({.shape = instance->shape, .slot = slot});
+        const Value value = instance->fields[slot];
         stackTop[-argCount - 1] = value;
-        return callValue(value, argCount);
+        return callValue(policy, value, argCount, tail);
     }
 
-    return invokeFromClass(instance->klass, name, argCount);
+    ObjClosure *method = klass->find_method(name);
+    if (method == nullptr) {
+        runtimeError("Undefined property '{}'.", name->str);
+        return false;
+    }
+    // A field of that name can still be added to a dictionary shape.
+    if (!instance->shape->is_dictionary()) {
+        cache.add(
+            {.shape = instance->shape, .version = klass->version, .method = method});
+    }
+    return call(policy, method, argCount, tail);
 }
 
-bool VM::bindMethod(ObjClass *klass, ObjString *name) {
-    Value method;
-    if (!klass->methods.get(name, &method)) {
+template <ExecutionPolicy P>
+bool VM::bindMethod(P &policy, ObjClass *klass, ObjString *name) {
+    ObjClosure *method = klass->find_method(name);
+    if (method == nullptr) {
         runtimeError("Undefined property '{}'.", name->str);
         return false;
     }
 
-    ObjBoundMethod *bound = newBoundMethod(peek(0), as<ObjClosure *>(method));
-    pop();
-    push(value<Obj *>(bound));
+    stackTop[-1] = bindMethod(policy, peek(0), method);
+    return true;
+}
+
+template <ExecutionPolicy P>
+Value VM::bindMethod(P &policy, Value receiver, ObjClosure *method) {
+    ObjBoundMethod *bound = newBoundMethod(receiver, method);
+    if constexpr (P::enabled) {
+        policy.onAllocate(bound);
+    }
+    return value<Obj *>(bound);
+}
+
+template <ExecutionPolicy P>
+bool VM::getProperty(P &policy, Value receiver, ObjString *name, InlineCache &cache,
+                     Value &result) {
+    if (!is<ObjInstance>(receiver)) {
+        runtimeError("Only instances have properties.");
+        return false;
+    }
+
+    ObjInstance *instance = as<ObjInstance *>(receiver);
+    ObjClass    *klass = instance->klass;
+
+    if (const CacheEntry *entry = cache.find(instance->shape, klass->version)) {
+        if (entry->method != nullptr) {
+            result = bindMethod(policy, receiver, entry->method);
+        } else {
+            result = instance->fields[entry->slot];
+        }
+        return true;
+    }
+
+    const int slot = instance->shape->lookup(name);
+    if (slot >= 0) {
+        cache.add({.shape = instance->shape, .slot = slot});
+        result = instance->fields[slot];
+        return true;
+    }
+
+    ObjClosure *method = klass->find_method(name);
+    if (method == nullptr) {
+        runtimeError("Undefined property '{}'.", name->str);
+        return false;
+    }
+    // A field of that name can still be added to a dictionary shape.
+    if (!instance->shape->is_dictionary()) {
+        cache.add(
+            {.shape = instance->shape, .version = klass->version, .method = method});
+    }
+    result = bindMethod(policy, receiver, method);
     return true;
 }
 
-ObjUpvalue *VM::captureUpvalue(Value *local) {
+bool VM::setProperty(Value receiver, ObjString *name, InlineCache &cache, Value value) {
+    if (!is<ObjInstance>(receiver)) {
+        runtimeError("Only instances have fields.");
+        return false;
+    }
+
+    ObjInstance *instance = as<ObjInstance *>(receiver);
+    if (const CacheEntry *entry = cache.find(instance->shape, 0)) {
+        instance->set_slot(entry->next, entry->slot, value);
+        return true;
+    }
+    Shape *shape = instance->shape;
+    int    slot = shape->lookup(name);
+    Shape *next = shape;
+    if (slot < 0) {
+        next = shape->transition(name);
+        slot = int(next->get_count() - 1);
+    }
+    // A dictionary shape is the instance's own, so others can't be moved to it.
+    if (next == shape || !next->is_dictionary()) {
+        cache.add({.shape = shape, .next = next, .slot = slot});
+    }
+    instance->set_slot(next, slot, value);
+    return true;
+}
+
+template <ExecutionPolicy P> ObjUpvalue *VM::captureUpvalue(P &policy, Value *local) {
     ObjUpvalue *prevUpvalue = nullptr;
     ObjUpvalue *upvalue = openUpvalues;
     while (upvalue != nullptr && upvalue->location > local) {
@@ -189,6 +718,9 @@ ObjUpvalue *VM::captureUpvalue(Value *local) {
     }
 
     ObjUpvalue *createdUpvalue = newUpvalue(local);
+    if constexpr (P::enabled) {
+        policy.onAllocate(createdUpvalue);
+    }
     createdUpvalue->next = upvalue;
 
     if (prevUpvalue == nullptr) {
@@ -209,374 +741,1603 @@ void VM::closeUpvalues(Value const *last) {
     }
 }
 
-void VM::defineMethod(ObjString *name) {
-    const Value method = peek(0);
-    ObjClass   *klass = as<ObjClass *>(peek(1));
-    klass->methods.set(name, method);
-    pop();
+void VM::defineMethod(ObjClass *klass, ObjString *name, Value method) {
+    klass->set_method(name, as<ObjClosure *>(method));
+    if (name == initString) {
+        klass->initializer = as<ObjClosure *>(method);
+    }
 }
 
-void VM::concatenate() {
+template <ExecutionPolicy P> void VM::concatenate(P &policy) {
     ObjString *b = as<ObjString *>(peek(0));
     ObjString *a = as<ObjString *>(peek(1));
     ObjString *result = newString(a->str + b->str);
+    if constexpr (P::enabled) {
+        policy.onAllocate(result);
+    }
     pop();
     pop();
     push(value<Obj *>(result));
 }
 
-const inline auto number_zero = value<double>(0);
-const inline auto number_one = value<double>(1);
+// Compile a function to machine code once it has been called or looped enough.
+void VM::countHot(ObjFunction *function) {
+    if (jit != nullptr && ++function->hotness == options.jit_threshold) {
+        function->jit = jit->compile(function);
+    }
+}
 
-InterpretResult VM::run() {
-    CallFrame *frame = &frames[frameCount - 1];
-    uint8_t   *ip = frame->ip;
+/**
+ * @brief Run the top frame in JIT code, and the frames it calls or returns to while
+ * they have JIT code.
+ */
+JitExit VM::runJit() {
+    for (;;) {
+        CallFrame   *frame = &frames[frameCount - 1];
+        ObjFunction *function = frame->closure->function;
+        if (function->jit == nullptr) {
+            return JitExit::Call;
+        }
+        const size_t offset = frame->ip - function->chunk.get_code();
+        if (!jit->enter(this, function->jit, stackTop, frame->slots, offset)) {
+            return JitExit::Interpret;
+        }
+        if (jit_exit != JitExit::Call) {
+            return jit_exit;
+        }
+    }
+}
 
-#define READ_BYTE() (*ip++)
+template <OpCode op> Value *VM::jitHandler(VM *vm, Value *sp, uint8_t *ip) {
+    vm->stackTop = sp;
+    return vm->nativeInstruction(op, ip) ? vm->stackTop : nullptr;
+}
 
-#define READ_SHORT() (ip += 2, (uint16_t)(ip[-2] << UINT8_WIDTH) | ip[-1])
+// Leave the JIT code to interpret the instruction at ip.
+Value *VM::jitExit(VM *vm, Value *sp, uint8_t *ip) {
+    vm->stackTop = sp;
+    vm->frames[vm->frameCount - 1].ip = ip;
+    vm->jit_exit = JitExit::Interpret;
+    return nullptr;
+}
 
-#define READ_CONSTANT() (frame->closure->function->chunk.get_value(READ_SHORT()))
+/**
+ * @brief The instructions the JIT and the AOT code call back for, as in the interpreter
+ * loop but without quickening. ip is after the opcode. Returns false to leave the JIT
+ * code, with jit_exit saying why.
+ */
+bool VM::nativeInstruction(OpCode op, uint8_t *ip) {
+    PlainPolicy policy;
+    CallFrame  *frame = &frames[frameCount - 1];
+    Chunk      &chunk = frame->closure->function->chunk;
+    frame->ip = ip; // for the line of runtime errors.
 
-#define READ_STRING() as<ObjString *>(READ_CONSTANT())
-#define BINARY_OP(valueType, op)                                                         \
-    do {                                                                                 \
-        if (!is<double>(peek(0)) || !is<double>(peek(1))) {                              \
-            frame->ip = ip;                                                              \
-            runtimeError("Operands must be numbers.");                                   \
-            return INTERPRET_RUNTIME_ERROR;                                              \
-        }                                                                                \
-        const double b = as<double>(pop());                                              \
-        const double a = as<double>(pop());                                              \
-        push(valueType(a op b));                                                         \
-    } while (false)
+    auto word = [&ip]() {
+        ip += 2;
+        return uint16_t((ip[-2] << UINT8_WIDTH) | ip[-1]);
+    };
+    auto error = [this](const char *message) {
+        runtimeError(message);
+        jit_exit = JitExit::Error;
+        return false;
+    };
+    auto failed = [this]() {
+        jit_exit = JitExit::Error;
+        return false;
+    };
 
-    for (;;) {
-        if constexpr (DEBUG_TRACE_EXECUTION) {
-            if (options.trace) {
-                std::cout << "          ";
-                for (Value *slot = stack; slot < stackTop; slot++) {
-                    std::cout << "[ ";
-                    printValue(std::cout, *slot);
-                    std::cout << " ]";
-                }
-                std::cout << "\n";
-                disassembleInstruction(
-                    &frame->closure->function->chunk,
-                    (int)(ip - frame->closure->function->chunk.get_code()));
-            }
+    switch (op) {
+    case OpCode::GET_GLOBAL: {
+        const global_index_t slot = word();
+        const Value          value = globals.get_value(slot);
+        if (value == UNDEFINED_VAL) {
+            runtimeError("Undefined variable '{}'.", globals.get_name(slot)->str);
+            return failed();
         }
-
-        auto instruction = OpCode(READ_BYTE());
-        switch (instruction) {
-        case OpCode::CONSTANT: {
-            const Value constant = READ_CONSTANT();
-            push(constant);
-            break;
+        push(value);
+        return true;
+    }
+    case OpCode::DEFINE_GLOBAL:
+        globals.get_value(word()) = pop();
+        return true;
+    case OpCode::SET_GLOBAL: {
+        const global_index_t slot = word();
+        Value               &value = globals.get_value(slot);
+        if (value == UNDEFINED_VAL) {
+            runtimeError("Undefined variable '{}'.", globals.get_name(slot)->str);
+            return failed();
+        }
+        value = peek(0);
+        return true;
+    }
+    case OpCode::GET_UPVALUE:
+        push(*frame->closure->upvalues[*ip].upvalue->location);
+        return true;
+    case OpCode::SET_UPVALUE:
+        *frame->closure->upvalues[*ip].upvalue->location = peek(0);
+        return true;
+    case OpCode::GET_CAPTURED:
+        push(frame->closure->upvalues[*ip].value);
+        return true;
+    case OpCode::GET_LOCAL_PROPERTY:
+        push(frame->slots[*ip++]);
+        [[fallthrough]];
+    case OpCode::GET_PROPERTY: {
+        ObjString   *name = as<ObjString *>(chunk.get_value(word()));
+        InlineCache &cache = chunk.get_cache(word());
+        return getProperty(policy, peek(0), name, cache, stackTop[-1]) || failed();
+    }
+    case OpCode::SET_PROPERTY:
+    case OpCode::SET_PROPERTY_POP: {
+        ObjString   *name = as<ObjString *>(chunk.get_value(word()));
+        InlineCache &cache = chunk.get_cache(word());
+        if (!setProperty(peek(1), name, cache, peek(0))) {
+            return failed();
+        }
+        const Value value = pop();
+        if (op == OpCode::SET_PROPERTY) {
+            stackTop[-1] = value; // Instance.
+        } else {
+            pop();
         }
-        case OpCode::NIL:
-            push(NIL_VAL);
+        return true;
+    }
+    case OpCode::GET_SUPER: {
+        ObjString *name = as<ObjString *>(chunk.get_value(word()));
+        return bindMethod(policy, as<ObjClass *>(pop()), name) || failed();
+    }
+    case OpCode::EQUAL:
+    case OpCode::NOT_EQUAL: {
+        const Value b = pop();
+        const Value a = pop();
+        push(value<bool>(valuesEqual(a, b) == (op == OpCode::EQUAL)));
+        return true;
+    }
+    case OpCode::GREATER:
+    case OpCode::NOT_GREATER:
+    case OpCode::LESS:
+    case OpCode::NOT_LESS:
+    case OpCode::SUBTRACT:
+    case OpCode::MULTIPLY:
+    case OpCode::DIVIDE: {
+        if (!is<double>(peek(0)) || !is<double>(peek(1))) {
+            return error("Operands must be numbers.");
+        }
+        const double b = as<double>(pop());
+        const double a = as<double>(pop());
+        switch (op) {
+        case OpCode::GREATER:
+            push(value<bool>(a > b));
             break;
-        case OpCode::TRUE:
-            push(value<bool>(true));
+        case OpCode::NOT_GREATER:
+            push(value<bool>(a <= b));
             break;
-        case OpCode::FALSE:
-            push(value<bool>(false));
+        case OpCode::LESS:
+            push(value<bool>(a < b));
             break;
-        case OpCode::ZERO:
-            push(number_zero);
+        case OpCode::NOT_LESS:
+            push(value<bool>(a >= b));
             break;
-        case OpCode::ONE:
-            push(number_one);
+        case OpCode::SUBTRACT:
+            push(value<double>(a - b));
             break;
-        case OpCode::POP:
-            pop();
+        case OpCode::MULTIPLY:
+            push(value<double>(a * b));
             break;
-        case OpCode::GET_LOCAL: {
-            const uint8_t slot = READ_BYTE();
-            push(frame->slots[slot]);
+        default:
+            push(value<double>(a / b));
             break;
         }
-        case OpCode::SET_LOCAL: {
-            const uint8_t slot = READ_BYTE();
-            frame->slots[slot] = peek(0);
-            break;
+        return true;
+    }
+    case OpCode::ADD:
+        if (is<double>(peek(0)) && is<double>(peek(1))) {
+            const double b = as<double>(pop());
+            const double a = as<double>(pop());
+            push(value<double>(a + b));
+        } else if (is<ObjString>(peek(0)) && is<ObjString>(peek(1))) {
+            concatenate(policy);
+        } else {
+            return error("Operands must be two numbers or two strings.");
         }
-        case OpCode::GET_GLOBAL: {
-            ObjString *name = READ_STRING();
-            Value      value;
-            if (!globals.get(name, &value)) {
-                frame->ip = ip;
-                runtimeError("Undefined variable '{}'.", name->str);
-                return INTERPRET_RUNTIME_ERROR;
+        return true;
+    case OpCode::NOT:
+        push(value<bool>(isFalsey(pop())));
+        return true;
+    case OpCode::NEGATE:
+        if (!is<double>(peek(0))) {
+            return error("Operand must be a number.");
+        }
+        push(value<double>(-as<double>(pop())));
+        return true;
+    case OpCode::PRINT:
+        printValue(options.out, pop());
+        options.out << '\n';
+        return true;
+    case OpCode::CLOSURE: {
+        ObjClosure *closure = newClosure(as<ObjFunction *>(chunk.get_value(word())));
+        push(value<Obj *>(closure));
+        for (int i = 0; i < closure->upvalueCount; i++) {
+            const uint8_t kind = *ip++;
+            const uint8_t index = *ip++;
+            if (kind == CAPTURE_LOCAL) {
+                Value *local = frame->slots + index;
+                closure->upvalues[i].upvalue = captureUpvalue(policy, local);
+            } else if (kind == CAPTURE_LOCAL_COPY) {
+                closure->upvalues[i].value = frame->slots[index];
+            } else {
+                closure->upvalues[i] = frame->closure->upvalues[index];
             }
-            push(value);
-            break;
         }
-        case OpCode::DEFINE_GLOBAL: {
-            ObjString *name = READ_STRING();
-            globals.set(name, peek(0));
-            pop();
-            break;
+        return true;
+    }
+    case OpCode::CLOSE_UPVALUE:
+        closeUpvalues(stackTop - 1);
+        pop();
+        return true;
+    case OpCode::THROW: {
+        // Compiled code can't start at the handler, the interpreter runs it.
+        const Value exception = pop();
+        restart = throwValue(exception);
+        if (!restart) {
+            uncaught(exception);
         }
-        case OpCode::SET_GLOBAL: {
-            ObjString *name = READ_STRING();
-            if (globals.set(name, peek(0))) {
-                globals.del(name); // [delete]
-                frame->ip = ip;
-                runtimeError("Undefined variable '{}'.", name->str);
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            break;
+        return failed();
+    }
+    case OpCode::YIELD: {
+        if (running == nullptr) {
+            return error("Can't yield outside a coroutine.");
         }
-        case OpCode::GET_UPVALUE: {
-            const uint8_t slot = READ_BYTE();
-            push(*frame->closure->upvalues[slot]->location);
-            break;
+        // The resumer runs on in the interpreter.
+        if (suspend(peek(0), false)) {
+            restart = true;
         }
-        case OpCode::SET_UPVALUE: {
-            const uint8_t slot = READ_BYTE();
-            *frame->closure->upvalues[slot]->location = peek(0);
-            break;
+        return failed();
+    }
+    case OpCode::CLASS:
+        push(value<Obj *>(newClass(as<ObjString *>(chunk.get_value(word())))));
+        return true;
+    case OpCode::INHERIT: {
+        const Value superclass = peek(1);
+        if (!is<ObjClass>(superclass)) {
+            return error("Superclass must be a class.");
         }
-        case OpCode::GET_PROPERTY: {
-            if (!is<ObjInstance>(peek(0))) {
-                frame->ip = ip;
-                runtimeError("Only instances have properties.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-
-            ObjInstance *instance = as<ObjInstance *>(peek(0));
-            ObjString   *name = READ_STRING();
-
-            Value value;
-            if (instance->fields.get(name, &value)) {
-                pop(); // Instance.
-                push(value);
-                break;
-            }
+        ObjClass *subclass = as<ObjClass *>(peek(0));
+        subclass->inherit(as<ObjClass *>(superclass));
+        pop(); // Subclass.
+        return true;
+    }
+    case OpCode::METHOD:
+        defineMethod(as<ObjClass *>(peek(1)), as<ObjString *>(chunk.get_value(word())),
+                     peek(0));
+        pop();
+        return true;
+    default:
+        jitExit(this, stackTop, ip - 1);
+        return false;
+    }
+}
 
-            if (!bindMethod(instance->klass, name)) {
-                frame->ip = ip;
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            break;
+/**
+ * @brief CALL, CALL_DIRECT, INVOKE, SUPER_INVOKE and the tail calls for compiled code.
+ * The callee's frame is pushed, or a native function called, as in the interpreter loop.
+ * ip is after the opcode.
+ */
+VM::NativeCall VM::nativeCall(OpCode op, uint8_t *ip) {
+    PlainPolicy         policy;
+    CallFrame          *frame = &frames[frameCount - 1];
+    const int           depth = frameCount;
+    ObjCoroutine *const coroutine = running;
+    const bool          tail = op == OpCode::TAIL_CALL || op == OpCode::TAIL_INVOKE;
+    bool                called = false;
+    uint8_t            *next = nullptr;
+    auto                word = [ip](size_t n) {
+        return uint16_t((ip[n] << UINT8_WIDTH) | ip[n + 1]);
+    };
+    if (op == OpCode::CALL || op == OpCode::TAIL_CALL) {
+        const int argCount = ip[0];
+        frame->ip = next = ip + 1;
+        called = callValue(policy, peek(argCount), argCount, tail);
+    } else if (op == OpCode::CALL_DIRECT) {
+        const int argCount = ip[2];
+        frame->ip = next = ip + 3;
+        called = callDirect(policy, word(0), argCount);
+    } else if (isIntrinsic(op)) {
+        frame->ip = next = ip + 2;
+        called = callIntrinsic(policy, op, word(0));
+    } else {
+        Chunk     &chunk = frame->closure->function->chunk;
+        ObjString *method = as<ObjString *>(chunk.get_value(word(0)));
+        if (op == OpCode::SUPER_INVOKE) {
+            const int argCount = ip[2];
+            frame->ip = next = ip + 3;
+            ObjClass *superclass = as<ObjClass *>(pop());
+            called = invokeFromClass(policy, superclass, method, argCount);
+        } else {
+            InlineCache &cache = chunk.get_cache(word(2));
+            const int    argCount = ip[4];
+            frame->ip = next = ip + 5;
+            called = invoke(policy, method, argCount, cache, tail);
         }
-        case OpCode::SET_PROPERTY: {
-            if (!is<ObjInstance>(peek(1))) {
-                frame->ip = ip;
-                runtimeError("Only instances have fields.");
+    }
+    if (!called) {
+        return NativeCall::Error;
+    }
+    if (running != coroutine) {
+        return NativeCall::Switched;
+    }
+    // A callee's frame, new or reused, starts at the beginning of its code. The frames
+    // may have moved.
+    return frameCount == depth && frames[depth - 1].ip == next ? NativeCall::Returned
+                                                               : NativeCall::Entered;
+}
+
+/**
+ * @brief RETURN for compiled code. Returns false if it was the script that returned. A
+ * coroutine's function returns to its resumer, and a task's to the next task: false is
+ * then a runtime error in that task.
+ */
+bool VM::nativeReturn(uint8_t *ip) {
+    CallFrame  *frame = &frames[frameCount - 1];
+    const Value result = pop();
+    frame->ip = ip;
+    closeUpvalues(frame->slots);
+    frameCount--;
+    if (frameCount == 0 && running == nullptr) {
+        returned = result;
+        pop();
+        return false;
+    }
+    if (frameCount == 0) {
+        return suspend(result, true);
+    }
+    stackTop = frame->slots;
+    push(result);
+    return true;
+}
+
+template <OpCode op> JitJump VM::jitJumpHandler(VM *vm, Value *sp, uint8_t *ip) {
+    vm->stackTop = sp;
+    return vm->jitJump(op, ip);
+}
+
+/**
+ * @brief Calls and RETURN for the JIT code. After the frame is pushed or popped, the JIT
+ * code jumps to the code of the new top frame if it has some. If not it leaves for the
+ * interpreter.
+ */
+JitJump VM::jitJump(OpCode op, uint8_t *ip) {
+    // After a coroutine switch runJit() enters the top frame of the other stacks.
+    if (op == OpCode::RETURN) {
+        ObjCoroutine *const coroutine = running;
+        if (!nativeReturn(ip)) {
+            jit_exit = coroutine == nullptr ? JitExit::Done : JitExit::Error;
+            return {};
+        }
+        if (running != coroutine) {
+            jit_exit = JitExit::Call;
+            return {};
+        }
+    } else {
+        const NativeCall call = nativeCall(op, ip);
+        if (call == NativeCall::Error) {
+            jit_exit = JitExit::Error;
+            return {};
+        }
+        if (call == NativeCall::Returned) {
+            return {stackTop, nullptr};
+        }
+        if (call == NativeCall::Switched) {
+            jit_exit = JitExit::Call;
+            return {};
+        }
+    }
+
+    CallFrame   *next = &frames[frameCount - 1];
+    ObjFunction *function = next->closure->function;
+    uint8_t     *code = function->jit == nullptr
+                            ? nullptr
+                            : function->jit->entry(next->ip - function->chunk.get_code());
+    if (code == nullptr) {
+        jit_exit = JitExit::Call;
+        return {};
+    }
+    return {op == OpCode::RETURN ? next->slots : stackTop, code};
+}
+
+JitHandlers VM::jitHandlers() {
+    JitHandlers handlers;
+#define HANDLER(op) handlers.ops[size_t(OpCode::op)] = &jitHandler<OpCode::op>
+    HANDLER(GET_GLOBAL);
+    HANDLER(SET_GLOBAL);
+    HANDLER(GET_UPVALUE);
+    HANDLER(SET_UPVALUE);
+    HANDLER(GET_CAPTURED);
+    HANDLER(GET_PROPERTY);
+    HANDLER(SET_PROPERTY);
+    HANDLER(GREATER);
+    HANDLER(NOT_GREATER);
+    HANDLER(LESS);
+    HANDLER(NOT_LESS);
+    HANDLER(ADD);
+    HANDLER(SUBTRACT);
+    HANDLER(MULTIPLY);
+    HANDLER(DIVIDE);
+    HANDLER(EQUAL);
+    HANDLER(NOT_EQUAL);
+    HANDLER(NOT);
+    HANDLER(NEGATE);
+    HANDLER(PRINT);
+    HANDLER(CLOSE_UPVALUE);
+    HANDLER(GET_SUPER);
+    HANDLER(CLOSURE);
+    HANDLER(CLASS);
+    HANDLER(INHERIT);
+    HANDLER(METHOD);
+    HANDLER(GET_LOCAL_PROPERTY);
+    HANDLER(SET_PROPERTY_POP);
+#undef HANDLER
+    handlers.natives = {&jitJumpHandler<OpCode::CLOCK>, &jitJumpHandler<OpCode::GETC>,
+                        &jitJumpHandler<OpCode::CHR>, &jitJumpHandler<OpCode::ORD>};
+    handlers.ret = &jitJumpHandler<OpCode::RETURN>;
+    return handlers;
+}
+
+const inline auto number_zero = value<double>(0);
+const inline auto number_one = value<double>(1);
+
+void VM::traceExecution(CallFrame *frame, uint8_t *ip) {
+    std::cout << "          ";
+    for (Value *slot = stack.data(); slot < stackTop; slot++) {
+        std::cout << "[ ";
+        printValue(std::cout, *slot);
+        std::cout << " ]";
+    }
+    std::cout << "\n";
+    disassembleInstruction(&frame->closure->function->chunk,
+                           (int)(ip - frame->closure->function->chunk.get_code()));
+}
+
+// The register loop only keeps stackTop for calls, so the registers above it may be
+// stale, and only the instruction is printed.
+void VM::traceRegisters(CallFrame *frame, RegInstr *pc) {
+    Chunk &chunk = frame->closure->function->chunk;
+    disassembleRegister(&chunk, pc - chunk.get_registers().get_code());
+}
+
+#ifdef COMPUTED_GOTO
+// Labels as values are a GNU extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#ifdef __clang__
+#pragma clang diagnostic ignored "-Wgnu-label-as-value"
+#endif
+#endif
+
+/**
+ * @brief The interpreter loop, instantiated for each dispatch mode and execution policy.
+ *
+ * Each handler finishes with DISPATCH(). For Dispatch::Switch this goes back round the
+ * loop to the single switch. For Dispatch::Threaded the next handler is jumped to
+ * directly through the label table, so every handler has its own indirect branch
+ * for the predictor. The switch is then only used for the first instruction.
+ */
+template <Dispatch D, ExecutionPolicy P> InterpretResult VM::run(P &policy) {
+    // The state of the top frame and the stack top are kept in locals, which the C++
+    // compiler can keep in registers. They are written back for the calls, returns and
+    // errors that need them, and loaded again after.
+    CallFrame *frame = nullptr;
+    uint8_t   *ip = nullptr;
+    Value     *slots = nullptr;
+    Value     *constants = nullptr;
+    Value     *sp = stackTop;
+
+#define LOAD_FRAME()                                                                     \
+    do {                                                                                 \
+        frame = &frames[frameCount - 1];                                                 \
+        ip = frame->ip;                                                                  \
+        slots = frame->slots;                                                            \
+        constants = frame->closure->function->chunk.get_constants().get_values();        \
+    } while (false)
+
+#define SPILL()                                                                          \
+    do {                                                                                 \
+        frame->ip = ip;                                                                  \
+        stackTop = sp;                                                                   \
+    } while (false)
+
+#define PUSH(value) (*sp++ = (value))
+#define POP()       (*--sp)
+#define PEEK(distance) (sp[-1 - (distance)])
+
+#define READ_BYTE() (*ip++)
+
+#define READ_SHORT() (ip += 2, (uint16_t)(ip[-2] << UINT8_WIDTH) | ip[-1])
+
+#define READ_CONSTANT() (constants[READ_SHORT()])
+
+#define READ_STRING() as<ObjString *>(READ_CONSTANT())
+
+#define READ_CACHE() (frame->closure->function->chunk.get_cache(READ_SHORT()))
+#define BINARY_OP(valueType, op)                                                         \
+    do {                                                                                 \
+        if (!is<double>(PEEK(0)) || !is<double>(PEEK(1))) {                              \
+            frame->ip = ip;                                                              \
+            runtimeError("Operands must be numbers.");                                   \
+            return INTERPRET_RUNTIME_ERROR;                                              \
+        }                                                                                \
+        const double b = as<double>(POP());                                              \
+        sp[-1] = valueType(as<double>(sp[-1]) op b);                                     \
+    } while (false)
+
+// Rewrite the instruction being executed, from then on it runs as op. Specialised
+// instructions check their operand types, and if they change run again as the generic
+// op, which stays generic so that a site with mixed types isn't rewritten every time.
+#define QUICKEN(op) (ip[-1] = uint8_t(OpCode::op))
+
+#define DEQUICKEN(op)                                                                    \
+    do {                                                                                 \
+        QUICKEN(op##_GENERIC);                                                           \
+        ip--;                                                                            \
+    } while (false)
+
+#define TRACE()                                                                          \
+    do {                                                                                 \
+        if constexpr (P::enabled) {                                                      \
+            stackTop = sp;                                                               \
+            policy.onInstruction(frame, ip);                                             \
+        }                                                                                \
+    } while (false)
+
+// Continue in JIT code if the frame's function has been compiled. Only the plain loop
+// does, the other policies see every instruction.
+#define ENTER_JIT()                                                                      \
+    do {                                                                                 \
+        if constexpr (std::is_same_v<P, PlainPolicy>) {                                  \
+            if (frame->closure->function->jit != nullptr) {                              \
+                SPILL();                                                                 \
+                const JitExit exit = runJit();                                           \
+                if (exit == JitExit::Done) {                                             \
+                    return INTERPRET_OK;                                                 \
+                }                                                                        \
+                if (exit == JitExit::Error) {                                            \
+                    return INTERPRET_RUNTIME_ERROR;                                      \
+                }                                                                        \
+                LOAD_FRAME();                                                            \
+                sp = stackTop;                                                           \
+            }                                                                            \
+        }                                                                                \
+    } while (false)
+
+// A native called by name, inline while its global holds it.
+#define INTRINSIC(op)                                                                    \
+    CASE(op) {                                                                           \
+        const size_t         index = intrinsicIndex(OpCode::op);                         \
+        const global_index_t slot = READ_SHORT();                                        \
+        if (globals.get_value(slot) == natives[index]) [[likely]] {                      \
+            frame->ip = ip;                                                              \
+            if (!intrinsic<OpCode::op>(sp - intrinsics[index].arity)) {                  \
+                return INTERPRET_RUNTIME_ERROR;                                          \
+            }                                                                            \
+            sp += 1 - intrinsics[index].arity;                                           \
+            DISPATCH();                                                                  \
+        }                                                                                \
+        SPILL();                                                                         \
+        if (!callIntrinsic(policy, OpCode::op, slot)) {                                  \
+            return INTERPRET_RUNTIME_ERROR;                                              \
+        }                                                                                \
+        LOAD_FRAME();                                                                    \
+        sp = stackTop;                                                                   \
+        ENTER_JIT();                                                                     \
+        DISPATCH();                                                                      \
+    }
+
+#ifdef COMPUTED_GOTO
+    // Must be in the same order as OpCode.
+    static void *dispatch_table[] = {
+        &&op_CONSTANT,      &&op_NIL,           &&op_TRUE,          &&op_FALSE,
+        &&op_ZERO,          &&op_ONE,           &&op_POP,           &&op_GET_LOCAL,
+        &&op_SET_LOCAL,     &&op_GET_GLOBAL,    &&op_DEFINE_GLOBAL, &&op_SET_GLOBAL,
+        &&op_GET_UPVALUE,   &&op_SET_UPVALUE,   &&op_GET_CAPTURED,  &&op_GET_PROPERTY,
+        &&op_SET_PROPERTY,  &&op_GET_SUPER,     &&op_EQUAL,         &&op_NOT_EQUAL,
+        &&op_GREATER,       &&op_NOT_GREATER,   &&op_LESS,          &&op_NOT_LESS,
+        &&op_ADD,           &&op_SUBTRACT,      &&op_MULTIPLY,      &&op_DIVIDE,
+        &&op_NOT,           &&op_NEGATE,        &&op_PRINT,         &&op_JUMP,
+        &&op_JUMP_IF_FALSE, &&op_LOOP,          &&op_CALL,          &&op_INVOKE,
+        &&op_SUPER_INVOKE,  &&op_CLOSURE,       &&op_CLOSE_UPVALUE, &&op_RETURN,
+        &&op_CLASS,         &&op_INHERIT,       &&op_METHOD,        &&op_TAIL_CALL,
+        &&op_TAIL_INVOKE,   &&op_CALL_DIRECT,   &&op_CLOCK,         &&op_GETC,
+        &&op_CHR,           &&op_ORD,           &&op_THROW,         &&op_YIELD,
+        &&op_GET_LOCAL_LOCAL,     &&op_GET_LOCAL_CONSTANT, &&op_GET_LOCAL_PROPERTY,
+        &&op_SET_PROPERTY_POP,    &&op_JUMP_IF_FALSE_POP,  &&op_LESS_JUMP_IF_FALSE,
+        &&op_EQUAL_JUMP_IF_FALSE, &&op_ADD_NUMBER,         &&op_ADD_STRING,
+        &&op_EQUAL_NUMBER,        &&op_NOT_EQUAL_NUMBER,   &&op_ADD_GENERIC,
+        &&op_EQUAL_GENERIC,       &&op_NOT_EQUAL_GENERIC};
+    static_assert(std::size(dispatch_table) == OPCODE_COUNT);
+
+#define CASE(op)                                                                         \
+    case OpCode::op:                                                                     \
+    op_##op:
+#define DISPATCH()                                                                       \
+    if constexpr (D == Dispatch::Threaded) {                                             \
+        TRACE();                                                                         \
+        goto *dispatch_table[READ_BYTE()];                                               \
+    } else                                                                               \
+        continue
+#else
+#define CASE(op) case OpCode::op:
+#define DISPATCH() continue
+#endif
+
+    LOAD_FRAME();
+    ENTER_JIT();
+    for (;;) {
+        TRACE();
+
+        auto instruction = OpCode(READ_BYTE());
+        switch (instruction) {
+        CASE(CONSTANT) {
+            const Value constant = READ_CONSTANT();
+            PUSH(constant);
+            DISPATCH();
+        }
+        CASE(NIL) {
+            PUSH(NIL_VAL);
+            DISPATCH();
+        }
+        CASE(TRUE) {
+            PUSH(value<bool>(true));
+            DISPATCH();
+        }
+        CASE(FALSE) {
+            PUSH(value<bool>(false));
+            DISPATCH();
+        }
+        CASE(ZERO) {
+            PUSH(number_zero);
+            DISPATCH();
+        }
+        CASE(ONE) {
+            PUSH(number_one);
+            DISPATCH();
+        }
+        CASE(POP) {
+            sp--;
+            DISPATCH();
+        }
+        CASE(GET_LOCAL) {
+            const uint8_t slot = READ_BYTE();
+            PUSH(slots[slot]);
+            DISPATCH();
+        }
+        CASE(SET_LOCAL) {
+            const uint8_t slot = READ_BYTE();
+            slots[slot] = PEEK(0);
+            DISPATCH();
+        }
+        CASE(GET_GLOBAL) {
+            const global_index_t slot = READ_SHORT();
+            const Value          value = globals.get_value(slot);
+            if (value == UNDEFINED_VAL) {
+                frame->ip = ip;
+                runtimeError("Undefined variable '{}'.", globals.get_name(slot)->str);
                 return INTERPRET_RUNTIME_ERROR;
             }
-
-            ObjInstance *instance = as<ObjInstance *>(peek(1));
-            instance->fields.set(READ_STRING(), peek(0));
-            const Value value = pop();
-            pop();
-            push(value);
-            break;
+            PUSH(value);
+            DISPATCH();
+        }
+        CASE(DEFINE_GLOBAL) {
+            const global_index_t slot = READ_SHORT();
+            globals.get_value(slot) = PEEK(0);
+            sp--;
+            DISPATCH();
+        }
+        CASE(SET_GLOBAL) {
+            const global_index_t slot = READ_SHORT();
+            Value               &value = globals.get_value(slot);
+            if (value == UNDEFINED_VAL) {
+                frame->ip = ip;
+                runtimeError("Undefined variable '{}'.", globals.get_name(slot)->str);
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            value = PEEK(0);
+            DISPATCH();
+        }
+        CASE(GET_UPVALUE) {
+            const uint8_t slot = READ_BYTE();
+            PUSH(*frame->closure->upvalues[slot].upvalue->location);
+            DISPATCH();
+        }
+        CASE(SET_UPVALUE) {
+            const uint8_t slot = READ_BYTE();
+            *frame->closure->upvalues[slot].upvalue->location = PEEK(0);
+            DISPATCH();
+        }
+        CASE(GET_CAPTURED) {
+            const uint8_t slot = READ_BYTE();
+            PUSH(frame->closure->upvalues[slot].value);
+            DISPATCH();
+        }
+        CASE(GET_PROPERTY) {
+            ObjString   *name = READ_STRING();
+            InlineCache &cache = READ_CACHE();
+            frame->ip = ip;
+            if (!getProperty(policy, PEEK(0), name, cache, sp[-1])) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            DISPATCH();
+        }
+        CASE(SET_PROPERTY) {
+            ObjString   *name = READ_STRING();
+            InlineCache &cache = READ_CACHE();
+            frame->ip = ip;
+            if (!setProperty(PEEK(1), name, cache, PEEK(0))) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            const Value value = POP();
+            sp[-1] = value; // Instance.
+            DISPATCH();
         }
-        case OpCode::GET_SUPER: {
+        CASE(GET_SUPER) {
             ObjString *name = READ_STRING();
-            ObjClass  *superclass = as<ObjClass *>(pop());
+            ObjClass  *superclass = as<ObjClass *>(POP());
 
-            if (!bindMethod(superclass, name)) {
-                frame->ip = ip;
+            SPILL();
+            if (!bindMethod(policy, superclass, name)) {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break;
+            DISPATCH();
         }
-        case OpCode::EQUAL: {
-            const Value b = pop();
-            const Value a = pop();
-            push(value<bool>(valuesEqual(a, b)));
-            break;
+        CASE(EQUAL) {
+            if (is<double>(PEEK(0)) && is<double>(PEEK(1))) {
+                QUICKEN(EQUAL_NUMBER);
+            }
+            [[fallthrough]];
         }
-        case OpCode::NOT_EQUAL: {
-            const Value b = pop();
-            const Value a = pop();
-            push(value<bool>(!valuesEqual(a, b)));
-            break;
+        CASE(EQUAL_GENERIC) {
+            const Value b = POP();
+            const Value a = POP();
+            PUSH(value<bool>(valuesEqual(a, b)));
+            DISPATCH();
         }
-        case OpCode::GREATER:
+        CASE(NOT_EQUAL) {
+            if (is<double>(PEEK(0)) && is<double>(PEEK(1))) {
+                QUICKEN(NOT_EQUAL_NUMBER);
+            }
+            [[fallthrough]];
+        }
+        CASE(NOT_EQUAL_GENERIC) {
+            const Value b = POP();
+            const Value a = POP();
+            PUSH(value<bool>(!valuesEqual(a, b)));
+            DISPATCH();
+        }
+        CASE(GREATER) {
             BINARY_OP(value<bool>, >);
-            break;
-        case OpCode::NOT_GREATER:
+            DISPATCH();
+        }
+        CASE(NOT_GREATER) {
             BINARY_OP(value<bool>, <=);
-            break;
-        case OpCode::LESS:
+            DISPATCH();
+        }
+        CASE(LESS) {
             BINARY_OP(value<bool>, <);
-            break;
-        case OpCode::NOT_LESS:
+            DISPATCH();
+        }
+        CASE(NOT_LESS) {
             BINARY_OP(value<bool>, >=);
-            break;
-        case OpCode::ADD: {
-            if (is<ObjString>(peek(0)) && is<ObjString>(peek(1))) {
-                concatenate();
-            } else if (is<double>(peek(0)) && is<double>(peek(1))) {
-                double b = as<double>(pop());
-                double a = as<double>(pop());
-                push(value<double>(a + b));
+            DISPATCH();
+        }
+        CASE(ADD) {
+            if (is<double>(PEEK(0)) && is<double>(PEEK(1))) {
+                QUICKEN(ADD_NUMBER);
+            } else if (is<ObjString>(PEEK(0)) && is<ObjString>(PEEK(1))) {
+                QUICKEN(ADD_STRING);
+            }
+            [[fallthrough]];
+        }
+        CASE(ADD_GENERIC) {
+            if (is<double>(PEEK(0)) && is<double>(PEEK(1))) {
+                const double b = as<double>(POP());
+                sp[-1] = value<double>(as<double>(sp[-1]) + b);
+            } else if (is<ObjString>(PEEK(0)) && is<ObjString>(PEEK(1))) {
+                stackTop = sp;
+                concatenate(policy);
+                sp--;
             } else {
                 frame->ip = ip;
                 runtimeError("Operands must be two numbers or two strings.");
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break;
+            DISPATCH();
         }
-        case OpCode::SUBTRACT:
+        CASE(SUBTRACT) {
             BINARY_OP(value<double>, -);
-            break;
-        case OpCode::MULTIPLY:
+            DISPATCH();
+        }
+        CASE(MULTIPLY) {
             BINARY_OP(value<double>, *);
-            break;
-        case OpCode::DIVIDE:
+            DISPATCH();
+        }
+        CASE(DIVIDE) {
             BINARY_OP(value<double>, /);
-            break;
-        case OpCode::NOT:
-            push(value<bool>(isFalsey(pop())));
-            break;
-        case OpCode::NEGATE:
-            if (!is<double>(peek(0))) {
+            DISPATCH();
+        }
+        CASE(NOT) {
+            sp[-1] = value<bool>(isFalsey(sp[-1]));
+            DISPATCH();
+        }
+        CASE(NEGATE) {
+            if (!is<double>(PEEK(0))) {
                 frame->ip = ip;
                 runtimeError("Operand must be a number.");
                 return INTERPRET_RUNTIME_ERROR;
             }
-            push(value<double>(-as<double>(pop())));
-            break;
-        case OpCode::PRINT: {
-            printValue(options.out, pop());
-            std::cout << "\n";
-            break;
+            sp[-1] = value<double>(-as<double>(sp[-1]));
+            DISPATCH();
+        }
+        CASE(PRINT) {
+            printValue(options.out, POP());
+            options.out << '\n';
+            DISPATCH();
         }
-        case OpCode::JUMP: {
+        CASE(JUMP) {
             const uint16_t offset = READ_SHORT();
             ip += offset;
-            break;
+            DISPATCH();
         }
-        case OpCode::JUMP_IF_FALSE: {
+        CASE(JUMP_IF_FALSE) {
             const uint16_t offset = READ_SHORT();
-            if (isFalsey(peek(0)))
+            if (isFalsey(PEEK(0)))
                 ip += offset;
-            break;
+            DISPATCH();
         }
-        case OpCode::LOOP: {
+        CASE(LOOP) {
             const uint16_t offset = READ_SHORT();
             ip -= offset;
-            break;
+            if constexpr (std::is_same_v<P, PlainPolicy>) {
+                countHot(frame->closure->function);
+            }
+            ENTER_JIT();
+            DISPATCH();
         }
-        case OpCode::CALL: {
+        CASE(CALL) {
             const int argCount = READ_BYTE();
-            frame->ip = ip;
-            if (!callValue(peek(argCount), argCount)) {
-                frame->ip = ip;
+            SPILL();
+            if (!callValue(policy, PEEK(argCount), argCount)) {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            frame = &frames[frameCount - 1];
-            ip = frame->ip;
-            break;
+            LOAD_FRAME();
+            sp = stackTop;
+            ENTER_JIT();
+            DISPATCH();
         }
-        case OpCode::INVOKE: {
-            ObjString *method = READ_STRING();
-            const int  argCount = READ_BYTE();
-            frame->ip = ip;
-            if (!invoke(method, argCount)) {
-                frame->ip = ip;
+        CASE(INVOKE) {
+            ObjString   *method = READ_STRING();
+            InlineCache &cache = READ_CACHE();
+            const int    argCount = READ_BYTE();
+            SPILL();
+            if (!invoke(policy, method, argCount, cache)) {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            frame = &frames[frameCount - 1];
-            ip = frame->ip;
-            break;
+            LOAD_FRAME();
+            sp = stackTop;
+            ENTER_JIT();
+            DISPATCH();
         }
-        case OpCode::SUPER_INVOKE: {
+        CASE(SUPER_INVOKE) {
             ObjString *method = READ_STRING();
             const int  argCount = READ_BYTE();
-            ObjClass  *superclass = as<ObjClass *>(pop());
-            frame->ip = ip;
-            if (!invokeFromClass(superclass, method, argCount)) {
-                frame->ip = ip;
+            ObjClass  *superclass = as<ObjClass *>(POP());
+            SPILL();
+            if (!invokeFromClass(policy, superclass, method, argCount)) {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            frame = &frames[frameCount - 1];
-            ip = frame->ip;
-            break;
+            LOAD_FRAME();
+            sp = stackTop;
+            ENTER_JIT();
+            DISPATCH();
         }
-        case OpCode::CLOSURE: {
+        CASE(CLOSURE) {
             ObjFunction *function = as<ObjFunction *>(READ_CONSTANT());
             ObjClosure  *closure = newClosure(function);
-            push(value<Obj *>(closure));
+            if constexpr (P::enabled) {
+                policy.onAllocate(closure);
+            }
+            PUSH(value<Obj *>(closure));
             for (int i = 0; i < closure->upvalueCount; i++) {
-                const uint8_t isLocal = READ_BYTE();
+                const uint8_t kind = READ_BYTE();
                 const uint8_t index = READ_BYTE();
-                if (isLocal) {
-                    closure->upvalues[i] = captureUpvalue(frame->slots + index);
+                if (kind == CAPTURE_LOCAL) {
+                    closure->upvalues[i].upvalue = captureUpvalue(policy, slots + index);
+                } else if (kind == CAPTURE_LOCAL_COPY) {
+                    closure->upvalues[i].value = slots[index];
                 } else {
                     closure->upvalues[i] = frame->closure->upvalues[index];
                 }
             }
-            break;
+            DISPATCH();
         }
-        case OpCode::CLOSE_UPVALUE:
-            closeUpvalues(stackTop - 1);
-            pop();
-            break;
-        case OpCode::RETURN: {
-            const Value result = pop();
-            closeUpvalues(frame->slots);
+        CASE(CLOSE_UPVALUE) {
+            closeUpvalues(sp - 1);
+            sp--;
+            DISPATCH();
+        }
+        CASE(RETURN) {
+            if constexpr (P::enabled) {
+                policy.onReturn(frame->closure);
+            }
+            const Value result = POP();
+            closeUpvalues(slots);
             frameCount--;
-            if (frameCount == 0) {
-                pop();
-                frame->ip = ip;
+            if (frameCount == 0 && running == nullptr) {
+                returned = result;
+                sp--;
+                SPILL();
                 return INTERPRET_OK;
             }
 
-            stackTop = frame->slots;
-            push(result);
-            frame = &frames[frameCount - 1];
-            ip = frame->ip;
-            break;
+            if (frameCount == 0) {
+                // The coroutine's function returned, its resumer gets the result.
+                if (!suspend(result, true)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                sp = stackTop;
+            } else {
+                sp = slots;
+                PUSH(result);
+            }
+            LOAD_FRAME();
+            ENTER_JIT();
+            DISPATCH();
         }
-        case OpCode::CLASS:
-            push(value<Obj *>(newClass(READ_STRING())));
-            break;
-        case OpCode::INHERIT: {
-            const Value superclass = peek(1);
+        CASE(CLASS) {
+            ObjClass *klass = newClass(READ_STRING());
+            if constexpr (P::enabled) {
+                policy.onAllocate(klass);
+            }
+            PUSH(value<Obj *>(klass));
+            DISPATCH();
+        }
+        CASE(INHERIT) {
+            const Value superclass = PEEK(1);
             if (!is<ObjClass>(superclass)) {
                 frame->ip = ip;
                 runtimeError("Superclass must be a class.");
                 return INTERPRET_RUNTIME_ERROR;
             }
 
-            ObjClass *subclass = as<ObjClass *>(peek(0));
-            Table::addAll(as<ObjClass *>(superclass)->methods, subclass->methods);
-            pop(); // Subclass.
-            break;
+            ObjClass *subclass = as<ObjClass *>(PEEK(0));
+            subclass->inherit(as<ObjClass *>(superclass));
+            sp--; // Subclass.
+            DISPATCH();
+        }
+        CASE(METHOD) {
+            defineMethod(as<ObjClass *>(PEEK(1)), READ_STRING(), PEEK(0));
+            sp--;
+            DISPATCH();
+        }
+        CASE(TAIL_CALL) {
+            // A closure takes over this frame, so the RETURN after is for other callees.
+            const int argCount = READ_BYTE();
+            SPILL();
+            if (!callValue(policy, PEEK(argCount), argCount, true)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            sp = stackTop;
+            ENTER_JIT();
+            DISPATCH();
+        }
+        CASE(TAIL_INVOKE) {
+            ObjString   *method = READ_STRING();
+            InlineCache &cache = READ_CACHE();
+            const int    argCount = READ_BYTE();
+            SPILL();
+            if (!invoke(policy, method, argCount, cache, true)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            sp = stackTop;
+            ENTER_JIT();
+            DISPATCH();
+        }
+        INTRINSIC(CLOCK)
+        INTRINSIC(GETC)
+        INTRINSIC(CHR)
+        INTRINSIC(ORD)
+        CASE(THROW) {
+            const Value exception = POP();
+            SPILL();
+            if (!throwValue(exception)) {
+                uncaught(exception);
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            sp = stackTop;
+            DISPATCH();
+        }
+        CASE(YIELD) {
+            const Value value = PEEK(0);
+            SPILL();
+            if (running == nullptr) {
+                runtimeError("Can't yield outside a coroutine.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            // The value resumed with replaces the one yielded.
+            if (!suspend(value, false)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            sp = stackTop;
+            LOAD_FRAME();
+            ENTER_JIT();
+            DISPATCH();
+        }
+        CASE(CALL_DIRECT) {
+            const global_index_t slot = READ_SHORT();
+            const int            argCount = READ_BYTE();
+            SPILL();
+            if (!callDirect(policy, slot, argCount)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            sp = stackTop;
+            ENTER_JIT();
+            DISPATCH();
+        }
+        CASE(GET_LOCAL_LOCAL) {
+            const uint8_t first = READ_BYTE();
+            const uint8_t second = READ_BYTE();
+            PUSH(slots[first]);
+            PUSH(slots[second]);
+            DISPATCH();
+        }
+        CASE(GET_LOCAL_CONSTANT) {
+            const uint8_t slot = READ_BYTE();
+            PUSH(slots[slot]);
+            PUSH(READ_CONSTANT());
+            DISPATCH();
+        }
+        CASE(GET_LOCAL_PROPERTY) {
+            const uint8_t slot = READ_BYTE();
+            PUSH(slots[slot]);
+            ObjString   *name = READ_STRING();
+            InlineCache &cache = READ_CACHE();
+            frame->ip = ip;
+            if (!getProperty(policy, PEEK(0), name, cache, sp[-1])) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            DISPATCH();
+        }
+        CASE(SET_PROPERTY_POP) {
+            ObjString   *name = READ_STRING();
+            InlineCache &cache = READ_CACHE();
+            frame->ip = ip;
+            if (!setProperty(PEEK(1), name, cache, PEEK(0))) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            sp -= 2;
+            DISPATCH();
+        }
+        CASE(JUMP_IF_FALSE_POP) {
+            const uint16_t offset = READ_SHORT();
+            if (isFalsey(PEEK(0))) {
+                ip += offset;
+            } else {
+                sp--;
+            }
+            DISPATCH();
+        }
+        CASE(LESS_JUMP_IF_FALSE) {
+            const uint16_t offset = READ_SHORT();
+            if (!is<double>(PEEK(0)) || !is<double>(PEEK(1))) {
+                frame->ip = ip;
+                runtimeError("Operands must be numbers.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            const double b = as<double>(POP());
+            const double a = as<double>(POP());
+            if (!(a < b)) {
+                PUSH(value<bool>(false)); // popped at the jump target.
+                ip += offset;
+            }
+            DISPATCH();
+        }
+        CASE(ADD_NUMBER) {
+            if (!is<double>(PEEK(0)) || !is<double>(PEEK(1))) {
+                DEQUICKEN(ADD);
+                DISPATCH();
+            }
+            const double b = as<double>(POP());
+            sp[-1] = value<double>(as<double>(sp[-1]) + b);
+            DISPATCH();
+        }
+        CASE(ADD_STRING) {
+            if (!is<ObjString>(PEEK(0)) || !is<ObjString>(PEEK(1))) {
+                DEQUICKEN(ADD);
+                DISPATCH();
+            }
+            stackTop = sp;
+            concatenate(policy);
+            sp--;
+            DISPATCH();
+        }
+        CASE(EQUAL_NUMBER) {
+            if (!is<double>(PEEK(0)) || !is<double>(PEEK(1))) {
+                DEQUICKEN(EQUAL);
+                DISPATCH();
+            }
+            const double b = as<double>(POP());
+            sp[-1] = value<bool>(as<double>(sp[-1]) == b);
+            DISPATCH();
+        }
+        CASE(NOT_EQUAL_NUMBER) {
+            if (!is<double>(PEEK(0)) || !is<double>(PEEK(1))) {
+                DEQUICKEN(NOT_EQUAL);
+                DISPATCH();
+            }
+            const double b = as<double>(POP());
+            sp[-1] = value<bool>(as<double>(sp[-1]) != b);
+            DISPATCH();
+        }
+        CASE(EQUAL_JUMP_IF_FALSE) {
+            const uint16_t offset = READ_SHORT();
+            const Value    b = POP();
+            const Value    a = POP();
+            if (!valuesEqual(a, b)) {
+                PUSH(value<bool>(false)); // popped at the jump target.
+                ip += offset;
+            }
+            DISPATCH();
         }
-        case OpCode::METHOD:
-            defineMethod(READ_STRING());
-            break;
         }
     }
 
+#undef LOAD_FRAME
+#undef SPILL
+#undef PUSH
+#undef POP
+#undef PEEK
 #undef READ_BYTE
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef READ_STRING
+#undef READ_CACHE
 #undef BINARY_OP
+#undef QUICKEN
+#undef DEQUICKEN
+#undef TRACE
+#undef ENTER_JIT
+#undef INTRINSIC
+#undef CASE
+#undef DISPATCH
 }
 
-InterpretResult VM::run(ObjFunction *function) {
+#ifdef COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+/**
+ * @brief The interpreter loop for the register code. The registers of a frame are its
+ * stack slots. stackTop is only set where a call or a stack helper needs it.
+ */
+template <ExecutionPolicy P> InterpretResult VM::runRegisters(P &policy) {
+    CallFrame *frame = &frames[frameCount - 1];
+    RegInstr  *pc = frame->pc;
+    Value     *reg = frame->slots;
+    Chunk     *chunk = &frame->closure->function->chunk;
+
+#define RK(operand)                                                                      \
+    (((operand)&RK_CONSTANT) ? chunk->get_value((operand) & ~RK_CONSTANT) : reg[operand])
+
+#define K_STRING(operand) as<ObjString *>(chunk->get_value(operand))
+
+#define LOAD_FRAME()                                                                     \
+    do {                                                                                 \
+        frame = &frames[frameCount - 1];                                                 \
+        pc = frame->pc;                                                                  \
+        reg = frame->slots;                                                              \
+        chunk = &frame->closure->function->chunk;                                        \
+    } while (false)
+
+#define ERROR(...)                                                                       \
+    do {                                                                                 \
+        frame->pc = pc;                                                                  \
+        runtimeError(__VA_ARGS__);                                                       \
+        return INTERPRET_RUNTIME_ERROR;                                                  \
+    } while (false)
+
+#define BINARY_OP(valueType, op)                                                         \
+    do {                                                                                 \
+        const Value b = RK(instr.b);                                                     \
+        const Value c = RK(instr.c);                                                     \
+        if (!is<double>(b) || !is<double>(c)) {                                          \
+            ERROR("Operands must be numbers.");                                          \
+        }                                                                                \
+        reg[instr.a] = valueType(as<double>(b) op as<double>(c));                        \
+    } while (false)
+
+    for (;;) {
+        if constexpr (P::enabled) {
+            policy.onRegInstruction(frame, pc);
+        }
+        const RegInstr instr = *pc++;
+        switch (instr.op) {
+        case RegOp::MOVE:
+            reg[instr.a] = RK(instr.b);
+            break;
+        case RegOp::LOADK:
+            reg[instr.a] = chunk->get_value(instr.b);
+            break;
+        case RegOp::GET_GLOBAL: {
+            const Value value = globals.get_value(instr.b);
+            if (value == UNDEFINED_VAL) {
+                ERROR("Undefined variable '{}'.", globals.get_name(instr.b)->str);
+            }
+            reg[instr.a] = value;
+            break;
+        }
+        case RegOp::DEFINE_GLOBAL:
+            globals.get_value(instr.a) = RK(instr.b);
+            break;
+        case RegOp::SET_GLOBAL: {
+            Value &value = globals.get_value(instr.a);
+            if (value == UNDEFINED_VAL) {
+                ERROR("Undefined variable '{}'.", globals.get_name(instr.a)->str);
+            }
+            value = RK(instr.b);
+            break;
+        }
+        case RegOp::GET_UPVALUE:
+            reg[instr.a] = *frame->closure->upvalues[instr.b].upvalue->location;
+            break;
+        case RegOp::SET_UPVALUE:
+            *frame->closure->upvalues[instr.a].upvalue->location = RK(instr.b);
+            break;
+        case RegOp::GET_CAPTURED:
+            reg[instr.a] = frame->closure->upvalues[instr.b].value;
+            break;
+        case RegOp::GET_PROPERTY: {
+            InlineCache &cache = chunk->get_cache((pc++)->a);
+            Value        result;
+            frame->pc = pc;
+            if (!getProperty(policy, reg[instr.b], K_STRING(instr.c), cache, result)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            reg[instr.a] = result;
+            break;
+        }
+        case RegOp::SET_PROPERTY: {
+            InlineCache &cache = chunk->get_cache((pc++)->a);
+            frame->pc = pc;
+            if (!setProperty(reg[instr.a], K_STRING(instr.c), cache, RK(instr.b))) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            break;
+        }
+        case RegOp::GET_SUPER: {
+            ObjString  *name = K_STRING((pc++)->a);
+            ObjClosure *method = as<ObjClass *>(reg[instr.c])->find_method(name);
+            if (method == nullptr) {
+                ERROR("Undefined property '{}'.", name->str);
+            }
+            reg[instr.a] = bindMethod(policy, reg[instr.b], method);
+            break;
+        }
+        case RegOp::EQUAL:
+            reg[instr.a] = value<bool>(valuesEqual(RK(instr.b), RK(instr.c)));
+            break;
+        case RegOp::NOT_EQUAL:
+            reg[instr.a] = value<bool>(!valuesEqual(RK(instr.b), RK(instr.c)));
+            break;
+        case RegOp::GREATER:
+            BINARY_OP(value<bool>, >);
+            break;
+        case RegOp::NOT_GREATER:
+            BINARY_OP(value<bool>, <=);
+            break;
+        case RegOp::LESS:
+            BINARY_OP(value<bool>, <);
+            break;
+        case RegOp::NOT_LESS:
+            BINARY_OP(value<bool>, >=);
+            break;
+        case RegOp::ADD: {
+            const Value b = RK(instr.b);
+            const Value c = RK(instr.c);
+            if (is<double>(b) && is<double>(c)) {
+                reg[instr.a] = value<double>(as<double>(b) + as<double>(c));
+            } else if (is<ObjString>(b) && is<ObjString>(c)) {
+                ObjString *result =
+                    newString(as<ObjString *>(b)->str + as<ObjString *>(c)->str);
+                if constexpr (P::enabled) {
+                    policy.onAllocate(result);
+                }
+                reg[instr.a] = value<Obj *>(result);
+            } else {
+                ERROR("Operands must be two numbers or two strings.");
+            }
+            break;
+        }
+        case RegOp::SUBTRACT:
+            BINARY_OP(value<double>, -);
+            break;
+        case RegOp::MULTIPLY:
+            BINARY_OP(value<double>, *);
+            break;
+        case RegOp::DIVIDE:
+            BINARY_OP(value<double>, /);
+            break;
+        case RegOp::NOT:
+            reg[instr.a] = value<bool>(isFalsey(RK(instr.b)));
+            break;
+        case RegOp::NEGATE: {
+            const Value b = RK(instr.b);
+            if (!is<double>(b)) {
+                ERROR("Operand must be a number.");
+            }
+            reg[instr.a] = value<double>(-as<double>(b));
+            break;
+        }
+        case RegOp::PRINT:
+            printValue(options.out, RK(instr.a));
+            options.out << '\n';
+            break;
+        case RegOp::JUMP:
+            pc += instr.offset();
+            break;
+        case RegOp::JUMP_IF_FALSE:
+            if (isFalsey(RK(instr.a))) {
+                pc += instr.offset();
+            }
+            break;
+        case RegOp::CALL:
+        case RegOp::TAIL_CALL:
+            stackTop = reg + instr.a + instr.b + 1;
+            frame->pc = pc;
+            if (!callValue(policy, reg[instr.a], instr.b, instr.op == RegOp::TAIL_CALL)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            break;
+        case RegOp::CALL_DIRECT:
+            stackTop = reg + instr.a + instr.b + 1;
+            frame->pc = pc;
+            if (!callDirect(policy, instr.c, instr.b)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            break;
+        case RegOp::INTRINSIC:
+            stackTop = reg + instr.a + intrinsics[intrinsicIndex(OpCode(instr.b))].arity;
+            frame->pc = pc;
+            if (!callIntrinsic(policy, OpCode(instr.b), instr.c)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            break;
+        case RegOp::INVOKE:
+        case RegOp::TAIL_INVOKE: {
+            InlineCache &cache = chunk->get_cache((pc++)->a);
+            const bool   tail = instr.op == RegOp::TAIL_INVOKE;
+            stackTop = reg + instr.a + instr.b + 1;
+            frame->pc = pc;
+            if (!invoke(policy, K_STRING(instr.c), instr.b, cache, tail)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            break;
+        }
+        case RegOp::SUPER_INVOKE: {
+            ObjClass *superclass = as<ObjClass *>(reg[instr.a + instr.b + 1]);
+            stackTop = reg + instr.a + instr.b + 1;
+            frame->pc = pc;
+            if (!invokeFromClass(policy, superclass, K_STRING(instr.c), instr.b)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            break;
+        }
+        case RegOp::CLOSURE: {
+            ObjFunction *function = as<ObjFunction *>(chunk->get_value(instr.b));
+            ObjClosure  *closure = newClosure(function);
+            if constexpr (P::enabled) {
+                policy.onAllocate(closure);
+            }
+            // Stored first, as a local function copies itself.
+            reg[instr.a] = value<Obj *>(closure);
+            for (int i = 0; i < closure->upvalueCount; i++) {
+                const RegInstr &upvalue = *pc++;
+                if (upvalue.a == CAPTURE_LOCAL) {
+                    Value *local = reg + upvalue.b;
+                    closure->upvalues[i].upvalue = captureUpvalue(policy, local);
+                } else if (upvalue.a == CAPTURE_LOCAL_COPY) {
+                    closure->upvalues[i].value = reg[upvalue.b];
+                } else {
+                    closure->upvalues[i] = frame->closure->upvalues[upvalue.b];
+                }
+            }
+            break;
+        }
+        case RegOp::CLOSE_UPVALUE:
+            closeUpvalues(reg + instr.a);
+            break;
+        case RegOp::RETURN: {
+            if constexpr (P::enabled) {
+                policy.onReturn(frame->closure);
+            }
+            const Value result = RK(instr.a);
+            closeUpvalues(frame->slots);
+            frameCount--;
+            if (frameCount == 0 && running == nullptr) {
+                returned = result;
+                stackTop = frame->slots;
+                frame->pc = pc;
+                return INTERPRET_OK;
+            }
+            if (frameCount == 0) {
+                // The coroutine's function returned, its resumer gets the result.
+                if (!suspend(result, true)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+            } else {
+                frame->slots[0] = result;
+            }
+            LOAD_FRAME();
+            break;
+        }
+        case RegOp::YIELD: {
+            const Value value = reg[instr.a];
+            stackTop = reg + instr.a + 1;
+            if (running == nullptr) {
+                ERROR("Can't yield outside a coroutine.");
+            }
+            frame->pc = pc;
+            if (!suspend(value, false)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            break;
+        }
+        case RegOp::THROW: {
+            const Value exception = RK(instr.a);
+            frame->pc = pc;
+            if (!throwValue(exception)) {
+                uncaught(exception);
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            break;
+        }
+        case RegOp::CLASS: {
+            ObjClass *klass = newClass(K_STRING(instr.b));
+            if constexpr (P::enabled) {
+                policy.onAllocate(klass);
+            }
+            reg[instr.a] = value<Obj *>(klass);
+            break;
+        }
+        case RegOp::INHERIT: {
+            const Value superclass = reg[instr.a];
+            if (!is<ObjClass>(superclass)) {
+                ERROR("Superclass must be a class.");
+            }
+            ObjClass *subclass = as<ObjClass *>(reg[instr.b]);
+            subclass->inherit(as<ObjClass *>(superclass));
+            break;
+        }
+        case RegOp::METHOD:
+            defineMethod(as<ObjClass *>(reg[instr.a]), K_STRING(instr.c), RK(instr.b));
+            break;
+        case RegOp::EXTRA:
+            break;
+        }
+    }
 
+#undef RK
+#undef K_STRING
+#undef LOAD_FRAME
+#undef ERROR
+#undef BINARY_OP
+}
+
+template <ExecutionPolicy P>
+InterpretResult VM::execute(P &policy, ObjClosure *closure, int argCount) {
+    if (!call(policy, closure, argCount)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    if (options.debug_code && !options.trace) {
+        return INTERPRET_OK;
+    }
+    if constexpr (std::is_same_v<P, PlainPolicy>) {
+        if (closure->function->aot != nullptr) {
+            // The AOT code can't start at a handler or after a coroutine switch, so the
+            // interpreter runs on from there.
+            AotFrame frame(*this);
+            if (frame.run()) {
+                return INTERPRET_OK;
+            }
+            if (!restart) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+        }
+    }
+    // There is no register code if the compiler found an error.
+    running_registers =
+        options.registers && !closure->function->chunk.get_registers().empty();
+    auto loop = [this, &policy] {
+        if (running_registers) {
+            return runRegisters(policy);
+        }
+#ifdef COMPUTED_GOTO
+        if (!options.switch_dispatch) {
+            return run<Dispatch::Threaded>(policy);
+        }
+#endif
+        return run<Dispatch::Switch>(policy);
+    };
+    // A runtime error caught by a try block leaves the loop, which starts again at the
+    // handler.
+    for (;;) {
+        restart = false;
+        const InterpretResult result = loop();
+        if (result != INTERPRET_RUNTIME_ERROR || !restart) {
+            return result;
+        }
+    }
+}
+
+/**
+ * @brief Run the top level function, choosing the execution policy once for the whole
+ * run.
+ */
+InterpretResult VM::run(ObjFunction *function) {
+    const Heap::Scope scope(heap);
     push(value<Obj *>(function));
     ObjClosure *closure = newClosure(function);
     pop();
     push(value<Obj *>(closure));
-    call(closure, 0);
 
-    if (options.debug_code && !options.trace) {
-        return INTERPRET_OK;
+    if (hooks != nullptr) {
+        HookPolicy policy(*hooks);
+        return execute(policy, closure);
+    }
+    if (options.trace) {
+        TracePolicy policy(*this);
+        return execute(policy, closure);
+    }
+    if (options.profile) {
+        ProfilePolicy policy;
+        const auto    result = execute(policy, closure);
+        policy.report(options.err);
+        return result;
+    }
+    if (options.coverage) {
+        CoveragePolicy policy;
+        const auto     result = execute(policy, closure);
+        policy.report(options.err);
+        return result;
     }
-    return run();
+    PlainPolicy policy;
+    return execute(policy, closure);
+}
+
+InterpretResult VM::run(ObjClosure *closure, const std::vector<Value> &args,
+                        Value &result) {
+    const Heap::Scope scope(heap);
+    push(value<Obj *>(closure));
+    for (const Value arg : args) {
+        push(arg);
+    }
+    PlainPolicy           policy;
+    const InterpretResult status = execute(policy, closure, int(args.size()));
+    result = returned;
+    return status;
+}
+
+void VM::addProgram(const std::string &source, ObjFunction *script) {
+    programs.add(source, script);
 }
 
-} // namespace alox
\ No newline at end of file
+} // namespace alox
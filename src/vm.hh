@@ -4,27 +4,63 @@
 
 #pragma once
 
+#include <array>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include "error.hh"
+#include "event_loop.hh"
+#include "globals.hh"
+#include "heap.hh"
+#include "jit.hh"
 #include "object.hh"
 #include "options.hh"
+#include "parallel.hh"
 #include "table.hh"
 #include "value.hh"
+#include "vm_policy.hh"
 
 namespace alox {
 
+class AotFrame;
 class Compiler;
 
-constexpr auto FRAMES_MAX = 64;
-constexpr auto STACK_MAX = (FRAMES_MAX * UINT8_COUNT);
+// The stacks start this size and double when a call needs more, up to
+// Options::max_frames frames.
+constexpr size_t FRAMES_INITIAL = 16;
+constexpr size_t STACK_INITIAL = 256;
+
+// A runtime error prints the innermost frames of the traceback, and counts the rest.
+constexpr int TRACE_FRAMES = 64;
 
 struct CallFrame {
     ObjClosure *closure;
     uint8_t    *ip;
+    RegInstr   *pc; // for the register VM
     Value      *slots;
 };
 
+// The stacks of a coroutine. They are swapped with the VM's when it is resumed and when
+// it yields or returns, so the values and frames are never copied.
+struct CoroutineStacks {
+    CoroutineStacks()
+        : frames(FRAMES_INITIAL), stack(STACK_INITIAL), stackTop(stack.data()){};
+
+    std::vector<CallFrame> frames;
+    int                    frameCount{0};
+    std::vector<Value>     stack;
+    Value                 *stackTop;
+    ObjUpvalue            *openUpvalues{nullptr};
+};
+
+/**
+ * @brief How the interpreter loop moves from one instruction to the next.
+ *
+ * Threaded uses computed goto and is only available when built with COMPUTED_GOTO.
+ */
+enum class Dispatch { Switch, Threaded };
+
 enum InterpretResult {
     INTERPRET_OK,
     INTERPRET_PARSE_ERROR,
@@ -34,17 +70,34 @@ enum InterpretResult {
 
 class VM {
   public:
-    VM(const Options &opt) : options(opt){};
+    VM(const Options &opt) : options(opt), frames(FRAMES_INITIAL), stack(STACK_INITIAL){};
     ~VM() = default;
 
     void init();
     void free();
 
     void            set_error_manager(ErrorManager *err) { errors = err; }
+    void            set_hooks(VMHooks *h) { hooks = h; }
+    Globals        &get_globals() { return globals; }
+    Heap           &get_heap() { return heap; }
     InterpretResult run(ObjFunction *function);
+    // Call closure with args on a VM that isn't running, as a worker does for spawn().
+    InterpretResult run(ObjClosure *closure, const std::vector<Value> &args,
+                        Value &result);
+
+    // Each compiled program is added, for the workers to compile again.
+    void      addProgram(const std::string &source, ObjFunction *script);
+    Programs &get_programs() { return programs; }
+    void      set_worker() { worker = true; }
+
+    void traceExecution(CallFrame *frame, uint8_t *ip);
+    void traceRegisters(CallFrame *frame, RegInstr *pc);
 
   private:
+    friend class AotFrame;
+
     void resetStack();
+    void growStack(size_t size);
 
     constexpr void push(const Value value) noexcept {
         *stackTop = value;
@@ -59,39 +112,137 @@ class VM {
     }
 
     template <typename... T> void runtimeError(const char *format, const T &...msg);
+    void                          reportError(const std::string &message);
+    void                          uncaught(Value exception);
+    bool                          throwValue(Value exception);
+    const ExceptionHandler       *frameHandler(const CallFrame &frame) const;
 
     void def_stdlib();
+    void def_io();
+    void def_parallel();
     void defineNative(const std::string &name, NativeFn function);
-
-    bool        call(ObjClosure *closure, int argCount);
-    bool        callValue(Value callee, int argCount);
-    bool        invokeFromClass(ObjClass *klass, ObjString *name, int argCount);
-    bool        invoke(ObjString *name, int argCount);
-    bool        bindMethod(ObjClass *klass, ObjString *name);
-    ObjUpvalue *captureUpvalue(Value *local);
-    void        closeUpvalues(Value const *last);
-    void        defineMethod(ObjString *name);
+    void defineNative(const std::string &name, VmNativeFn function);
+    // For a VmNativeFn: its result replaces the callee and arguments, or the error is
+    // raised and false returned.
+    bool nativeResult(int argCount, Value result);
+    bool nativeError(const std::string &message);
+
+    // These take the execution policy so that calls and allocations can be hooked. A
+    // tail call of a closure replaces the caller's frame.
+    template <ExecutionPolicy P>
+    bool call(P &policy, ObjClosure *closure, int argCount, bool tail = false);
+    template <ExecutionPolicy P>
+    bool pushFrame(P &policy, ObjClosure *closure, int argCount, bool tail);
+    template <ExecutionPolicy P>
+    bool callDirect(P &policy, global_index_t slot, int argCount);
+    template <OpCode op> bool intrinsic(Value *args);
+    bool                      intrinsic(OpCode op, Value *args);
+    template <ExecutionPolicy P>
+    bool callIntrinsic(P &policy, OpCode op, global_index_t slot);
+    template <ExecutionPolicy P>
+    bool callValue(P &policy, Value callee, int argCount, bool tail = false);
+    template <ExecutionPolicy P>
+    bool resume(P &policy, ObjCoroutine *coroutine, int argCount);
+    void enterCoroutine(ObjCoroutine *coroutine);
+    void leaveCoroutine(bool done);
+    void swapStacks(CoroutineStacks &other);
+    bool suspend(Value result, bool done);
+    bool schedule();
+    bool wait(int argCount, int fd, EventLoop::Event event);
+    template <ExecutionPolicy P>
+    bool invokeFromClass(P &policy, ObjClass *klass, ObjString *name, int argCount);
+    template <ExecutionPolicy P>
+    bool invoke(P &policy, ObjString *name, int argCount, InlineCache &cache,
+                bool tail = false);
+    template <ExecutionPolicy P>
+    bool bindMethod(P &policy, ObjClass *klass, ObjString *name);
+    template <ExecutionPolicy P>
+    Value bindMethod(P &policy, Value receiver, ObjClosure *method);
+    template <ExecutionPolicy P>
+    bool getProperty(P &policy, Value receiver, ObjString *name, InlineCache &cache,
+                     Value &result);
+    bool setProperty(Value receiver, ObjString *name, InlineCache &cache, Value value);
+    template <ExecutionPolicy P> ObjUpvalue *captureUpvalue(P &policy, Value *local);
+    template <ExecutionPolicy P> void        concatenate(P &policy);
+
+    void closeUpvalues(Value const *last);
+    void defineMethod(ObjClass *klass, ObjString *name, Value method);
 
     static constexpr bool isFalsey(const Value value) noexcept {
         return is<nullptr_t>(value) || (is<bool>(value) && !as<bool>(value));
     };
-    void            concatenate();
-    InterpretResult run();
+
+    // The JIT and AOT code call back into the VM for the instructions they don't do
+    // inline.
+    enum class NativeCall {
+        Error,
+        Returned, // a native function, or a class without init, has been called.
+        Entered,  // the top frame is the callee's, new or the caller's after a tail call.
+        Switched, // a coroutine was resumed, the stacks are its own.
+    };
+    bool       nativeInstruction(OpCode op, uint8_t *ip);
+    NativeCall nativeCall(OpCode op, uint8_t *ip);
+    bool       nativeReturn(uint8_t *ip);
+
+    void    countHot(ObjFunction *function);
+    JitExit runJit();
+    template <OpCode op>
+    static Value *jitHandler(VM *vm, Value *sp, uint8_t *ip);
+    static Value *jitExit(VM *vm, Value *sp, uint8_t *ip);
+    JitJump       jitJump(OpCode op, uint8_t *ip);
+    template <OpCode op>
+    static JitJump jitJumpHandler(VM *vm, Value *sp, uint8_t *ip);
+    static JitHandlers jitHandlers();
+
+    template <ExecutionPolicy P>
+    InterpretResult execute(P &policy, ObjClosure *closure, int argCount = 0);
+    template <Dispatch D, ExecutionPolicy P> InterpretResult run(P &policy);
+    template <ExecutionPolicy P> InterpretResult             runRegisters(P &policy);
 
     int addConstant(Value value);
 
     const Options &options;
-    ErrorManager  *errors;
-
-    CallFrame frames[FRAMES_MAX];
-    int       frameCount;
-
-    Value  stack[STACK_MAX];
-    Value *stackTop;
-    Table  globals;
+    Heap           heap; // freed after the other members.
+    ErrorManager  *errors{nullptr};
+    VMHooks       *hooks{nullptr};
+    bool           running_registers{false};
+    // The frames changed under compiled code, by a caught runtime error or a coroutine
+    // switch: the interpreter runs on from the top frame.
+    bool           restart{false};
+
+    std::unique_ptr<Jit> jit;
+    JitExit              jit_exit{JitExit::Interpret};
+
+    // Frames and their slots are moved when the stacks grow, so pointers to them are not
+    // kept across a call.
+    std::vector<CallFrame> frames;
+    int                    frameCount;
+
+    std::vector<Value> stack;
+    Value             *stackTop;
+    Globals            globals;
 
     ObjString  *initString{nullptr}; // name of LOX class constructor method.
-    ObjUpvalue *openUpvalues;
+    ObjUpvalue *openUpvalues{nullptr};
+
+    // The coroutine whose stacks are the VM's, nullptr for the script's.
+    ObjCoroutine *running{nullptr};
+    EventLoop     loop;
+    ObjClass     *objectClass{nullptr}; // of the results of natives with fields.
+
+    // What the function run last returned.
+    Value returned{NIL_VAL};
+
+    // The spawned functions not yet joined, by handle, and the workers that run them.
+    Programs                                      programs;
+    std::unique_ptr<WorkerPool>                   workers;
+    std::unordered_map<int, std::shared_ptr<Job>> jobs;
+    int                                           lastJob{0};
+    bool                                          worker{false}; // a worker's VM.
+
+    // The natives of the intrinsic opcodes, and the strings made by chr.
+    std::array<Value, intrinsics.size()>   natives{};
+    std::array<ObjString *, UINT8_MAX + 1> characters{};
 
     // std::unique_ptr<Compiler> compiler;
 };
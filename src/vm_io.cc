@@ -0,0 +1,250 @@
+//
+// ALOX-CC
+//
+
+#include "object.hh"
+#include "value.hh"
+#include "vm.hh"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace alox {
+
+namespace {
+
+// A descriptor passed to a native, or -1.
+int descriptor(Value v) {
+    if (!is<double>(v)) {
+        return -1;
+    }
+    const double fd = as<double>(v);
+    return fd >= 0 && fd <= INT_MAX && fd == std::trunc(fd) ? int(fd) : -1;
+}
+
+// The call would have blocked, or was interrupted: it is made again when fd is ready.
+bool again() {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+// A descriptor the natives didn't open, such as stdin, may block the VM. A task waits
+// for it to be ready before a call on it.
+bool blocking(int fd) {
+    const int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && (flags & O_NONBLOCK) == 0;
+}
+
+// The most read() returns at once.
+constexpr size_t READ_MAX = size_t(64) * 1024;
+
+} // namespace
+
+/**
+ * @brief The natives of the event loop: tasks, timers, and I/O on descriptors that
+ * never blocks the VM while another task can run. The descriptors these natives open
+ * are non-blocking, and others are polled first; a task waits for one to be ready, see
+ * VM::wait().
+ */
+void VM::def_io() {
+    static constexpr auto arity = [](VM &vm, int argCount, int expected) {
+        return argCount == expected ||
+               vm.nativeError(fmt::format("Expected {:d} arguments but got {:d}.",
+                                          expected, argCount));
+    };
+    static constexpr auto inTask = [](const VM &vm) {
+        return vm.running != nullptr && vm.running->task;
+    };
+
+    // task(f) runs f when run() is called, with the other tasks.
+    defineNative("task", [](VM &vm, int argCount) {
+        if (!arity(vm, argCount, 1)) {
+            return false;
+        }
+        const Value function = vm.peek(0);
+        if (!is<ObjClosure>(function) ||
+            as<ObjClosure *>(function)->function->arity != 0) {
+            return vm.nativeError("A task must be a function without parameters.");
+        }
+        ObjCoroutine *task = newCoroutine(function);
+        task->task = true;
+        vm.loop.add(task);
+        return vm.nativeResult(argCount, value<Obj *>(task));
+    });
+
+    // run() runs the tasks until they have all returned.
+    defineNative("run", [](VM &vm, int argCount) {
+        if (!arity(vm, argCount, 0)) {
+            return false;
+        }
+        if (inTask(vm)) {
+            return vm.nativeError("Can't run the event loop in a task.");
+        }
+        // The callee's slot gets nil when the last task returns.
+        vm.stackTop -= argCount + 1;
+        return vm.schedule();
+    });
+
+    // sleep(ms) lets the other tasks run for ms milliseconds.
+    defineNative("sleep", [](VM &vm, int argCount) {
+        if (!arity(vm, argCount, 1)) {
+            return false;
+        }
+        if (!is<double>(vm.peek(0)) || !(as<double>(vm.peek(0)) >= 0) ||
+            !std::isfinite(as<double>(vm.peek(0)))) {
+            return vm.nativeError("Expected a number of milliseconds.");
+        }
+        const double ms = std::min(as<double>(vm.peek(0)), EventLoop::SLEEP_MAX);
+        if (!inTask(vm)) {
+            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(ms));
+            return vm.nativeResult(argCount, NIL_VAL);
+        }
+        vm.stackTop -= argCount;
+        vm.stackTop[-1] = NIL_VAL;
+        vm.loop.sleep(vm.running, ms);
+        vm.leaveCoroutine(false);
+        return vm.schedule();
+    });
+
+    // pipe() returns an Object with the descriptors of its read and write ends.
+    defineNative("pipe", [](VM &vm, int argCount) {
+        if (!arity(vm, argCount, 0)) {
+            return false;
+        }
+        int fds[2];
+        if (::pipe(fds) != 0) {
+            return vm.nativeError(
+                fmt::format("Can't make a pipe: {}.", std::strerror(errno)));
+        }
+        for (const int fd : fds) {
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        ObjInstance *ends = newInstance(vm.objectClass);
+        ends->set_field(newString("read"), value<double>(fds[0]));
+        ends->set_field(newString("write"), value<double>(fds[1]));
+        return vm.nativeResult(argCount, value<Obj *>(ends));
+    });
+
+    // open(path, mode) returns a descriptor for reading ("r"), writing ("w") or
+    // appending ("a") to a file.
+    defineNative("open", [](VM &vm, int argCount) {
+        if (!arity(vm, argCount, 2)) {
+            return false;
+        }
+        if (!is<ObjString>(vm.peek(1)) || !is<ObjString>(vm.peek(0))) {
+            return vm.nativeError("Expected a path and a mode.");
+        }
+        const std::string &path = as<ObjString *>(vm.peek(1))->str;
+        const std::string &mode = as<ObjString *>(vm.peek(0))->str;
+        int                flags = 0;
+        if (mode == "r") {
+            flags = O_RDONLY;
+        } else if (mode == "w") {
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+        } else if (mode == "a") {
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+        } else {
+            return vm.nativeError("Expected a mode of \"r\", \"w\" or \"a\".");
+        }
+        const int fd = ::open(path.c_str(), flags | O_NONBLOCK | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            return vm.nativeError(
+                fmt::format("Can't open {}: {}.", path, std::strerror(errno)));
+        }
+        return vm.nativeResult(argCount, value<double>(fd));
+    });
+
+    // read(fd, size) returns up to size bytes once there are some, or nil at the end.
+    defineNative("read", [](VM &vm, int argCount) {
+        if (!arity(vm, argCount, 2)) {
+            return false;
+        }
+        const int   fd = descriptor(vm.peek(1));
+        const Value size = vm.peek(0);
+        if (fd < 0 || !is<double>(size) || !(as<double>(size) >= 1)) {
+            return vm.nativeError("Expected a descriptor and a number of bytes.");
+        }
+        if (inTask(vm) && blocking(fd) &&
+            !EventLoop::available(fd, EventLoop::Event::Read)) {
+            return vm.wait(argCount, fd, EventLoop::Event::Read);
+        }
+        std::string   buffer(size_t(std::min(as<double>(size), double(READ_MAX))), '\0');
+        const ssize_t count = ::read(fd, buffer.data(), buffer.size());
+        if (count < 0 && again()) {
+            return vm.wait(argCount, fd, EventLoop::Event::Read);
+        }
+        if (count < 0) {
+            return vm.nativeError(
+                fmt::format("Can't read from {:d}: {}.", fd, std::strerror(errno)));
+        }
+        if (count == 0) {
+            return vm.nativeResult(argCount, NIL_VAL);
+        }
+        buffer.resize(size_t(count));
+        return vm.nativeResult(argCount, value<Obj *>(newString(buffer)));
+    });
+
+    // write(fd, s) writes as much of s as fd takes once it takes some, and returns the
+    // number of bytes written.
+    defineNative("write", [](VM &vm, int argCount) {
+        if (!arity(vm, argCount, 2)) {
+            return false;
+        }
+        const int fd = descriptor(vm.peek(1));
+        if (fd < 0 || !is<ObjString>(vm.peek(0))) {
+            return vm.nativeError("Expected a descriptor and a string.");
+        }
+        const std::string &text = as<ObjString *>(vm.peek(0))->str;
+        if (text.empty()) {
+            return vm.nativeResult(argCount, value<double>(0));
+        }
+        // A blocking descriptor that is ready takes PIPE_BUF bytes without blocking.
+        size_t length = text.size();
+        if (inTask(vm) && blocking(fd)) {
+            if (!EventLoop::available(fd, EventLoop::Event::Write)) {
+                return vm.wait(argCount, fd, EventLoop::Event::Write);
+            }
+            length = std::min<size_t>(length, PIPE_BUF);
+        }
+        const ssize_t count = ::write(fd, text.data(), length);
+        if (count < 0 && again()) {
+            return vm.wait(argCount, fd, EventLoop::Event::Write);
+        }
+        if (count < 0) {
+            return vm.nativeError(
+                fmt::format("Can't write to {:d}: {}.", fd, std::strerror(errno)));
+        }
+        return vm.nativeResult(argCount, value<double>(double(count)));
+    });
+
+    // close(fd) closes a descriptor. The tasks waiting on it run again, to find it
+    // closed.
+    defineNative("close", [](VM &vm, int argCount) {
+        if (!arity(vm, argCount, 1)) {
+            return false;
+        }
+        const int fd = descriptor(vm.peek(0));
+        if (fd < 0) {
+            return vm.nativeError("Expected a descriptor.");
+        }
+        vm.loop.close(fd);
+        if (::close(fd) != 0) {
+            return vm.nativeError(
+                fmt::format("Can't close {:d}: {}.", fd, std::strerror(errno)));
+        }
+        return vm.nativeResult(argCount, NIL_VAL);
+    });
+}
+
+} // namespace alox
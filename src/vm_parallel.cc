@@ -0,0 +1,176 @@
+//
+// ALOX-CC
+//
+
+#include "object.hh"
+#include "parallel.hh"
+#include "value.hh"
+#include "vm.hh"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace alox {
+
+namespace {
+
+// The first global named in the code of the functions, or of the functions they reach
+// through their constants and the globals they name, that isn't copied to a worker, or
+// nullptr. Those undefined in the spawning VM are undefined in the worker too.
+ObjString *uncopiedGlobal(Globals &globals, const std::vector<bool> &copied,
+                          std::vector<ObjFunction *> pending) {
+    std::unordered_set<ObjFunction *> seen(pending.begin(), pending.end());
+    auto reach = [&](ObjFunction *function) {
+        if (seen.insert(function).second) {
+            pending.push_back(function);
+        }
+    };
+    while (!pending.empty()) {
+        Chunk &chunk = pending.back()->chunk;
+        pending.pop_back();
+        for (size_t n = 0; n < chunk.get_constants().get_count(); n++) {
+            if (const Value constant = chunk.get_value(const_index_t(n));
+                is<ObjFunction>(constant)) {
+                reach(as<ObjFunction *>(constant));
+            }
+        }
+        for (size_t offset = 0; offset < chunk.get_count();
+             offset += chunk.instruction_length(offset)) {
+            const auto op = OpCode(chunk.get_code(offset));
+            if (op != OpCode::GET_GLOBAL && op != OpCode::SET_GLOBAL &&
+                op != OpCode::CALL_DIRECT) {
+                continue;
+            }
+            const auto slot = global_index_t(
+                (chunk.get_code(offset + 1) << UINT8_WIDTH) | chunk.get_code(offset + 2));
+            const Value global = globals.get_value(slot);
+            if (global == UNDEFINED_VAL || is<ObjNative>(global)) {
+                continue; // the natives are the worker's own.
+            }
+            if (!copied[slot]) {
+                return globals.get_name(slot);
+            }
+            if (is<ObjClosure>(global)) {
+                reach(as<ObjClosure *>(global)->function);
+            } else if (is<ObjClass>(global)) {
+                for (const auto &method : as<ObjClass *>(global)->get_methods()) {
+                    reach(method.closure->function);
+                }
+            }
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+/**
+ * @brief spawn() and join(): functions run in parallel on the VMs of a WorkerPool, made
+ * at the first spawn with Options::workers workers, or one for each core. A spawned
+ * function sees copies of the globals as they were when it was spawned, and nothing it
+ * does to them is seen by the spawning VM. A function whose code uses a global that
+ * can't be copied, such as an instance, isn't spawned. Only the result comes back.
+ */
+void VM::def_parallel() {
+    // spawn(f, args...) starts f(args...) on a worker, and returns the handle to join.
+    defineNative("spawn", [](VM &vm, int argCount) {
+        if (argCount < 1) {
+            return vm.nativeError("Expected at least 1 argument but got 0.");
+        }
+        if (vm.worker) {
+            return vm.nativeError("Can't spawn in a spawned function.");
+        }
+        const Value *args = vm.stackTop - argCount;
+        const auto   function = vm.programs.copy(args[0]);
+        if (!is<ObjClosure>(args[0]) || !function) {
+            return vm.nativeError("Can only spawn functions that capture no variables.");
+        }
+        const int arity = as<ObjClosure *>(args[0])->function->arity;
+        if (arity != argCount - 1) {
+            return vm.nativeError(fmt::format("Expected {:d} arguments but got {:d}.",
+                                              arity, argCount - 1));
+        }
+
+        auto job = std::make_shared<Job>();
+        job->sources = vm.programs.get_sources();
+        job->function = std::get<FunctionRef>(*function);
+        std::vector<ObjFunction *> code{as<ObjClosure *>(args[0])->function};
+        for (int i = 1; i < argCount; i++) {
+            auto copy = vm.programs.copy(args[i]);
+            if (!copy) {
+                return vm.nativeError("Can only pass numbers, booleans, nil, strings, "
+                                      "functions and classes to a spawned function.");
+            }
+            job->args.push_back(std::move(*copy));
+            if (is<ObjClosure>(args[i])) {
+                code.push_back(as<ObjClosure *>(args[i])->function);
+            } else if (is<ObjClass>(args[i])) {
+                for (const auto &method : as<ObjClass *>(args[i])->get_methods()) {
+                    code.push_back(method.closure->function);
+                }
+            }
+        }
+        std::vector<bool> copied(vm.globals.get_count());
+        for (size_t slot = 0; slot < vm.globals.get_count(); slot++) {
+            const Value global = vm.globals.get_value(global_index_t(slot));
+            if (global == UNDEFINED_VAL) {
+                continue;
+            }
+            if (auto copy = vm.programs.copy(global)) {
+                job->globals.emplace_back(global_index_t(slot), std::move(*copy));
+                copied[slot] = true;
+            }
+        }
+        if (ObjString *name = uncopiedGlobal(vm.globals, copied, std::move(code))) {
+            return vm.nativeError(fmt::format(
+                "Can't spawn a function that uses '{}', which can't be copied.",
+                name->str));
+        }
+
+        if (!vm.workers) {
+            const size_t count =
+                vm.options.workers != 0
+                    ? vm.options.workers
+                    : std::max(1U, std::thread::hardware_concurrency());
+            vm.workers = std::make_unique<WorkerPool>(vm.options, count);
+        }
+        vm.workers->spawn(job);
+        vm.jobs[++vm.lastJob] = job;
+        return vm.nativeResult(argCount, value<double>(vm.lastJob));
+    });
+
+    // join(handle) waits for a spawned function, prints what it printed, and returns its
+    // result or raises its runtime error.
+    defineNative("join", [](VM &vm, int argCount) {
+        if (argCount != 1) {
+            return vm.nativeError(
+                fmt::format("Expected 1 arguments but got {:d}.", argCount));
+        }
+        // Checked before it is converted, as a handle out of range has no int.
+        const Value  handle = vm.peek(0);
+        const double number = is<double>(handle) ? as<double>(handle) : 0;
+        const bool   valid =
+            number >= 1 && number <= vm.lastJob && number == std::trunc(number);
+        const auto job = valid ? vm.jobs.find(int(number)) : vm.jobs.end();
+        if (job == vm.jobs.end()) {
+            return vm.nativeError(
+                "Expected the handle of a spawned function not joined.");
+        }
+        const std::shared_ptr<Job> joined = job->second;
+        vm.jobs.erase(job);
+        vm.workers->join(joined);
+        vm.options.out << joined->output;
+        if (!joined->result) {
+            return vm.nativeError(joined->error);
+        }
+        return vm.nativeResult(argCount, vm.programs.make(*joined->result));
+    });
+}
+
+} // namespace alox
@@ -0,0 +1,118 @@
+//
+// ALOX-CC
+//
+
+#include <algorithm>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "debug.hh"
+#include "vm.hh"
+#include "vm_policy.hh"
+
+namespace alox {
+
+static std::string function_name(ObjFunction *function) {
+    return function->name != nullptr ? function->name->str : "<script>";
+}
+
+void TracePolicy::onInstruction(CallFrame *frame, uint8_t *ip) {
+    vm.traceExecution(frame, ip);
+}
+
+void TracePolicy::onRegInstruction(CallFrame *frame, RegInstr *pc) {
+    vm.traceRegisters(frame, pc);
+}
+
+constexpr auto PROFILE_SEQUENCES = 12;
+
+// The most frequent sequences of length opcodes, indexed by the opcodes in base
+// OPCODE_COUNT.
+template <typename C>
+static void report_sequences(std::ostream &os, const C &counts, size_t length) {
+    std::vector<std::pair<size_t, size_t>> sequences;
+    for (size_t i = 0; i < counts.size(); i++) {
+        if (counts[i] != 0) {
+            sequences.emplace_back(counts[i], i);
+        }
+    }
+    if (sequences.empty()) {
+        return;
+    }
+    std::ranges::sort(sequences, std::greater{});
+    if (sequences.size() > PROFILE_SEQUENCES) {
+        sequences.resize(PROFILE_SEQUENCES);
+    }
+    os << fmt::format("-- {} instruction sequences --\n", length);
+    for (auto [count, index] : sequences) {
+        std::string name;
+        for (size_t i = 0; i < length; i++) {
+            name.insert(0, std::string(opcodeName(OpCode(index % OPCODE_COUNT))) + ' ');
+            index /= OPCODE_COUNT;
+        }
+        os << fmt::format("{:<44} {:>12d}\n", name, count);
+    }
+}
+
+void ProfilePolicy::report(std::ostream &os) const {
+    os << "== profile ==\n";
+    std::vector<std::pair<size_t, size_t>> ops;
+    for (size_t i = 0; i < instructions.size(); i++) {
+        if (instructions[i] != 0) {
+            ops.emplace_back(instructions[i], i);
+        }
+    }
+    std::ranges::sort(ops, std::greater{});
+    for (auto [count, op] : ops) {
+        os << fmt::format("{:<16} {:>12d}\n", opcodeName(OpCode(op)), count);
+    }
+    ops.clear();
+    for (size_t i = 0; i < reg_instructions.size(); i++) {
+        if (reg_instructions[i] != 0) {
+            ops.emplace_back(reg_instructions[i], i);
+        }
+    }
+    if (!ops.empty()) {
+        std::ranges::sort(ops, std::greater{});
+        os << "-- register instructions --\n";
+        for (auto [count, op] : ops) {
+            os << fmt::format("{:<16} {:>12d}\n", regopName(RegOp(op)), count);
+        }
+    }
+    report_sequences(os, pairs, 2);
+    report_sequences(os, triples, 3);
+    std::map<std::string, size_t> by_name;
+    for (auto [function, count] : calls) {
+        by_name[function_name(function)] += count;
+    }
+    for (auto const &[name, count] : by_name) {
+        os << fmt::format("{:<16} {:>12d} calls\n", name, count);
+    }
+    os << fmt::format("{:<16} {:>12d}\n", "allocations", allocations);
+}
+
+void CoveragePolicy::onInstruction(CallFrame *frame, uint8_t *ip) {
+    ObjFunction *function = frame->closure->function;
+    lines[function_name(function)].insert(
+        function->chunk.get_line(ip - function->chunk.get_code()));
+}
+
+void CoveragePolicy::onRegInstruction(CallFrame *frame, RegInstr *pc) {
+    ObjFunction   *function = frame->closure->function;
+    RegisterChunk &registers = function->chunk.get_registers();
+    lines[function_name(function)].insert(registers.get_line(pc - registers.get_code()));
+}
+
+void CoveragePolicy::report(std::ostream &os) const {
+    os << "== coverage ==\n";
+    for (auto const &[name, executed] : lines) {
+        os << name << ':';
+        for (auto line : executed) {
+            os << ' ' << line;
+        }
+        os << '\n';
+    }
+}
+
+} // namespace alox
@@ -0,0 +1,156 @@
+//
+// ALOX-CC
+//
+
+#pragma once
+
+#include <array>
+#include <concepts>
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "chunk.hh"
+#include "object.hh"
+#include "register.hh"
+
+namespace alox {
+
+class VM;
+struct CallFrame;
+
+/**
+ * @brief Hooks for embedders, called from the interpreter loop when set with
+ * VM::set_hooks(). Override the events of interest.
+ */
+class VMHooks {
+  public:
+    virtual ~VMHooks() = default;
+
+    virtual void onInstruction(CallFrame * /*frame*/, uint8_t * /*ip*/) {}
+    virtual void onRegInstruction(CallFrame * /*frame*/, RegInstr * /*pc*/) {}
+    virtual void onCall(ObjClosure * /*closure*/) {}
+    virtual void onReturn(ObjClosure * /*closure*/) {}
+    virtual void onAllocate(Obj * /*obj*/) {}
+};
+
+/**
+ * @brief An execution policy for VM::run. The loop is instantiated once per policy and
+ * the hooks are only called when enabled is true, so the plain loop has no
+ * instrumentation at all. The register loop calls onRegInstruction in place of
+ * onInstruction.
+ */
+template <typename P>
+concept ExecutionPolicy = requires(P p, CallFrame *frame, uint8_t *ip, RegInstr *pc,
+                                   ObjClosure *closure, Obj *obj) {
+        { P::enabled } -> std::convertible_to<bool>;
+        p.onInstruction(frame, ip);
+        p.onRegInstruction(frame, pc);
+        p.onCall(closure);
+        p.onReturn(closure);
+        p.onAllocate(obj);
+    };
+
+class PlainPolicy {
+  public:
+    static constexpr bool enabled = false;
+
+    void onInstruction(CallFrame * /*frame*/, uint8_t * /*ip*/) {}
+    void onRegInstruction(CallFrame * /*frame*/, RegInstr * /*pc*/) {}
+    void onCall(ObjClosure * /*closure*/) {}
+    void onReturn(ObjClosure * /*closure*/) {}
+    void onAllocate(Obj * /*obj*/) {}
+};
+
+/**
+ * @brief Prints the stack and each instruction before it is executed.
+ */
+class TracePolicy : public PlainPolicy {
+  public:
+    static constexpr bool enabled = true;
+
+    explicit TracePolicy(VM &vm) : vm(vm){};
+
+    void onInstruction(CallFrame *frame, uint8_t *ip);
+    void onRegInstruction(CallFrame *frame, RegInstr *pc);
+
+  private:
+    VM &vm;
+};
+
+/**
+ * @brief Counts instructions executed per opcode, calls per function and allocations.
+ * Also counts the pairs and triples of opcodes executed one after the other, which are
+ * the candidates for superinstructions.
+ */
+class ProfilePolicy : public PlainPolicy {
+  public:
+    static constexpr bool enabled = true;
+
+    ProfilePolicy() : triples(OPCODE_COUNT * OPCODE_COUNT * OPCODE_COUNT){};
+
+    void onInstruction(CallFrame * /*frame*/, uint8_t *ip) {
+        instructions[*ip]++;
+        pairs[(last[1] * OPCODE_COUNT) + *ip]++;
+        triples[(((last[0] * OPCODE_COUNT) + last[1]) * OPCODE_COUNT) + *ip]++;
+        last[0] = last[1];
+        last[1] = *ip;
+    }
+    void onRegInstruction(CallFrame * /*frame*/, RegInstr *pc) {
+        reg_instructions[size_t(pc->op)]++;
+    }
+    void onCall(ObjClosure *closure) { calls[closure->function]++; }
+    void onAllocate(Obj * /*obj*/) { allocations++; }
+
+    void report(std::ostream &os) const;
+
+  private:
+    std::array<size_t, OPCODE_COUNT>                 instructions{};
+    std::array<size_t, REGOP_COUNT>                  reg_instructions{};
+    std::array<size_t, OPCODE_COUNT * OPCODE_COUNT>  pairs{};
+    std::vector<size_t>                              triples;
+    std::array<size_t, 2>                            last{};
+    std::map<ObjFunction *, size_t>                  calls;
+    size_t                                           allocations{0};
+};
+
+/**
+ * @brief Records the source lines executed in each function.
+ */
+class CoveragePolicy : public PlainPolicy {
+  public:
+    static constexpr bool enabled = true;
+
+    void onInstruction(CallFrame *frame, uint8_t *ip);
+    void onRegInstruction(CallFrame *frame, RegInstr *pc);
+
+    void report(std::ostream &os) const;
+
+  private:
+    std::map<std::string, std::set<size_t>> lines;
+};
+
+/**
+ * @brief Forwards every event to the embedder's VMHooks.
+ */
+class HookPolicy {
+  public:
+    static constexpr bool enabled = true;
+
+    explicit HookPolicy(VMHooks &hooks) : hooks(hooks){};
+
+    void onInstruction(CallFrame *frame, uint8_t *ip) { hooks.onInstruction(frame, ip); }
+    void onRegInstruction(CallFrame *frame, RegInstr *pc) {
+        hooks.onRegInstruction(frame, pc);
+    }
+    void onCall(ObjClosure *closure) { hooks.onCall(closure); }
+    void onReturn(ObjClosure *closure) { hooks.onReturn(closure); }
+    void onAllocate(Obj *obj) { hooks.onAllocate(obj); }
+
+  private:
+    VMHooks &hooks;
+};
+
+} // namespace alox
@@ -38,20 +38,14 @@ Value getc(int /*argCount*/, Value const * /*args*/) {
     return value<double>(ch);
 }
 
-Value chr(int /*argCount*/, Value const *v) {
-    auto ch = char(as<double>(*v));
-    // weird to get one char string (not 0 terminated)
-    std::string s{1, ch};
-    s.erase(1);
-    s[0] = ch;
-    debug("chr: {}", s.size());
-    return value<Obj *>(newString(s));
+// The function runs when the coroutine is first called, see VM::resume().
+Value coroutine(int /*argCount*/, Value const *function) {
+    return value<Obj *>(newCoroutine(*function));
 }
 
-Value ord(int /*argCount*/, Value const *v) {
-    auto *s = as<ObjString *>(*v);
-    debug("ord: '{}'", s->str);
-    return value<double>(s->str[0]);
+Value done(int /*argCount*/, Value const *v) {
+    return value<bool>(is<ObjCoroutine>(*v) &&
+                       as<ObjCoroutine *>(*v)->state == ObjCoroutine::State::Done);
 }
 
 Value print_error(int /*argCount*/, Value const *value) {
@@ -62,7 +56,15 @@ Value print_error(int /*argCount*/, Value const *value) {
 void VM::defineNative(const std::string &name, NativeFn function) {
     push(value<Obj *>(newString(name)));
     push(value<Obj *>(newNative(function)));
-    globals.set(as<ObjString *>(stack[0]), stack[1]);
+    globals.define(as<ObjString *>(stack[0]), stack[1]);
+    pop();
+    pop();
+}
+
+void VM::defineNative(const std::string &name, VmNativeFn function) {
+    push(value<Obj *>(newString(name)));
+    push(value<Obj *>(newNative(function)));
+    globals.define(as<ObjString *>(stack[0]), stack[1]);
     pop();
     pop();
 }
@@ -71,13 +73,37 @@ void VM::def_stdlib() {
     defineNative("clock", clockNative);
     defineNative("exit", lox_exit);
     defineNative("getc", getc);
-    defineNative("chr", chr);
-    defineNative("ord", ord);
+    // Called by value, as in var f = chr, they check their argument as their opcodes do.
+    static constexpr auto intrinsic = [](VM &vm, int argCount, OpCode op) {
+        if (argCount != 1) {
+            return vm.nativeError(
+                fmt::format("Expected 1 arguments but got {:d}.", argCount));
+        }
+        return vm.intrinsic(op, vm.stackTop - 1) && vm.nativeResult(1, vm.peek(0));
+    };
+    defineNative("chr", [](VM &vm, int argCount) {
+        return intrinsic(vm, argCount, OpCode::CHR);
+    });
+    defineNative("ord", [](VM &vm, int argCount) {
+        return intrinsic(vm, argCount, OpCode::ORD);
+    });
     defineNative("print_error", print_error);
+    defineNative("coroutine", coroutine);
+    defineNative("done", done);
+
+    // The intrinsic opcodes run while these are the globals' values.
+    for (const auto &intrinsic : intrinsics) {
+        ObjString *name = newString(std::string(intrinsic.name));
+        natives[intrinsicIndex(intrinsic.op)] = globals.get_value(globals.slot(name));
+    }
 
     // Define generic empty class Object
     auto *obj_class = newClass(newString("Object"));
-    globals.set(obj_class->name, value<Obj *>(obj_class));
+    globals.define(obj_class->name, value<Obj *>(obj_class));
+    objectClass = obj_class;
+
+    def_io();
+    def_parallel();
 }
 
 } // namespace alox
\ No newline at end of file
@@ -4,16 +4,25 @@
 // Copyright © Alex Kowalenko 2022.
 //
 
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <functional>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 
 #include <fmt/core.h>
 #include <gtest/gtest.h>
+#include <unistd.h>
 
+#include "alox.hh"
 #include "compiler.hh"
 #include "parser.hh"
 #include "printer.hh"
+#include "shape.hh"
 
 using namespace alox;
 
@@ -23,7 +32,28 @@ struct ParseTests {
     std::string error;
 };
 
-auto do_eval_tests(std::vector<ParseTests> &tests) -> void;
+using Configure = std::function<void(Options &)>;
+// Sets up the VM before the tests run.
+using Prepare = std::function<void(VM &)>;
+
+auto do_eval_tests(std::vector<ParseTests> &tests, const Configure &configure = {},
+                   const Prepare &prepare = {}) -> void;
+
+// The stack VM, the register VM, and the JIT compiling each function at its first call.
+const std::vector<Configure> all_modes = {
+    [](Options &) {},
+    [](Options &options) { options.registers = true; },
+    [](Options &options) {
+        options.jit = true;
+        options.jit_threshold = 1;
+    },
+};
+
+auto do_eval_tests_all_modes(std::vector<ParseTests> &tests) -> void {
+    for (const Configure &mode : all_modes) {
+        do_eval_tests(tests, mode);
+    }
+}
 
 TEST(Eval, Basic) { // NOLINT
     std::vector<ParseTests> tests = {
@@ -143,8 +173,617 @@ TEST(Eval, class) { // NOLINT
     std::vector<ParseTests> tests = {
         {"class A{} var x = A(); print x;", "A instance", ""},
         {"class A{f(a) {print a;}} var x = A(); x.f(17);", "17", ""},
+        // instances after the first are made with room for the fields init adds.
+        {"class P { init(n) { this.a = n; this.b = n; this.c = n; this.d = n; "
+         "this.e = n; } } var p = P(1); var q = P(2); q.f = 3; print p.e + q.e + q.f + P(4).a;",
+         "10", ""},
+        {"class Q { init(x) { this.x = x; } } class R < Q {} print R(5).x;", "5", ""},
+        // one instance with extra fields sizes only the next one.
+        {"class T { init() { this.a = 1; } } var t = T(); t.b = 2; t.c = 3; t.d = 4; "
+         "var u = T(); var v = T(); v.b = 5; print t.d + u.a + v.a + v.b + T().a;",
+         "12", ""},
+        {"class S { init(x) {} } S();", "", "Expected 1 arguments but got 0."},
+    };
+    do_eval_tests(tests);
+}
+
+TEST(Eval, strings) { // NOLINT
+    // A string made in another heap is not the VM's interned one, but equal to it.
+    Heap       other;
+    ObjString *foreign = nullptr;
+    {
+        const Heap::Scope scope(other);
+        foreign = newString("cat");
+    }
+    std::vector<ParseTests> tests = {
+        {"fun eq(a, b) { return a == b; } print foreign == \"cat\"; "
+         "print eq(foreign, \"cat\"); print eq(\"cat\", foreign); "
+         "print foreign != \"cat\"; print eq(foreign, \"dog\");",
+         "true\ntrue\ntrue\nfalse\nfalse", ""},
+    };
+    for (const Configure &mode : all_modes) {
+        do_eval_tests(tests, mode, [foreign](VM &vm) {
+            vm.get_globals().define(newString("foreign"), value<Obj *>(foreign));
+        });
+    }
+}
+
+TEST(Eval, globals) { // NOLINT
+    // the VM keeps the global slots between inputs, like the REPL.
+    std::vector<ParseTests> tests = {
+        {"var g = 1;", "", ""},
+        {"print g;", "1", ""},
+        {"g = g + 1; print g;", "2", ""},
+        {"fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } "
+         "print fib(10);",
+         "55", ""},
+        {"print h;", "", "Undefined variable 'h'."},
+        {"h = 1;", "", "Undefined variable 'h'."},
+        {"var h = 3; print h + g;", "5", ""},
+        {"print clock() >= 0;", "true", ""},
+    };
+    do_eval_tests(tests);
+
+    // Once the slots run out, the names that have one can still be used.
+    std::string source;
+    for (int n = 0; n < GLOBALS_MAX; n++) {
+        source += fmt::format("var v{};", n);
+    }
+    std::ostringstream err;
+    std::ostringstream out;
+    Options            options(out, std::cin, err);
+    options.silent = true;
+    Alox alox(options);
+    alox.runString(source);
+    EXPECT_EQ(err.str().substr(0, err.str().find('\n')),
+              "[line 1] Error: Too many global variables.");
+    err.str("");
+    alox.runString("v1 = 2; print v1 + 1;");
+    EXPECT_EQ(out.str() + err.str(), "3\n");
+
+    // Defining a global past the last slot fails, not only compiling one.
+    Globals globals;
+    for (int n = 0; n < GLOBALS_MAX; n++) {
+        globals.slot(newString(fmt::format("g{}", n)));
+    }
+    EXPECT_THROW(globals.define(newString("more"), NIL_VAL), std::length_error);
+    EXPECT_EQ(globals.slot(newString("g7")), 7);
+}
+
+TEST(Eval, inline_cache) { // NOLINT
+    std::vector<ParseTests> tests = {
+        // one GET_PROPERTY site sees two shapes.
+        {"class A { init() { this.x = 1; } } "
+         "class B { init() { this.y = 0; this.x = 2; } } "
+         "fun f(o) { return o.x; } print f(A()) + f(B()) + f(A());",
+         "4", ""},
+        // a field added later hides the cached method.
+        {"class C { m() { return 1; } } fun two() { return 2; } var c = C(); "
+         "fun g(o) { return o.m(); } print g(c); c.m = two; print g(c);",
+         "1\n2", ""},
+        // SET_PROPERTY caches the transition and the existing slot.
+        {"class D {} fun s(o, v) { o.a = v; } var d = D(); var e = D(); "
+         "s(d, 1); s(e, 2); s(d, 3); print d.a + e.a;",
+         "5", ""},
+        {"class E {} fun h(o) { return o.z; } print h(E());", "",
+         "Undefined property 'z'."},
+    };
+    // past SHAPE_MAX_FIELDS the instance has a dictionary shape of its own.
+    std::string fields;
+    for (size_t n = 0; n <= SHAPE_MAX_FIELDS; n++) {
+        fields += fmt::format("o.f{0} = {0}; ", n);
+    }
+    tests.push_back({"class F { m() { return 1; } } fun two() { return 2; } "
+                     "fun g(o) { return o.m(); } fun fill(o) { " +
+                         fields +
+                         "} var a = F(); var b = F(); fill(a); fill(b); a.f1 = 7; "
+                         "print g(a) + a.f1 + b.f1 + a.f64; a.m = two; print g(a); "
+                         "print g(b);",
+                     "73\n2\n1", ""});
+    do_eval_tests(tests);
+}
+
+TEST(Eval, vtables) { // NOLINT
+    std::vector<ParseTests> tests = {
+        {"class A { f() { return \"A\"; } g() { return \"g\"; } } "
+         "class B < A { f() { return \"B\" + super.f(); } } class C < B {} "
+         "class D < C { f() { return \"D\" + super.f(); } } "
+         "print D().f() + C().f() + A().f() + D().g();",
+         "DBABAAg", ""},
+        // a method defined in a subclass is not in its superclass.
+        {"class E { init(x) { this.x = x; } } class F < E { h() { return this.x; } } "
+         "print F(3).h(); E(1).h();",
+         "3", "Undefined property 'h'."},
+        {"class G { m() {} } G().unknown();", "", "Undefined property 'unknown'."},
+        // a subclass's method numbered before its superclass's.
+        {"class H { early() {} } class I { late() { return \"l\"; } } "
+         "class J < I { early() { return \"e\"; } } class K < J {} "
+         "print K().early() + K().late() + I().late();",
+         "ell", ""},
+        {"class L { late() {} } L().early();", "", "Undefined property 'early'."},
+    };
+    do_eval_tests_all_modes(tests);
+}
+
+TEST(Eval, superinstructions) { // NOLINT
+    std::vector<ParseTests> tests = {
+        // LESS_JUMP_IF_FALSE and GET_LOCAL_LOCAL in a loop condition.
+        {"fun f(n) { var s = 0; for (var i = 0; i < n; i = i + 1) s = s + i; return s; } "
+         "print f(5);",
+         "10", ""},
+        // the value left by `and` when the comparison fails.
+        {"fun f(a, b) { return a < b and b; } print f(2, 1);", "false", ""},
+        {"fun f(a, b) { return a == b or 3; } print f(2, 2); print f(1, 2);", "true\n3",
+         ""},
+        // a jump into the middle of a sequence stops it being fused.
+        {"fun f(a) { if (a and a < 2) print 1; else print 2; } f(1); f(nil); f(3);",
+         "1\n2\n2", ""},
+        // GET_LOCAL_PROPERTY and SET_PROPERTY_POP.
+        {"class P {} fun f(p) { p.x = 1; p.x = p.x + 2; return p.x; } print f(P());",
+         "3", ""},
+        {"fun f(a) { return a < 1; } print f(nil);", "", "Operands must be numbers."},
+        {"fun f(a) { return a.x; } f(1);", "", "Only instances have properties."},
+    };
+    do_eval_tests(tests);
+}
+
+TEST(Eval, quickening) { // NOLINT
+    std::vector<ParseTests> tests = {
+        // ADD is quickened for numbers, then falls back for strings and stays generic.
+        {R"(fun add(a, b) { return a + b; } print add(1, 2); print add("a", "b"); )"
+         R"(print add(3, 4); print add("c", "d");)",
+         "3\nab\n7\ncd", ""},
+        {R"(fun add(a, b) { return a + b; } print add(1, 2); print add(1, "b");)", "3",
+         "Operands must be two numbers or two strings."},
+        {R"(fun eq(a, b) { return a == b; } print eq(1, 1); print eq("a", "a"); )"
+         R"(print eq(1, nil); print eq(2, 1);)",
+         "true\ntrue\nfalse\nfalse", ""},
+        {R"(fun ne(a, b) { return a != b; } print ne(1, 1); print ne(nil, nil); )"
+         R"(print ne(1, "a"); print ne(2, 1);)",
+         "false\nfalse\ntrue\ntrue", ""},
+    };
+    do_eval_tests(tests);
+
+    // A site that saw mixed types isn't quickened again.
+    const std::string source =
+        R"(fun add(a, b) { return a + b; } add(1, 2); add("a", "b"); add(3, 4);)";
+    std::ostringstream err;
+    std::ostringstream out;
+    Options            options(out, std::cin, err);
+    VM                 vm(options);
+    vm.init();
+    const Heap::Scope scope(vm.get_heap());
+    ErrorManager      errors(options.err);
+    Scanner           scanner(source);
+    Parser            parser(scanner, errors);
+    Compiler          compiler(options, errors, vm.get_globals());
+    ObjFunction      *script = compiler.compile(parser.parse());
+    vm.addProgram(source, script);
+    vm.run(script);
+
+    Globals            &globals = vm.get_globals();
+    const Value         add = globals.get_value(globals.slot(newString("add")));
+    Chunk              &chunk = as<ObjClosure *>(add)->function->chunk;
+    std::vector<OpCode> ops;
+    for (size_t offset = 0; offset < chunk.get_count();
+         offset += chunk.instruction_length(offset)) {
+        ops.push_back(OpCode(chunk.get_code(offset)));
+    }
+    EXPECT_NE(std::ranges::find(ops, OpCode::ADD_GENERIC), ops.end());
+}
+
+TEST(Eval, registers) { // NOLINT
+    std::vector<ParseTests> tests = {
+        {"var x = 1; { var y = x + 2; print y * 3; }", "9", ""},
+        // a local read before it is assigned keeps the old value.
+        {"{ var a = 1; var b = a + (a = 5); print b; print a; }", "6\n5", ""},
+        {"for (var i = 0; i < 3; i = i + 1) { var i = -1; print i; }", "-1\n-1\n-1", ""},
+        {"fun f(n) { var s = 0; while (n > 0) { s = s + n; n = n - 1; } return s; } "
+         "print f(4);",
+         "10", ""},
+        {"print nil or 2 and !false;", "true", ""},
+        {"fun f(a) { fun g() { return a; } return g; } print f(7)();", "7", ""},
+        {"class A { init(x) { this.x = x; } get() { return this.x; } } "
+         "class B < A { get() { return super.get() + 1; } } print B(2).get();",
+         "3", ""},
+        {"fun f(a) { return -a; } f(nil);", "", "Operand must be a number."},
+    };
+    do_eval_tests(tests, [](Options &options) { options.registers = true; });
+}
+
+TEST(Eval, jit) { // NOLINT
+    std::vector<ParseTests> tests = {
+        {"fun f(n) { var s = 0; for (var i = 0; i < n; i = i + 1) { s = s + i; } "
+         "return s; } print f(10); print f(100);",
+         "45\n4950", ""},
+        {"var g = 0; fun f() { g = g + 1; return g; } f(); f(); f(); print g;", "3", ""},
+        {"fun fib(n) { if (n < 2) return n; return fib(n - 2) + fib(n - 1); } "
+         "print fib(15);",
+         "610", ""},
+        {"var nan = 0 / 0; fun f(a, b) { return a == b; } "
+         "print f(1, 1); print f(nan, nan); print f(\"a\", \"a\"); print f(nil, false);",
+         "true\nfalse\ntrue\nfalse", ""},
+        {"class A { init(x) { this.x = x; } get() { return this.x; } } "
+         "fun f(a) { return a.get() + 1; } print f(A(1)); print f(A(2));",
+         "2\n3", ""},
+        {"fun f(a) { for (var i = 0; i < 3; i = i + 1) { a = a - 1; } } f(nil);", "",
+         "Operands must be numbers."},
+    };
+    do_eval_tests(tests, [](Options &options) {
+        options.jit = true;
+        options.jit_threshold = 1;
+    });
+}
+
+TEST(Eval, tail_calls) { // NOLINT
+    // Deeper than FRAMES_INITIAL.
+    std::vector<ParseTests> tests = {
+        {"fun f(n, s) { if (n == 0) return s; return f(n - 1, s + n); } "
+         "print f(1000, 0);",
+         "500500", ""},
+        {"fun even(n) { if (n == 0) return true; return (odd(n - 1)); } "
+         "fun odd(n) { if (n == 0) return false; return even(n - 1); } print even(501);",
+         "false", ""},
+        {"class A { down(n) { if (n == 0) return \"done\"; return this.down(n - 1); } } "
+         "print A().down(500);",
+         "done", ""},
+        {"fun f(n) { var x = n; fun g() { return x; } if (n == 0) return g; "
+         "return f(n - 1); } print f(100)();",
+         "0", ""},
+        {"class A { init(x) { this.x = x; } } fun f() { return A(2); } print f().x;", "2",
+         ""},
+        {"fun f() { return clock() >= 0; } print f();", "true", ""},
+        {"fun f(n) { return f(); } f(1);", "", "Expected 1 arguments but got 0."},
+    };
+    do_eval_tests_all_modes(tests);
+}
+
+TEST(Eval, deep_calls) { // NOLINT
+    // The stacks grow with open upvalues pointing into them.
+    std::vector<ParseTests> tests = {
+        // A closure that escaped before an error keeps its variable as the stacks grow.
+        {"var k; fun m() { var x = 1; fun h() { return x; } k = h; x = 2; nil(); } m();",
+         "", "Can only call functions and classes."},
+        {"fun d(n) { if (n == 0) return k(); return d(n - 1); } print d(3000);", "2",
+         ""},
+        {"fun f(n) { if (n == 0) return 0; return 1 + f(n - 1); } print f(3000);", "3000",
+         ""},
+        {"fun f(n) { var x = n; fun g() { return x; } if (n == 0) return g; "
+         "var h = f(n - 1); x = x + h(); return g; } print f(1000)();",
+         "500500", ""},
+        {"class A { down(n) { if (n == 0) return 0; return 1 + this.down(n - 1); } } "
+         "print A().down(2000);",
+         "2000", ""},
+        {"fun f() { return 1 + f(); } f();", "", "Stack overflow."},
+    };
+    do_eval_tests_all_modes(tests);
+
+    tests = {
+        {"fun f(n) { if (n == 0) return 0; return 1 + f(n - 1); } print f(50);", "50",
+         ""},
+        {"fun f(n) { if (n == 0) return 0; return 1 + f(n - 1); } print f(200);", "",
+         "Stack overflow."},
+    };
+    do_eval_tests(tests, [](Options &options) { options.max_frames = 100; });
+
+    // The script itself doesn't fit.
+    tests = {
+        {"print 1;", "", "Stack overflow."},
+    };
+    do_eval_tests(tests, [](Options &options) { options.max_frames = 0; });
+
+    // The traceback of a stack overflow prints the innermost frames only.
+    {
+        std::ostringstream err;
+        std::ostringstream out;
+        Options            options(out, std::cin, err);
+        options.silent = true;
+        Alox alox(options);
+        alox.runString("fun f(n) { if (n == 0) return 0; return 1 + f(n - 1); } "
+                       "print f(20000);");
+        const std::string trace = err.str();
+        EXPECT_EQ(std::count(trace.begin(), trace.end(), '\n'), TRACE_FRAMES + 2);
+        EXPECT_TRUE(trace.ends_with(
+            fmt::format("... {} more frames\n", options.max_frames - TRACE_FRAMES)));
+    }
+
+    // A program with a compile error still runs, and its functions still grow the stacks.
+    for (const Configure &mode : all_modes) {
+        std::ostringstream err;
+        std::ostringstream out;
+        Options            options(out, std::cin, err);
+        options.silent = true;
+        mode(options);
+        Alox alox(options);
+        alox.runString("fun bad() { print this; } "
+                       "fun deep(n) { if (n == 0) return 0; return 1 + deep(n - 1); } "
+                       "print deep(5000);");
+        EXPECT_EQ(out.str(), "5000\n");
+    }
+}
+
+TEST(Eval, closures) { // NOLINT
+    // Variables that are never assigned are copied, the others are shared.
+    std::vector<ParseTests> tests = {
+        {"fun f(a) { fun g(b) { fun h() { return a + b; } return h; } return g; } "
+         "print f(1)(2)();",
+         "3", ""},
+        {"fun f() { var n = 0; fun inc() { n = n + 1; return n; } inc(); return inc; } "
+         "print f()();",
+         "2", ""},
+        {"fun f() { var x = 1; fun g() { return x; } x = 2; return g; } print f()();",
+         "2", ""},
+        {"fun f() { var x = 1; fun g() { fun h() { x = x + 1; } h(); return x; } "
+         "return g; } var g = f(); g(); print g();",
+         "3", ""},
+        {"fun f(n) { if (n == 0) return 0; return n + f(n - 1); } "
+         "fun g() { fun h(n) { if (n == 0) return 0; return n + h(n - 1); } return h; } "
+         "print f(3) + g()(3);",
+         "12", ""},
+        {"{ var a = \"a\"; fun f() { return a; } print f(); }", "a", ""},
+        {"class A { m() { fun g() { return this.x; } return g; } } var a = A(); a.x = 4; "
+         "print a.m()();",
+         "4", ""},
+    };
+    do_eval_tests_all_modes(tests);
+}
+
+TEST(Eval, local_functions) { // NOLINT
+    // Local functions that are only called get what they capture as arguments.
+    std::vector<ParseTests> tests = {
+        {"fun f(n) { var k = 3; var s = 0; for (var i = 0; i < n; i = i + 1) { "
+         "fun sq(x) { return x * x + k; } s = s + sq(i); } return s; } print f(4);",
+         "26", ""},
+        {"fun f() { var a = 1; fun h() { return a; } { var a = 2; return h() + a; } } "
+         "print f();",
+         "3", ""},
+        {"fun f() { var a = 1; fun h(x) { return x + a; } return h(1) + h(2); } "
+         "print f(); print f();",
+         "5\n5", ""},
+        {"fun f() { fun g() {} return g; } print f() == f();", "false", ""},
+        {"fun f() { var a = 1; fun h() { return a; } fun g() { return h(); } "
+         "return g(); } print f();",
+         "1", ""},
+        {"fun f() { var a = 1; fun h() { return a; } a = 2; return h(); } print f();",
+         "2", ""},
+        {"fun f() { fun h(n) { if (n == 0) return 0; return n + h(n - 1); } "
+         "return h(4); } print f();",
+         "10", ""},
+        {"fun f() { var a = 1; fun h(x) { return x + a; } return h(1, 2); } f();", "",
+         "Expected 1 arguments but got 2."},
+    };
+    do_eval_tests_all_modes(tests);
+}
+
+TEST(Eval, direct_calls) { // NOLINT
+    // Global functions that are never assigned are called without looking them up.
+    std::vector<ParseTests> tests = {
+        {"fun fib(n) { if (n < 2) return n; return fib(n - 2) + fib(n - 1); } "
+         "print fib(10);",
+         "55", ""},
+        {"fun even(n) { if (n == 0) return true; var r = odd(n - 1); return r; } "
+         "fun odd(n) { if (n == 0) return false; var r = even(n - 1); return r; } "
+         "print even(4);",
+         "true", ""},
+        {"fun f() { return 1; } fun g() { return 2; } f = g; print f();", "2", ""},
+        {"fun f() { return 1; } { fun f() { return 2; } print f(); }", "2", ""},
+        {"fun f(a) { return a; } fun g(f) { return f(3); } print g(f);", "3", ""},
+        {"var f = 1; fun f() { return 2; } print f();", "2", ""},
+        {"f(); fun f() {}", "", "Undefined variable 'f'."},
+        {"fun f(a) {} f();", "", "Expected 1 arguments but got 0."},
+    };
+    do_eval_tests_all_modes(tests);
+}
+
+TEST(Eval, intrinsics) { // NOLINT
+    // Calls of clock, getc, chr and ord by name are opcodes, unless the name is defined.
+    std::vector<ParseTests> tests = {
+        {R"(print ord("A");)", "65", ""},
+        {"print chr(66);", "B", ""},
+        {R"(print chr(ord("a") + 1);)", "b", ""},
+        {"print clock() >= 0;", "true", ""},
+        {R"(var f = ord; print f("C");)", "67", ""},
+        {"ord(1);", "", "Argument to ord must be a string."},
+        {R"(chr("x");)", "", "Argument to chr must be a number."},
+        {"print chr(1000);", "", "Argument to chr must be from 0 to 255."},
+        {"print chr(-1000000 * 1000000);", "", "Argument to chr must be from 0 to 255."},
+        {"print chr(0 / 0);", "", "Argument to chr must be from 0 to 255."},
+        {"print ord(chr(200)) == 200;", "true", ""},
+        {R"(print ord("");)", "", "Argument to ord must not be empty."},
+        {"var f = chr; print f(256);", "", "Argument to chr must be from 0 to 255."},
+        {"var f = ord; print f(1);", "", "Argument to ord must be a string."},
+        {"{ fun chr(n) { return n; } print chr(5); }", "5", ""},
+        {R"(fun up(s) { return chr(ord(s) - 32); } print up("a");)", "A", ""},
+        // up was compiled with the native.
+        {R"(fun ord(s) { return 98; } print up("a");)", "B", ""},
+    };
+    do_eval_tests_all_modes(tests);
+}
+
+TEST(Eval, exceptions) { // NOLINT
+    std::vector<ParseTests> tests = {
+        {R"(try { throw "a"; } catch (e) { print e; })", "a", ""},
+        {"try { print 1; } catch (e) { print 2; }", "1", ""},
+        {"try { print -nil; } catch (e) { print e; }", "Operand must be a number.", ""},
+        {"try { nil(); } catch (e) { print e; }", "Can only call functions and classes.",
+         ""},
+        {"fun f(n) { if (n == 0) throw 7; f(n - 1); } "
+         "try { f(50); } catch (e) { print e; }",
+         "7", ""},
+        // A return in a try block is not a tail call, so the handler stays.
+        {"fun g() { throw 8; } fun h() { try { return g(); } catch (e) { return -e; } } "
+         "print h();",
+         "-8", ""},
+        {"try { try { throw 1; } catch (e) { throw e + 1; } } "
+         "catch (e) { print e; }",
+         "2", ""},
+        {"{ var a = 1; try { var b = 2; throw a; } catch (e) { print a + e; } }", "2",
+         ""},
+        {"throw 3;", "", "Uncaught exception: 3"},
+    };
+    do_eval_tests_all_modes(tests);
+}
+
+TEST(Eval, coroutines) { // NOLINT
+    std::vector<ParseTests> tests = {
+        {"fun g(n) { for (var i = 0; i < n; i = i + 1) yield i; return -1; } "
+         "var c = coroutine(g); print c(2); print c(); print c(); print done(c);",
+         "0\n1\n-1\ntrue", ""},
+        {"fun g() { var a = yield 1; print a; } var c = coroutine(g); c(); c(5);", "5",
+         ""},
+        // A closure made in the coroutine keeps its variable when the stacks switch.
+        {"fun g() { var x = 1; fun f() { return x; } yield f; x = 2; yield f; } "
+         "var c = coroutine(g); var f = c(); print f(); c(); print f();", "1\n2", ""},
+        {"fun i() { yield 1; return 2; } "
+         "fun o() { var c = coroutine(i); yield c() + 10; yield c() + 20; } "
+         "var c = coroutine(o); print c(); print c();", "11\n22", ""},
+        {"fun g() { yield 1; throw 2; } var c = coroutine(g); c(); "
+         "try { c(); } catch (e) { print e; } print done(c);", "2\ntrue", ""},
+        {"fun g() { return 1; } var c = coroutine(g); c(); c();", "",
+         "Can't resume a finished coroutine."},
+        {"fun g() { yield 1; } g();", "", "Can't yield outside a coroutine."},
+        // The closure keeps its variable after an error ends the coroutine.
+        {"var f; fun g() { var x = 6; fun h() { return x; } f = h; x = 7; yield 1; "
+         "nil(); } var c = coroutine(g); c(); c();",
+         "", "Can only call functions and classes."},
+        {"print f();", "7", ""},
+    };
+    do_eval_tests_all_modes(tests);
+}
+
+TEST(Eval, events) { // NOLINT
+    const std::string file =
+        (std::filesystem::temp_directory_path() / "alox_events").string();
+    std::vector<ParseTests> tests = {
+        {"fun a() { for (var i = 0; i < 2; i = i + 1) { print i; yield nil; } } "
+         "fun b() { print \"b\"; } task(a); task(b); print run();",
+         "0\nb\n1\nnil", ""},
+        // The reader waits on the pipe while the writer sleeps.
+        {"var p = pipe(); "
+         "fun r() { var s = read(p.read, 8); while (s != nil) { print s; "
+         "s = read(p.read, 8); } close(p.read); } "
+         "fun w() { write(p.write, \"x\"); sleep(2); write(p.write, \"y\"); "
+         "close(p.write); } task(r); task(w); run();",
+         "x\ny", ""},
+        {"fun s() { sleep(10); print 1; } fun f() { sleep(1); print 2; } "
+         "task(s); task(f); run();",
+         "2\n1", ""},
+        {fmt::format("var f = open(\"{0}\", \"w\"); print write(f, \"abc\"); close(f); "
+                     "f = open(\"{0}\", \"r\"); print read(f, 2); print read(f, 2); "
+                     "print read(f, 2); close(f);",
+                     file),
+         "3\nab\nc\nnil", ""},
+        {"var p = pipe(); "
+         "fun r() { try { read(p.read, 1); } catch (e) { print \"closed\"; } } "
+         "fun c() { close(p.read); } task(r); task(c); run(); close(p.write);",
+         "closed", ""},
+        {"fun t() { throw 1; } task(t); try { run(); } catch (e) { print e; }", "1", ""},
+        {"fun t() { run(); } task(t); run();", "", "Can't run the event loop in a task."},
+        {"fun f() {} var t = task(f); t();", "", "Can't resume a task."},
+        {"fun t() { sleep(0 / 0); } task(t); run();", "",
+         "Expected a number of milliseconds."},
+        {"sleep(-1);", "", "Expected a number of milliseconds."},
+        {"sleep(1 / 0);", "", "Expected a number of milliseconds."},
+        // A sleep too long for the clock is cut short, and the other tasks still run.
+        {"fun s() { sleep(100000000000000000000); } fun p() { print 2; } "
+         "fun t() { throw 1; } task(s); task(p); task(t); "
+         "try { run(); } catch (e) { print e; }",
+         "2\n1", ""},
+    };
+    do_eval_tests_all_modes(tests);
+    std::filesystem::remove(file);
+
+    // The natives didn't open the pipe, so it blocks: the reader waits for it in the
+    // loop, and the other task runs first.
+    int fds[2];
+    ASSERT_EQ(::pipe(fds), 0);
+    std::thread writer([fds] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        EXPECT_EQ(::write(fds[1], "x", 1), 1);
+    });
+    tests = {
+        {fmt::format("fun r() {{ print read({}, 8); }} fun b() {{ print \"b\"; }} "
+                     "task(r); task(b); run();",
+                     fds[0]),
+         "b\nx", ""},
+        {"print read(0, -1);", "", "Expected a descriptor and a number of bytes."},
+        {"print read(0, 0 / 0);", "", "Expected a descriptor and a number of bytes."},
     };
     do_eval_tests(tests);
+    writer.join();
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST(Eval, spawn) { // NOLINT
+    std::vector<ParseTests> tests = {
+        {"fun sq(x) { return x * x; } var a = spawn(sq, 3); var b = spawn(sq, 4); "
+         "print join(a) + join(b);",
+         "25", ""},
+        // The worker has the global fib, and a copy of greeting.
+        {"fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } "
+         "print join(spawn(fib, 20));",
+         "6765", ""},
+        {"var greeting = \"hi \"; fun greet(name) { return greeting + name; } "
+         "print join(spawn(greet, \"bob\"));",
+         "hi bob", ""},
+        {"var n = 1; fun inc() { n = n + 1; return n; } print join(spawn(inc)); print n;",
+         "2\n1", ""},
+        {"fun f() { throw \"x\"; } try { join(spawn(f)); } catch (e) { print e; }",
+         "Uncaught exception: x", ""},
+        {"fun f() { return nil(); } join(spawn(f));", "",
+         "Can only call functions and classes."},
+        {"fun f() { class B {} return B(); } join(spawn(f));", "",
+         "A spawned function can only return numbers, booleans, nil, strings, functions "
+         "and classes."},
+        {"class A {} fun f(a) {} spawn(f, A());", "",
+         "Can only pass numbers, booleans, nil, strings, functions and classes to a "
+         "spawned function."},
+        {"fun o() { var x = 1; fun i() { return x; } return i; } spawn(o());", "",
+         "Can only spawn functions that capture no variables."},
+        {"fun p(x) { print x; return x + 1; } var h = spawn(p, 1); print 0; "
+         "print join(h);",
+         "0\n1\n2", ""},
+        {"fun f() {} var h = spawn(f); join(h); join(h);", "",
+         "Expected the handle of a spawned function not joined."},
+        {"print join(0 / 0);", "",
+         "Expected the handle of a spawned function not joined."},
+        {"print join(1000000 * 1000000 * 1000000);", "",
+         "Expected the handle of a spawned function not joined."},
+        {"fun f() {} var h = spawn(f); print join(h + 0.5);", "",
+         "Expected the handle of a spawned function not joined."},
+        // A function using a global that can't be copied isn't spawned.
+        {"class C {} var c = 1; fun get() { return c; } "
+         "for (var i = 0; i < 64; i = i + 1) join(spawn(get)); "
+         "c = C(); for (var i = 0; i < 64; i = i + 1) print join(spawn(get));",
+         "", "Can't spawn a function that uses 'c', which can't be copied."},
+        // and through the functions it calls.
+        {"var c = 1; fun get() { return c; } fun g() { return get(); } class D {} "
+         "c = D(); spawn(g);",
+         "", "Can't spawn a function that uses 'c', which can't be copied."},
+        // Classes are made again in the worker.
+        {"class Tree { init(d) { this.d = d; if (d > 0) { this.l = Tree(d - 1); "
+         "this.r = Tree(d - 1); } } count() { if (this.d == 0) return 1; "
+         "return 1 + this.l.count() + this.r.count(); } } "
+         "fun make(d) { return Tree(d).count(); } "
+         "print join(spawn(make, 4)) + join(spawn(make, 3));",
+         "46", ""},
+        {"class A { f() { return \"a\"; } } class B < A { g() { return \"b\"; } } "
+         "fun h() { var b = B(); return b.f() + b.g(); } print join(spawn(h));",
+         "ab", ""},
+        {"class P { init(x) { this.x = x; } } fun mk(k, x) { return k(x).x; } "
+         "fun id(k) { return k; } print join(spawn(mk, P, 5)); "
+         "print join(spawn(id, P)) == P;",
+         "5\ntrue", ""},
+        {"fun f() { class L { n() { return 3; } } return L; } "
+         "print join(spawn(f))().n();",
+         "3", ""},
+        // A method using super captures its class's superclass.
+        {"class A { f() { return 1; } } class B < A { f() { return super.f(); } } "
+         "fun g() { return B().f(); } spawn(g);",
+         "", "Can't spawn a function that uses 'B', which can't be copied."},
+    };
+    do_eval_tests_all_modes(tests);
 }
 
 inline std::string rtrim(std::string s) {
@@ -158,16 +797,24 @@ std::string nl_trim(std::string s) {
     return s.substr(0, s.find_first_of('\n'));
 }
 
-void do_eval_tests(std::vector<ParseTests> &tests) {
+void do_eval_tests(std::vector<ParseTests> &tests, const Configure &configure,
+                   const Prepare &prepare) {
 
     std::ostringstream err;
     std::ostringstream out;
     Options            options(out, std::cin, err);
     options.silent = true;
+    if (configure) {
+        configure(options);
+    }
     VM vm(options);
     vm.init();
-    ErrorManager errors(options.err);
+    const Heap::Scope scope(vm.get_heap());
+    ErrorManager      errors(options.err);
     vm.set_error_manager(&errors);
+    if (prepare) {
+        prepare(vm);
+    }
 
     for (auto const &t : tests) {
         try {
@@ -184,8 +831,9 @@ void do_eval_tests(std::vector<ParseTests> &tests) {
                 continue;
             }
 
-            Compiler     compiler(options, errors);
+            Compiler     compiler(options, errors, vm.get_globals());
             ObjFunction *function = compiler.compile(ast);
+            vm.addProgram(t.input, function);
             if (errors.hadError) {
                 EXPECT_EQ(rtrim(err.str()), t.error);
                 continue; // I
@@ -202,4 +850,81 @@ void do_eval_tests(std::vector<ParseTests> &tests) {
             FAIL();
         }
     }
-}
\ No newline at end of file
+}
+
+class CountingHooks : public VMHooks {
+  public:
+    void onInstruction(CallFrame * /*frame*/, uint8_t * /*ip*/) override { instructions++; }
+    void onRegInstruction(CallFrame * /*frame*/, RegInstr * /*pc*/) override {
+        reg_instructions++;
+    }
+    void onCall(ObjClosure * /*closure*/) override { calls++; }
+    void onReturn(ObjClosure * /*closure*/) override { returns++; }
+    void onAllocate(Obj * /*obj*/) override { allocations++; }
+
+    int instructions{0};
+    int reg_instructions{0};
+    int calls{0};
+    int returns{0};
+    int allocations{0};
+};
+
+TEST(Eval, hooks) { // NOLINT
+    for (const bool registers : {false, true}) {
+        std::ostringstream err;
+        std::ostringstream out;
+        Options            options(out, std::cin, err);
+        options.registers = registers;
+        VM vm(options);
+        vm.init();
+        const Heap::Scope scope(vm.get_heap());
+        ErrorManager      errors(options.err);
+        vm.set_error_manager(&errors);
+        CountingHooks hooks;
+        vm.set_hooks(&hooks);
+
+        const std::string source = "class A{} fun f(a) {return A();} f(1); f(2);";
+        Scanner           scanner(source);
+        Parser            parser(scanner, errors);
+        auto             *ast = parser.parse();
+
+        Compiler compiler(options, errors, vm.get_globals());
+        EXPECT_EQ(vm.run(compiler.compile(ast)), INTERPRET_OK);
+        EXPECT_GT(registers ? hooks.reg_instructions : hooks.instructions, 0);
+        EXPECT_EQ(registers ? hooks.instructions : hooks.reg_instructions, 0);
+        EXPECT_EQ(hooks.calls, 3);       // script, f, f
+        EXPECT_EQ(hooks.returns, 3);     // f, f, script
+        EXPECT_EQ(hooks.allocations, 3); // class A, 2 instances: f's closure is a constant
+    }
+}
+
+// Each Alox has a heap of its own, so they run on threads of their own at the same time.
+TEST(Eval, instances) { // NOLINT
+    constexpr int            count = 4;
+    std::vector<std::string> outputs(count);
+    std::vector<std::thread> threads;
+    for (int n = 0; n < count; n++) {
+        threads.emplace_back([n, &output = outputs[n]] {
+            const std::string source = fmt::format(
+                "class A{0} {{ init(name) {{ this.name = name; this.n = 0; }} "
+                "add{0}(k) {{ this.n = this.n + k; return this; }} }} "
+                "var a = A{0}(\"a\" + \"{0}\"); "
+                "for (var i = 0; i < 100; i = i + 1) a.add{0}(i); "
+                "print a.name == \"a{0}\"; print a.n + {0};",
+                n);
+            std::ostringstream err;
+            std::ostringstream out;
+            Options            options(out, std::cin, err);
+            options.silent = true;
+            Alox alox(options);
+            alox.runString(source);
+            output = out.str() + err.str();
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (int n = 0; n < count; n++) {
+        EXPECT_EQ(outputs[n], fmt::format("true\n{}\n", 4950 + n));
+    }
+}
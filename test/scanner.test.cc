@@ -46,6 +46,7 @@ TEST(Scanner, basic) { // NOLINT
         // keywords
         {"and", TokenType::AND, "and"},
         {"break", TokenType::BREAK, "break"},
+        {"catch", TokenType::CATCH, "catch"},
         {"class", TokenType::CLASS, "do"},
         {"continue", TokenType::CONTINUE, "else"},
         {"else", TokenType::ELSE, "elseif"},
@@ -56,8 +57,11 @@ TEST(Scanner, basic) { // NOLINT
         {"nil", TokenType::NIL, "nil"},
         {"return", TokenType::RETURN, "retrun"},
         {"this", TokenType::THIS, "true"},
+        {"throw", TokenType::THROW, "throw"},
         {"true", TokenType::TRUE, "true"},
+        {"try", TokenType::TRY, "try"},
         {"while", TokenType::WHILE, "while"},
+        {"yield", TokenType::YIELD, "yield"},
         {"var", TokenType::VAR, "until"},
         {"super", TokenType::SUPER, "__builtin"},
     };
@@ -4,6 +4,7 @@
 // Copyright © Alex Kowalenko 2022.
 //
 
+#include "heap.hh"
 #include "object.hh"
 #include "table.hh"
 
@@ -39,3 +40,111 @@ TEST(Table, basic) { // NOLINT
     EXPECT_EQ(is<bool>(v), true);
     EXPECT_EQ(as<bool>(v), true);
 }
+
+TEST(String, interned) { // NOLINT
+    auto *a = newString("cat");
+    auto *b = newString(std::string("ca") + "t");
+    EXPECT_EQ(a, b);
+    EXPECT_NE(a, newString("dog"));
+    EXPECT_EQ(valuesEqual(value<Obj *>(a), value<Obj *>(b)), true);
+
+    Table table;
+    table.set(a, value<double>(1));
+    Value v;
+    EXPECT_EQ(table.get(b, &v), true);
+    EXPECT_EQ(as<double>(v), 1);
+}
+
+TEST(String, heaps) { // NOLINT
+    // Strings are interned in their heap: the same text from two heaps is two strings.
+    Heap       other;
+    ObjString *a = newString("cat");
+    ObjString *b = nullptr;
+    {
+        const Heap::Scope scope(other);
+        b = newString("cat");
+    }
+    EXPECT_NE(a, b);
+    EXPECT_EQ(valuesEqual(value<Obj *>(a), value<Obj *>(b)), true);
+
+    Table table;
+    table.set(a, value<double>(1));
+    Value v;
+    EXPECT_EQ(table.get(b, &v), true);
+    EXPECT_EQ(as<double>(v), 1);
+}
+
+TEST(Shape, transitions) { // NOLINT
+    auto *klass = newClass(newString("A"));
+    auto *a = newInstance(klass);
+    auto *b = newInstance(klass);
+
+    a->set_field(newString("x"), value<double>(1));
+    a->set_field(newString("y"), value<double>(2));
+    b->set_field(newString("x"), value<double>(3));
+    b->set_field(newString("y"), value<double>(4));
+    EXPECT_EQ(a->shape, b->shape);
+    EXPECT_EQ(a->shape->get_count(), 2);
+    EXPECT_EQ(a->shape->lookup(newString("y")), 1);
+
+    Value v;
+    EXPECT_EQ(b->get_field(newString("x"), &v), true);
+    EXPECT_EQ(as<double>(v), 3);
+    EXPECT_EQ(b->get_field(newString("z"), &v), false);
+
+    // different order, different shape
+    auto *c = newInstance(klass);
+    c->set_field(newString("y"), value<double>(5));
+    c->set_field(newString("x"), value<double>(6));
+    EXPECT_NE(a->shape, c->shape);
+    EXPECT_EQ(c->get_field(newString("x"), &v), true);
+    EXPECT_EQ(as<double>(v), 6);
+}
+
+TEST(Class, vtable_size) { // NOLINT
+    // Each class has init, numbered first, and two methods of its own numbered after
+    // those of all the classes before it, but takes no more room than the first.
+    auto *init = newClosure(newFunction());
+    auto *f0 = newString("f0");
+    for (int n = 0; n < 1000; n++) {
+        auto *klass = newClass(newString(fmt::format("C{}", n)));
+        auto *f = newClosure(newFunction());
+        auto *g = newClosure(newFunction());
+        klass->set_method(newString("init"), init);
+        klass->set_method(newString(fmt::format("f{}", n)), f);
+        klass->set_method(newString(fmt::format("g{}", n)), g);
+        EXPECT_EQ(klass->find_method(newString("init")), init);
+        EXPECT_EQ(klass->find_method(newString(fmt::format("f{}", n))), f);
+        EXPECT_EQ(klass->find_method(newString(fmt::format("g{}", n))), g);
+        if (n > 0) {
+            EXPECT_EQ(klass->find_method(f0), nullptr);
+        }
+        // the three methods, and at most twice as many indexed.
+        EXPECT_LE(klass->vtable_size(), 3 * 3);
+    }
+}
+
+TEST(Shape, dictionary) { // NOLINT
+    auto *klass = newClass(newString("B"));
+    auto *a = newInstance(klass);
+    auto *b = newInstance(klass);
+    for (size_t n = 0; n < 1000; n++) {
+        a->set_field(newString(fmt::format("f{}", n)), value<double>(double(n)));
+        if (n < SHAPE_MAX_FIELDS) {
+            b->set_field(newString(fmt::format("f{}", n)), value<double>(double(n)));
+        }
+    }
+    // the tree stops at SHAPE_MAX_FIELDS, so b shares it and a has its own.
+    EXPECT_EQ(b->shape->is_dictionary(), false);
+    EXPECT_EQ(a->shape->is_dictionary(), true);
+    EXPECT_EQ(a->shape->get_count(), 1000);
+    EXPECT_EQ(a->shape->lookup(newString("f999")), 999);
+    EXPECT_EQ(b->shape->lookup(newString("f3")), 3);
+    EXPECT_EQ(b->shape->lookup(newString("f999")), -1);
+
+    Value v;
+    for (size_t n = 0; n < 1000; n++) {
+        EXPECT_EQ(a->get_field(newString(fmt::format("f{}", n)), &v), true);
+        EXPECT_EQ(as<double>(v), double(n));
+    }
+}
@@ -26,7 +26,7 @@ type Class = {
 let classes: Array<Class> = [
     {
         name: "Declaration",
-        instances: [{ type: "std::vector<Obj *>", name: "stats" }]
+        instances: [{ type: "std::vector<Obj *>", name: "stats" }, { type: "std::vector<std::string>", name: "assigned" }]
     },
     {
         name: "Statement",
@@ -104,9 +104,21 @@ let classes: Array<Class> = [
         name: "Return",
         instances: [{ type: "Expr *", name: "expr" }]
     },
+    {
+        name: "Try",
+        instances: [{ type: "Block *", name: "body" }, { type: "Identifier*", name: "var" }, { type: "Block *", name: "handler" }]
+    },
+    {
+        name: "Throw",
+        instances: [{ type: "Expr *", name: "expr" }]
+    },
+    {
+        name: "Yield",
+        instances: [{ type: "Expr *", name: "expr" }]
+    },
     {
         name: "FunctDec",
-        instances: [{ type: "Identifier*", name: "name" }, { type: "std::vector<Identifier*>", name: "parameters" }, { type: "Block *", name: "body" }]
+        instances: [{ type: "Identifier*", name: "name" }, { type: "std::vector<Identifier*>", name: "parameters" }, { type: "Block *", name: "body" }, { type: "std::vector<std::string>", name: "assigned" }]
     },
     {
         name: "Call",
@@ -6,11 +6,16 @@
 //
 
 import * as fs from "fs";
+import * as os from "os";
+import * as path from "path";
 import { spawn } from "child_process";
 
 const base_dir = "../xtest"
 const prog_file = "../bin/alox"
 const exec_file = prog_file
+// ALOX_AOT=1 runs the tests as executables made by aloxc, alox --emit-cpp and a build.
+const aot_compiler = "../bin/aloxc"
+// ALOX_REGISTERS=1 runs the tests with alox --registers.
 
 type SpawnResult = {
     stderr: string,
@@ -103,6 +108,8 @@ function get_expected(name: string): FileInfo {
 
 type TestOptions = {
     bytecode?: boolean;
+    aot?: boolean;
+    registers?: boolean;
 }
 
 async function execute_test(name: string, options: TestOptions): Promise<FileInfo> {
@@ -110,13 +117,33 @@ async function execute_test(name: string, options: TestOptions): Promise<FileInf
 
     const file = `${base_dir}/${name}`;
     // console.log(`do ${file}`)
+    if (options.aot) {
+        const dir = fs.mkdtempSync(path.join(os.tmpdir(), "xtest-"));
+        try {
+            const program = `${dir}/program`;
+            const compiled = await spawnP(aot_compiler, [file, program]) as SpawnResult;
+            if (compiled.status != 0) {
+                return file_info(compiled);
+            }
+            return file_info(await spawnP(program, []) as SpawnResult);
+        } finally {
+            fs.rmSync(dir, { recursive: true, force: true });
+        }
+    }
     let cmd = `${exec_file} `
+    if (options.registers) {
+        cmd += `--registers `;
+    }
     cmd += `${file}`;
     // console.log("cmd: " + cmd)
     const args = cmd.split(' ');
     let { stdout, stderr, status } = await spawnP(args[0], args.slice(1)) as SpawnResult;
     // console.log("error: " + stderr)
     // console.log("output: " + stdout)
+    return file_info({ stdout, stderr, status });
+}
+
+function file_info({ stdout, stderr, status }: SpawnResult): FileInfo {
     let test_result = new FileInfo(stdout.split('\n'), stderr.split('\n'));
     test_result.status = status
     return test_result;
@@ -127,7 +154,7 @@ async function test_with_options(name: string, file_expected: FileInfo, options:
     let test_name = name;
 
     test(test_name, async () => {
-        jest.setTimeout(10000);
+        jest.setTimeout(options.aot ? 60000 : 10000); // the C++ build takes a while
         let test_result = await execute_test(name, options);
 
         for (let i = 0; i < file_expected.output.length && i < test_result.output.length; i++) {
@@ -143,7 +170,10 @@ async function test_with_options(name: string, file_expected: FileInfo, options:
 
 async function run_test(name: string) {
     let file_expected = get_expected(name);
-    let options = {} as TestOptions;
+    let options = {
+        aot: !!process.env.ALOX_AOT,
+        registers: !!process.env.ALOX_REGISTERS,
+    } as TestOptions;
 
     test_with_options(name, file_expected, options);
 